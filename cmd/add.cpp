@@ -1,10 +1,26 @@
 #include "add.hpp"
+#include "save.hpp"
 #include "../utils/main.hpp"
+#include "../utils/chunks.hpp"
+#include "../utils/object_store.hpp"
+#include "../utils/hasher.hpp"
+#include "../utils/index.hpp"
+#include "../utils/io_engine.hpp"
+#include "../utils/tree.hpp"
+#include "../utils/parallel.hpp"
+#include "../utils/thread_pool.hpp"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <filesystem>
 #include <vector>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
@@ -12,114 +28,282 @@ namespace cmd
 {
   Command *addCmd = nullptr;
 
-  bool UpdateIndex(const std::string &filePath, const std::string &hash)
-  {
-    std::string indexPath = utils::DEFAULT_PATH + "/index";
-    std::string existing;
+  // Files smaller than this are read and stored in batches
+  const size_t BATCH_FILE_SIZE = 1024 * 1024;
 
-    // Read existing index
-    std::ifstream indexFile(indexPath);
-    if (indexFile.is_open())
-    {
-      std::stringstream buffer;
-      buffer << indexFile.rdbuf();
-      existing = buffer.str();
-      indexFile.close();
-    }
+  // Files handed to the I/O engine at once, and the most data one batch of
+  // the worker pool holds before the next batch is started
+  const size_t ADD_BATCH_FILES = 256;
+  const uint64_t ADD_BATCH_BYTES = 64 * 1024 * 1024;
 
-    // Split into lines
-    std::vector<std::string> lines;
-    std::istringstream stream(existing);
-    std::string line;
-    while (std::getline(stream, line))
+  // Batches queued or being stored per worker, ahead of the collector
+  const size_t ADD_BATCHES_PER_WORKER = 4;
+
+  std::string StagingName(const std::string &path)
+  {
+    std::string name;
+    for (char c : utils::TreePath(path))
     {
-      if (!line.empty())
+      if (c == '%')
+      {
+        name += "%25";
+      }
+      else if (c == '/')
+      {
+        name += "%2F";
+      }
+      else
       {
-        lines.push_back(line);
+        name += c;
       }
     }
+    return name;
+  }
+
+  // A file to add. Problems found by the walker or a worker are kept in
+  // error and printed by the collector, so output follows the walk order.
+  struct AddEntry
+  {
+    std::string path;
+    uint64_t size = 0;
+    utils::ObjectId hash; // null unless the content was stored
+    std::string error;
+    utils::IndexStat stat; // taken by the walker, before the file is read
+    bool removed = false;  // a file of HEAD deleted from the working directory
+  };
+
+  // Files hashed and stored by one worker, staged by the collector once done
+  struct AddBatch
+  {
+    std::vector<AddEntry> entries;
+    bool done = false;
+  };
+
+  // Queue path, or every file below it when it is a directory. Directories
+  // are walked in name order so the same tree is always added in the same
+  // order; the repository's own directory and .git are skipped.
+  static void WalkPath(const std::string &path, const std::function<void(AddEntry)> &emit)
+  {
+    std::error_code ec;
+    fs::file_status status = fs::status(path, ec);
+    if (ec || !fs::exists(status))
+    {
+      emit({path, 0, {}, "Warning: '" + path + "' did not match any files", {}});
+      return;
+    }
 
-    // Update or add entry
-    bool found = false;
-    for (size_t i = 0; i < lines.size(); i++)
+    if (!fs::is_directory(status))
     {
-      if (lines[i].substr(0, filePath.length()) == filePath &&
-          (lines[i].length() == filePath.length() || lines[i][filePath.length()] == ' '))
+      // Trees and staging entries are line based
+      if (path.find('\n') != std::string::npos)
+      {
+        emit({path, 0, {}, "Error: Cannot add '" + path + "': names with a newline are not supported", {}});
+        return;
+      }
+      utils::IndexStat stat;
+      if (!utils::StatFile(path, stat) || access(path.c_str(), R_OK) != 0)
       {
-        lines[i] = filePath + " " + hash;
-        found = true;
-        break;
+        emit({path, 0, {}, "Error: Cannot read file '" + path + "'", {}});
+        return;
       }
+      emit({path, stat.size, {}, "", stat});
+      return;
     }
 
-    if (!found)
+    std::vector<fs::directory_entry> children;
+    for (const auto &entry : fs::directory_iterator(path, ec))
     {
-      lines.push_back(filePath + " " + hash);
+      children.push_back(entry);
     }
-
-    // Write back to file
-    std::ofstream outFile(indexPath);
-    if (!outFile.is_open())
+    if (ec)
     {
-      return false;
+      emit({path, 0, {}, "Error: Cannot read directory '" + path + "'", {}});
+      return;
     }
+    std::sort(children.begin(), children.end(), [](const fs::directory_entry &a, const fs::directory_entry &b)
+              { return a.path().filename() < b.path().filename(); });
 
-    for (size_t i = 0; i < lines.size(); i++)
+    for (const auto &child : children)
     {
-      outFile << lines[i];
-      if (i < lines.size() - 1)
+      std::string name = child.path().filename().string();
+      if (name == utils::DEFAULT_PATH || name == ".git")
       {
-        outFile << std::endl;
+        continue;
       }
-    }
 
-    outFile.close();
-    return true;
+      // Symbolic links to directories are not followed
+      std::string childPath = path == "." ? name : (fs::path(path) / name).string();
+      if (child.is_symlink(ec) && child.is_directory(ec))
+      {
+        continue;
+      }
+      WalkPath(childPath, emit);
+    }
   }
 
-  bool StageFile(const std::string &path, const std::string &fileName)
+  // Hash and store one batch. Small files are read and written through the
+  // I/O engine together, large ones are streamed one at a time.
+  static void StoreBatch(std::vector<AddEntry> &entries, size_t batchLimit)
   {
-    try
+    std::vector<utils::FileRead> reads;
+    std::vector<size_t> readIndexes;
+    for (size_t i = 0; i < entries.size(); i++)
     {
-      // Read file content
-      std::ifstream file(path, std::ios::binary);
-      if (!file.is_open())
+      AddEntry &entry = entries[i];
+      if (!entry.error.empty() || entry.removed)
       {
-        std::cerr << "Error reading file '" << fileName << "'" << std::endl;
-        return false;
+        continue;
       }
 
-      // Read file into vector
-      std::vector<uint8_t> content(
-          (std::istreambuf_iterator<char>(file)),
-          std::istreambuf_iterator<char>());
-      file.close();
+      if (entry.size < batchLimit)
+      {
+        utils::FileRead read;
+        read.path = entry.path;
+        reads.push_back(std::move(read));
+        readIndexes.push_back(i);
+        continue;
+      }
 
-      // Calculate hash
-      std::string hash = utils::HashContent(content);
+      // Stream the content into the objects directory, chunking large files
+      entry.hash = utils::WriteBlobFile(entry.path);
+      if (entry.hash.IsNull())
+      {
+        entry.error = "Error: Could not write to object store for '" + entry.path + "'";
+      }
+    }
 
-      // Write object
-      if (!utils::WriteObject(hash, content))
+    utils::GetIoEngine().Read(reads);
+    std::vector<std::vector<uint8_t>> batchContents;
+    std::vector<size_t> batchIndexes;
+    for (size_t j = 0; j < reads.size(); j++)
+    {
+      AddEntry &entry = entries[readIndexes[j]];
+      if (!reads[j].ok)
       {
-        std::cerr << "Error writing object for '" << fileName << "'" << std::endl;
-        return false;
+        entry.error = "Error: Cannot read file '" + entry.path + "'";
+        continue;
       }
+      batchContents.push_back(std::move(reads[j].data));
+      batchIndexes.push_back(readIndexes[j]);
+    }
 
-      // Update index
-      if (!UpdateIndex(path, hash))
+    // Hash the files read together, small ones share SIMD lanes
+    std::vector<utils::ObjectId> batchHashes = utils::HashBatch(batchContents);
+    for (size_t k = 0; k < batchIndexes.size(); k++)
+    {
+      entries[batchIndexes[k]].hash = batchHashes[k];
+    }
+
+    if (!utils::GetObjectStore().WriteBatch(batchHashes, batchContents))
+    {
+      // Find out which ones made it
+      for (size_t i : readIndexes)
       {
-        std::cerr << "Error updating index for '" << fileName << "'" << std::endl;
-        return false;
+        AddEntry &entry = entries[i];
+        if (!entry.hash.IsNull() && !utils::ObjectExists(entry.hash))
+        {
+          entry.error = "Error: Could not write to object store for '" + entry.path + "'";
+          entry.hash = utils::ObjectId();
+        }
       }
+    }
+  }
+
+  // Whether HEAD records a file at path
+  static bool InHead(const std::string &path)
+  {
+    std::string treePath = utils::TreePath(path);
+    return !treePath.empty() && !FindHeadFiles({treePath}).empty();
+  }
 
-      std::cout << "Added " << path << " (hash: " << hash << ")" << std::endl;
+  // The path to add for a command line argument. Absolute paths and paths
+  // through ".." are made relative to the repository root, the working
+  // directory; false if they lead outside it.
+  static bool RepositoryRelative(const std::string &arg, std::string &path)
+  {
+    std::string normal = fs::path(arg).lexically_normal().string();
+    if (!utils::TreePath(arg).empty() || normal == "." || normal == "./")
+    {
+      path = arg;
       return true;
     }
-    catch (const std::exception &e)
+
+    std::error_code ec;
+    fs::path root = fs::current_path(ec);
+    fs::path relative = fs::absolute(arg, ec).lexically_normal().lexically_relative(root.lexically_normal());
+    if (ec || relative.empty())
     {
-      std::cerr << "Error: " << e.what() << std::endl;
       return false;
     }
+    path = relative.string();
+    return path == "." || !utils::TreePath(path).empty();
+  }
+
+  // Create the staging entries of a stored batch, record the staged files in
+  // the index and report on each file
+  static void StageBatch(const std::vector<AddEntry> &entries, const fs::path &stagingDir, utils::Index &index,
+                         int &filesAdded, int &filesSkipped)
+  {
+    std::vector<std::string> stageLines(entries.size());
+    std::vector<utils::FileWrite> stageWrites;
+    std::vector<size_t> stageIndexes;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+      // Paths outside the repository have no staging name
+      std::string treePath = utils::TreePath(entries[i].path);
+      if ((entries[i].hash.IsNull() && !entries[i].removed) || treePath.empty())
+      {
+        continue;
+      }
+      // The path lets save place the file in its directory's tree. Removals
+      // are staged with an empty hash.
+      stageLines[i] = entries[i].hash.Hex() + "\n" + treePath + "\n";
+      utils::FileWrite write;
+      write.path = (stagingDir / StagingName(entries[i].path)).string();
+      write.data = reinterpret_cast<const uint8_t *>(stageLines[i].data());
+      write.size = stageLines[i].size();
+      stageWrites.push_back(write);
+      stageIndexes.push_back(i);
+    }
+    utils::GetIoEngine().Write(stageWrites);
+
+    std::vector<bool> staged(entries.size(), false);
+    for (size_t k = 0; k < stageWrites.size(); k++)
+    {
+      staged[stageIndexes[k]] = stageWrites[k].ok;
+    }
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+      if (staged[i] && entries[i].removed)
+      {
+        index.Remove(utils::TreePath(entries[i].path));
+        std::cout << "Removed '" << entries[i].path << "'" << std::endl;
+        filesAdded++;
+        continue;
+      }
+      if (staged[i])
+      {
+        index.Set({utils::TreePath(entries[i].path), entries[i].hash, entries[i].stat});
+        std::cout << "Added '" << entries[i].path << "'" << std::endl;
+        filesAdded++;
+        continue;
+      }
+
+      if (!entries[i].error.empty())
+      {
+        std::cerr << entries[i].error << std::endl;
+      }
+      else if (utils::TreePath(entries[i].path).empty())
+      {
+        std::cerr << "Error: '" << entries[i].path << "' is outside the repository" << std::endl;
+      }
+      else
+      {
+        std::cerr << "Error: Could not write to staging area for '" << entries[i].path << "'" << std::endl;
+      }
+      filesSkipped++;
+    }
   }
 
   int Add(const std::vector<std::string> &args)
@@ -131,11 +315,35 @@ namespace cmd
       return 1;
     }
 
+    size_t threads = utils::DefaultWorkerCount();
+    std::vector<std::string> paths;
+    for (const auto &arg : args)
+    {
+      if (!utils::starts_with(arg, "--threads="))
+      {
+        paths.push_back(arg);
+        continue;
+      }
+      try
+      {
+        threads = std::stoul(arg.substr(10));
+      }
+      catch (const std::exception &)
+      {
+        threads = 0;
+      }
+      if (threads == 0)
+      {
+        std::cerr << "Error: Invalid thread count '" << arg.substr(10) << "'" << std::endl;
+        return 1;
+      }
+    }
+
     // Check if we have any arguments
-    if (args.empty())
+    if (paths.empty())
     {
       std::cerr << "Error: No files specified to add" << std::endl;
-      std::cerr << "Usage: microgit add <file1> [file2] [file3] ..." << std::endl;
+      std::cerr << "Usage: microgit add [--threads=<n>] <file1> [file2] [file3] ..." << std::endl;
       return 1;
     }
 
@@ -146,70 +354,124 @@ namespace cmd
       fs::create_directories(stagingDir);
     }
 
+    // Staged files are recorded in the index, written once at the end
+    utils::Index index;
+    if (!index.Load())
+    {
+      std::cerr << "Warning: The index is damaged, it is rebuilt from the files added now" << std::endl;
+    }
+
     int filesAdded = 0;
     int filesSkipped = 0;
 
-    // Process each file
-    for (const auto &file : args)
+    // Small files are read and written in batches through the I/O engine,
+    // large ones are streamed one at a time
+    size_t threshold = utils::GetChunkingThreshold();
+    size_t batchLimit = threshold > 0 ? std::min(threshold, BATCH_FILE_SIZE) : BATCH_FILE_SIZE;
+
+    // The walker (this thread) cuts the files into batches for the workers
+    // to hash and store, and between batches collects the finished ones in
+    // the order they were walked. At most a few batches per worker are in
+    // flight, which bounds memory however large the tree is.
+    utils::GetObjectStore();
+    utils::ThreadPool pool(threads);
+    size_t maxInFlight = threads * ADD_BATCHES_PER_WORKER;
+    std::deque<std::unique_ptr<AddBatch>> inFlight;
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    // Stage finished batches from the front until no more than keep are left
+    auto collect = [&](size_t keep)
     {
-      fs::path filePath = fs::path(file);
-
-      // Check if the file exists
-      if (!fs::exists(filePath))
+      while (!inFlight.empty())
       {
-        std::cerr << "Warning: '" << file << "' did not match any files" << std::endl;
-        filesSkipped++;
-        continue;
-      }
-
-      // Read the file contents
-      try
-      {
-        std::ifstream input(filePath, std::ios::binary);
-        if (!input)
+        AddBatch &batch = *inFlight.front();
         {
-          std::cerr << "Error: Cannot read file '" << file << "'" << std::endl;
-          filesSkipped++;
-          continue;
-        }
-
-        std::vector<uint8_t> buffer(std::istreambuf_iterator<char>(input), {});
-
-        // Hash the content
-        std::string hash = utils::HashContent(buffer);
-
-        // Store the content in the objects directory
-        if (!utils::WriteObject(hash, buffer))
-        {
-          std::cerr << "Error: Could not write to object store for '" << file << "'" << std::endl;
-          filesSkipped++;
-          continue;
+          std::unique_lock<std::mutex> lock(mutex);
+          if (!batch.done && inFlight.size() <= keep)
+          {
+            return;
+          }
+          finished.wait(lock, [&batch]()
+                        { return batch.done; });
         }
+        StageBatch(batch.entries, stagingDir, index, filesAdded, filesSkipped);
+        inFlight.pop_front();
+      }
+    };
 
-        // Create an entry in the staging area
-        fs::path stagingPath = stagingDir / filePath.filename().string();
-        std::ofstream stageFile(stagingPath);
-        if (!stageFile)
+    std::vector<AddEntry> entries;
+    uint64_t entryBytes = 0;
+    auto submit = [&]()
+    {
+      inFlight.push_back(std::unique_ptr<AddBatch>(new AddBatch{std::move(entries), false}));
+      AddBatch *batch = inFlight.back().get();
+      pool.Submit([batch, batchLimit, &mutex, &finished]()
+                  {
+        StoreBatch(batch->entries, batchLimit);
         {
-          std::cerr << "Error: Could not write to staging area for '" << file << "'" << std::endl;
-          filesSkipped++;
-          continue;
+          std::lock_guard<std::mutex> lock(mutex);
+          batch->done = true;
         }
+        finished.notify_all(); });
+      entries.clear();
+      entryBytes = 0;
+      collect(maxInFlight);
+    };
 
-        stageFile << hash << std::endl;
-        stageFile.close();
-
-        std::cout << "Added '" << file << "'" << std::endl;
-        filesAdded++;
+    auto emit = [&](AddEntry entry)
+    {
+      entryBytes += entry.size;
+      entries.push_back(std::move(entry));
+      if (entries.size() == ADD_BATCH_FILES || entryBytes >= ADD_BATCH_BYTES)
+      {
+        submit();
       }
-      catch (const std::exception &e)
+    };
+    for (const auto &arg : paths)
+    {
+      std::string path;
+      if (!RepositoryRelative(arg, path))
       {
-        std::cerr << "Error processing '" << file << "': " << e.what() << std::endl;
-        filesSkipped++;
+        emit({arg, 0, {}, "Error: '" + arg + "' is outside the repository", {}});
+        continue;
       }
+
+      // A file of HEAD that is gone from the working directory is staged
+      // for removal
+      std::error_code ec;
+      if (!fs::exists(fs::symlink_status(path, ec)) && InHead(path))
+      {
+        AddEntry entry;
+        entry.path = path;
+        entry.removed = true;
+        emit(std::move(entry));
+        continue;
+      }
+      WalkPath(path, emit);
+    }
+    if (!entries.empty())
+    {
+      submit();
+    }
+    collect(0);
+    pool.Wait();
+
+    // Make the whole batch of new objects durable at once
+    if (!utils::SyncObjects())
+    {
+      std::cerr << "Warning: Could not flush objects to disk" << std::endl;
+    }
+
+    if (filesAdded > 0 && !index.Write())
+    {
+      std::cerr << "Error: Could not write the index" << std::endl;
+      filesSkipped++;
     }
 
+    const utils::ObjectWriteStats &stats = utils::GetObjectWriteStats();
     std::cout << "Summary: " << filesAdded << " file(s) added, " << filesSkipped << " file(s) skipped" << std::endl;
+    std::cout << "Objects: " << stats.written << " written, " << stats.skipped << " already stored" << std::endl;
     return filesSkipped > 0 ? 1 : 0;
   }
 
@@ -221,45 +483,20 @@ namespace cmd
         "Add files to the staging area for the next commit.\n\n"
         "Usage:\n"
         "  microgit add <file1> [file2 ...]  - Stage specific files\n"
+        "  microgit add <directory>          - Stage every file below a directory\n"
         "  microgit add .                    - Stage all files in current directory\n\n"
         "The add command will:\n"
-        "1. Calculate a SHA-256 hash of the file content\n"
+        "1. Calculate the repository's object hash of the file content\n"
         "2. Store the file content in the objects directory\n"
-        "3. Update the index with the file path and corresponding hash\n\n"
+        "3. Record the file path and its hash in the staging area and the index\n\n"
+        "Files are hashed and stored by a pool of worker threads (one per core\n"
+        "unless --threads=<n> is given) and reported in a fixed order: as given,\n"
+        "with directories walked in name order.\n\n"
+        "Naming a file of the last commit that no longer exists stages its removal.\n\n"
         "Files in the .microgit/ and .git/ directories are automatically ignored.");
 
     addCmd->SetRunFunc([](const std::vector<std::string> &args)
-                       {
-      if (args.empty()) {
-        std::cout << "Error: No files specified" << std::endl;
-        return;
-      }
-      
-      if (args[0] == ".") {
-        // Stage all files in current directory
-        try {
-          for (const auto& entry : fs::recursive_directory_iterator(".")) {
-            std::string path = entry.path().string();
-            
-            // Skip directories and special paths
-            if (fs::is_directory(entry) || 
-                utils::starts_with(path, utils::DEFAULT_PATH) || 
-                utils::starts_with(path, ".git/")) {
-              continue;
-            }
-            
-            StageFile(path, entry.path().filename().string());
-          }
-        } catch (const fs::filesystem_error& e) {
-          std::cerr << "Error reading directory: " << e.what() << std::endl;
-        }
-        return;
-      }
-      
-      // Stage specific files
-      for (const auto& file : args) {
-        StageFile(file, file);
-      } });
+                       { Add(args); });
 
     rootCmd->AddCommand(addCmd);
   }
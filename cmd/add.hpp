@@ -8,13 +8,11 @@ namespace cmd
 {
   extern Command *addCmd;
 
-  // Updates index with path -> hash mapping
-  bool UpdateIndex(const std::string &filePath, const std::string &hash);
+  // Name of the staging entry for a path: its repository path with '/'
+  // escaped, so files of the same name in different directories don't collide
+  std::string StagingName(const std::string &path);
 
-  // Stage a specific file
-  bool StageFile(const std::string &path, const std::string &fileName);
-
-  // Add files to the repository's staging area
+  // Add files, or every file below a directory, to the repository's staging area
   int Add(const std::vector<std::string> &args);
 
   void InitAddCommand();
@@ -0,0 +1,93 @@
+#include "cat_object.hpp"
+#include "../utils/main.hpp"
+#include "../utils/object_store.hpp"
+#include <iostream>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace cmd
+{
+  Command *catObjectCmd = nullptr;
+
+  int CatObject(const std::vector<std::string> &args)
+  {
+    // Check for the .microgit directory
+    if (!fs::exists(utils::DEFAULT_PATH))
+    {
+      std::cerr << "Error: Not a MicroGit repository (or any parent up to mount point /)" << std::endl;
+      return 1;
+    }
+
+    if (args.size() != 2 || (args[0] != "-t" && args[0] != "-s" && args[0] != "-p"))
+    {
+      std::cerr << "Usage: microgit cat-object (-t | -s | -p) <hash>" << std::endl;
+      return 1;
+    }
+    std::vector<utils::ObjectId> matches = utils::ResolveObjectId(args[1]);
+    if (matches.size() > 1)
+    {
+      utils::ReportAmbiguousId(std::cerr, args[1], matches);
+      return 1;
+    }
+    if (matches.empty())
+    {
+      std::cerr << "Error: Object " << args[1] << " not found" << std::endl;
+      return 1;
+    }
+    utils::ObjectId hash = matches[0];
+    utils::ObjectStore &store = utils::GetObjectStore();
+
+    if (args[0] == "-p")
+    {
+      bool ok = store.Stream(hash, [](const uint8_t *data, size_t size)
+                             { return static_cast<bool>(std::cout.write(reinterpret_cast<const char *>(data), size)); });
+      if (!ok)
+      {
+        std::cerr << "Error: Could not read object " << hash << std::endl;
+        return 1;
+      }
+      return 0;
+    }
+
+    // Type and size come from the object header, the content is not read
+    utils::ObjectInfo info;
+    if (!store.Info(hash, info))
+    {
+      std::cerr << "Error: Object " << hash << " not found" << std::endl;
+      return 1;
+    }
+
+    if (args[0] == "-t")
+    {
+      std::cout << utils::ObjectTypeName(info.type) << std::endl;
+    }
+    else
+    {
+      std::cout << info.size << std::endl;
+    }
+    return 0;
+  }
+
+  void InitCatObjectCommand()
+  {
+    catObjectCmd = new Command(
+        "cat-object",
+        "Show an object's type, size or content",
+        "Inspect a stored object.\n\n"
+        "Usage:\n"
+        "  microgit cat-object (-t | -s | -p) <hash>\n\n"
+        "  -t  print the type: blob, savepoint or chunklist\n"
+        "  -s  print the size of the content in bytes\n"
+        "  -p  print the content\n\n"
+        "The hash may be abbreviated to a unique prefix of at least four digits.\n"
+        "-t and -s read only the object header, so they cost the same for a\n"
+        "large file as for a small one.");
+
+    catObjectCmd->SetRunFunc([](const std::vector<std::string> &args)
+                             { CatObject(args); });
+
+    rootCmd->AddCommand(catObjectCmd);
+  }
+} // namespace cmd
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "root.hpp"
+#include <string>
+#include <vector>
+
+namespace cmd
+{
+  extern Command *catObjectCmd;
+
+  // Print an object's type, size or content
+  int CatObject(const std::vector<std::string> &args);
+
+  // Initialize the cat-object command
+  void InitCatObjectCommand();
+} // namespace cmd
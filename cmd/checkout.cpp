@@ -1,11 +1,23 @@
 #include "checkout.hpp"
+#include "save.hpp"
 #include "../utils/main.hpp"
 #include "../utils/json.hpp"
+#include "../utils/chunks.hpp"
+#include "../utils/tree.hpp"
+#include "../utils/cache.hpp"
+#include "../utils/object_store.hpp"
+#include "../utils/io_engine.hpp"
+#include "../utils/file_copy.hpp"
+#include "../utils/index.hpp"
+#include "../utils/hasher.hpp"
 #include <iostream>
 #include <fstream>
 #include <filesystem>
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
@@ -13,7 +25,66 @@ namespace cmd
 {
   Command *checkoutCmd = nullptr;
 
-  int Checkout(const std::vector<std::string> &args)
+  // Files fetched and written through the I/O engine at once
+  const size_t CHECKOUT_BATCH_FILES = 64;
+
+  // Remove a working file that shares its inode with another file, such as
+  // an object linked by --link, that is read-only, or whose size or mtime no
+  // longer match its index entry, so that writing the new content never
+  // modifies a stored object
+  static void BreakLink(const std::string &path, const utils::Index &index)
+  {
+    struct stat info;
+    if (lstat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+    {
+      return;
+    }
+
+    utils::IndexEntry entry;
+    int64_t mtimeNs = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    bool changed = index.Find(utils::TreePath(path), entry) &&
+                   (static_cast<uint64_t>(info.st_size) != entry.stat.size || mtimeNs != entry.stat.mtimeNs);
+    if (info.st_nlink > 1 || access(path.c_str(), W_OK) != 0 || changed)
+    {
+      unlink(path.c_str());
+    }
+  }
+
+  enum class LinkResult
+  {
+    Linked,
+    Copy,    // no raw loose file to link, copy the object instead
+    Corrupt, // the raw file no longer hashes to the object
+  };
+
+  // Hard-link path to the object's raw loose file. The object is made
+  // read-only first, and since the link shares its inode, so is the file.
+  // The owner can still make an earlier link writable and modify the object
+  // through it, so the object is rehashed before it is shared again.
+  static LinkResult LinkWorkingFile(const utils::ObjectId &hash, const std::string &path)
+  {
+    std::string rawPath = utils::GetObjectStore().RawPath(hash, 0);
+    if (rawPath.empty())
+    {
+      return LinkResult::Copy;
+    }
+    utils::Hasher hasher;
+    if (!hasher.UpdateFile(rawPath) || hasher.Finish() != hash)
+    {
+      std::cerr << "Warning: Object " << hash.Hex().substr(0, 8) << " for '" << path
+                << "' no longer matches its hash, skipping (run fsck)" << std::endl;
+      return LinkResult::Corrupt;
+    }
+    if (chmod(rawPath.c_str(), 0444) != 0)
+    {
+      return LinkResult::Copy;
+    }
+
+    unlink(path.c_str());
+    return link(rawPath.c_str(), path.c_str()) == 0 ? LinkResult::Linked : LinkResult::Copy;
+  }
+
+  int Checkout(const std::vector<std::string> &options)
   {
     // Check for the .microgit directory
     if (!fs::exists(utils::DEFAULT_PATH))
@@ -22,117 +93,269 @@ namespace cmd
       return 1;
     }
 
+    // "--" ends the commit: checkout [<commit>] -- <file>
+    bool linkMode = false;
+    bool separated = false;
+    size_t commitArgs = 0; // arguments before "--"
+    std::vector<std::string> args;
+    for (const auto &option : options)
+    {
+      if (!separated && option == "--")
+      {
+        separated = true;
+        commitArgs = args.size();
+      }
+      else if (!separated && option == "--link")
+      {
+        linkMode = true;
+      }
+      else
+      {
+        args.push_back(option);
+      }
+    }
+
+    // Mode 0444 is all that keeps a linked file from writing into the
+    // object, and it does not stop root
+    if (linkMode && geteuid() == 0)
+    {
+      std::cerr << "Error: --link is not available to root, whose writes would modify stored objects" << std::endl;
+      return 1;
+    }
+
     // Check if we have the required arguments
     if (args.empty())
     {
       std::cerr << "Error: Missing commit hash or file name" << std::endl;
-      std::cerr << "Usage: microgit checkout <commit> [file]" << std::endl;
-      std::cerr << "       microgit checkout <file>" << std::endl;
+      std::cerr << "Usage: microgit checkout [--link] <commit> [[--] file]" << std::endl;
+      std::cerr << "       microgit checkout [--] <file>" << std::endl;
       return 1;
     }
 
-    std::string commitHash = args[0];
-    bool singleFileMode = false;
-    std::string targetFile = "";
-
-    if (args.size() > 1)
+    // Work out which argument is the commit (empty for HEAD) and which the file
+    std::string commitArg;
+    std::string targetFile;
+    if (separated)
+    {
+      if (commitArgs > 1 || args.size() > commitArgs + 1)
+      {
+        std::cerr << "Error: Expected at most one commit before '--' and one file after it" << std::endl;
+        return 1;
+      }
+      commitArg = commitArgs == 1 ? args[0] : "";
+      targetFile = args.size() > commitArgs ? args[commitArgs] : "";
+    }
+    else if (args.size() == 1 && !utils::TreePath(args[0]).empty() &&
+             !FindHeadFiles({utils::TreePath(args[0])}).empty())
+    {
+      // A file of HEAD wins over a commit prefix it happens to spell, such as
+      // a file named "cafe"; "checkout <commit> --" forces the commit
+      targetFile = args[0];
+    }
+    else
     {
-      // If we have more than one argument, the second one is a file name
-      targetFile = args[1];
-      singleFileMode = true;
+      commitArg = args[0];
+      targetFile = args.size() > 1 ? args[1] : "";
     }
 
-    // If only one argument and it's not a valid hash, assume it's a file
-    fs::path objectPath = fs::path(utils::DEFAULT_PATH) / "objects" / commitHash;
-    if (args.size() == 1 && !fs::exists(objectPath))
+    // The commit may be given by a unique prefix of its hash
+    utils::ObjectId commitHash;
+    if (!commitArg.empty())
     {
-      // Try to find the head commit
-      std::ifstream headFile(fs::path(utils::DEFAULT_PATH) / "HEAD");
-      std::string headHash;
-      if (!headFile || !(headFile >> headHash))
+      std::vector<utils::ObjectId> matches = utils::ResolveObjectId(commitArg, utils::ObjectType::SavePoint);
+      if (matches.size() > 1)
       {
-        std::cerr << "Error: Could not determine current HEAD" << std::endl;
+        utils::ReportAmbiguousId(std::cerr, commitArg, matches);
+        return 1;
+      }
+      if (matches.size() == 1)
+      {
+        commitHash = matches[0];
+      }
+      else if (!separated && args.size() == 1)
+      {
+        // If only one argument and it's not a commit, assume it's a file
+        targetFile = commitArg;
+      }
+      else
+      {
+        std::cerr << "Error: Commit " << commitArg << " not found" << std::endl;
         return 1;
       }
-
-      // Set the file to checkout
-      targetFile = commitHash;
-      commitHash = headHash;
-      singleFileMode = true;
     }
-
-    // Load the commit
-    objectPath = fs::path(utils::DEFAULT_PATH) / "objects" / commitHash;
-    if (!fs::exists(objectPath))
+    if (commitHash.IsNull())
     {
-      std::cerr << "Error: Commit " << commitHash << " not found" << std::endl;
-      return 1;
+      commitHash = GetHead();
+      if (commitHash.IsNull())
+      {
+        std::cerr << "Error: Could not determine current HEAD" << std::endl;
+        return 1;
+      }
     }
+    bool singleFileMode = !targetFile.empty();
 
+    // Working files that no longer match the index are replaced, not written through
+    utils::Index index;
+    index.Load();
+
+    // Load the commit
     try
     {
-      std::ifstream file(objectPath);
-      std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-      utils::SavePoint savePoint = utils::JSON::Parse(content);
+      auto savePointPtr = utils::ReadSavePoint(commitHash);
+      if (!savePointPtr)
+      {
+        std::cerr << "Error: Commit " << commitHash << " not found" << std::endl;
+        return 1;
+      }
+      const utils::SavePoint &savePoint = *savePointPtr;
+      std::map<std::string, utils::ObjectId> commitFiles;
+      if (!utils::SavePointFiles(savePoint, commitFiles))
+      {
+        std::cerr << "Error: Could not read the tree of commit " << commitHash << std::endl;
+        return 1;
+      }
 
       if (singleFileMode)
       {
         // Checkout a single file
-        if (savePoint.files.find(targetFile) == savePoint.files.end())
+        auto file = commitFiles.find(utils::TreePath(targetFile));
+        if (file == commitFiles.end())
         {
-          std::cerr << "Error: File '" << targetFile << "' not found in commit " << commitHash.substr(0, 8) << std::endl;
+          std::cerr << "Error: File '" << targetFile << "' not found in commit " << commitHash.Hex().substr(0, 8) << std::endl;
           return 1;
         }
 
-        std::string fileHash = savePoint.files[targetFile];
-        fs::path fileObjectPath = fs::path(utils::DEFAULT_PATH) / "objects" / fileHash;
-        if (!fs::exists(fileObjectPath))
+        utils::ObjectId fileHash = file->second;
+        LinkResult linked = linkMode ? LinkWorkingFile(fileHash, targetFile) : LinkResult::Copy;
+        if (linked == LinkResult::Corrupt)
         {
-          std::cerr << "Error: Object for file '" << targetFile << "' not found" << std::endl;
           return 1;
         }
+        if (linked == LinkResult::Linked)
+        {
+          std::cout << "Linked '" << targetFile << "' from commit " << commitHash.Hex().substr(0, 8) << " (read-only)" << std::endl;
+          return 0;
+        }
 
-        // Read the file content
-        std::ifstream objectFile(fileObjectPath, std::ios::binary);
-        std::vector<uint8_t> fileContent(std::istreambuf_iterator<char>(objectFile), {});
-
-        // Write to the working directory
-        std::ofstream outputFile(targetFile, std::ios::binary);
-        outputFile.write(reinterpret_cast<const char *>(fileContent.data()), fileContent.size());
+        // Write to the working directory, reassembling chunked files
+        BreakLink(targetFile, index);
+        if (!utils::RestoreBlob(fileHash, targetFile))
+        {
+          std::cerr << "Error: Object for file '" << targetFile << "' not found" << std::endl;
+          return 1;
+        }
 
-        std::cout << "Restored '" << targetFile << "' from commit " << commitHash.substr(0, 8) << std::endl;
+        std::cout << "Restored '" << targetFile << "' from commit " << commitHash.Hex().substr(0, 8) << std::endl;
       }
       else
       {
-        // Checkout entire commit
+        // Checkout entire commit. Objects are fetched and files written in
+        // batches through the I/O engine; chunked files are reassembled one
+        // chunk at a time instead.
         int filesRestored = 0;
+        int filesLinked = 0;
+        std::vector<std::pair<std::string, utils::ObjectId>> files(commitFiles.begin(), commitFiles.end());
 
-        for (const auto &[filename, fileHash] : savePoint.files)
+        for (size_t start = 0; start < files.size(); start += CHECKOUT_BATCH_FILES)
         {
-          fs::path fileObjectPath = fs::path(utils::DEFAULT_PATH) / "objects" / fileHash;
-          if (!fs::exists(fileObjectPath))
+          size_t end = std::min(files.size(), start + CHECKOUT_BATCH_FILES);
+          std::vector<utils::ObjectId> hashes;
+          std::vector<size_t> indexes;
+          for (size_t i = start; i < end; i++)
           {
-            std::cerr << "Warning: Object for file '" << filename << "' not found, skipping" << std::endl;
-            continue;
+            // Files in subdirectories need their directory first
+            fs::path parentDir = fs::path(files[i].first).parent_path();
+            std::error_code ec;
+            if (!parentDir.empty())
+            {
+              fs::create_directories(parentDir, ec);
+            }
+
+            // With --link, raw objects are shared with the working file
+            // instead of copied; everything else falls back to a copy
+            LinkResult linked = linkMode ? LinkWorkingFile(files[i].second, files[i].first) : LinkResult::Copy;
+            if (linked == LinkResult::Corrupt)
+            {
+              continue;
+            }
+            if (linked == LinkResult::Linked)
+            {
+              filesRestored++;
+              filesLinked++;
+              continue;
+            }
+            BreakLink(files[i].first, index);
+
+            // Large raw objects are copied by the kernel (a reflink where the
+            // filesystem supports it) instead of passing through memory
+            std::string rawPath = utils::GetObjectStore().RawPath(files[i].second, utils::CLONE_MIN_SIZE);
+            if (!rawPath.empty() && utils::CloneFile(rawPath, files[i].first))
+            {
+              filesRestored++;
+              continue;
+            }
+            hashes.push_back(files[i].second);
+            indexes.push_back(i);
           }
 
-          // Read the file content
-          std::ifstream objectFile(fileObjectPath, std::ios::binary);
-          std::vector<uint8_t> fileContent(std::istreambuf_iterator<char>(objectFile), {});
+          std::vector<std::vector<uint8_t>> contents;
+          std::vector<bool> found = utils::GetObjectStore().ReadBatch(hashes, contents);
+
+          std::vector<utils::FileWrite> writes;
+          for (size_t j = 0; j < hashes.size(); j++)
+          {
+            const std::string &filename = files[indexes[j]].first;
+            if (!found[j])
+            {
+              std::cerr << "Warning: Object for file '" << filename << "' not found, skipping" << std::endl;
+              continue;
+            }
+
+            if (utils::IsChunkList(contents[j]))
+            {
+              if (utils::RestoreBlob(hashes[j], filename))
+              {
+                filesRestored++;
+              }
+              else
+              {
+                std::cerr << "Warning: Object for file '" << filename << "' not found, skipping" << std::endl;
+              }
+              continue;
+            }
 
-          // Write to the working directory
-          std::ofstream outputFile(filename, std::ios::binary);
-          outputFile.write(reinterpret_cast<const char *>(fileContent.data()), fileContent.size());
+            utils::FileWrite write;
+            write.path = filename;
+            write.data = contents[j].data();
+            write.size = contents[j].size();
+            writes.push_back(write);
+          }
 
-          filesRestored++;
+          utils::GetIoEngine().Write(writes);
+          for (const auto &write : writes)
+          {
+            if (write.ok)
+            {
+              filesRestored++;
+            }
+            else
+            {
+              std::cerr << "Warning: Could not write '" << write.path << "', skipping" << std::endl;
+            }
+          }
         }
 
         // Update HEAD pointer
         std::ofstream headFile(fs::path(utils::DEFAULT_PATH) / "HEAD");
         headFile << commitHash;
 
-        std::cout << "Checked out commit " << commitHash.substr(0, 8) << ": " << savePoint.message << std::endl;
-        std::cout << filesRestored << " files restored" << std::endl;
+        std::cout << "Checked out commit " << commitHash.Hex().substr(0, 8) << ": " << savePoint.message << std::endl;
+        std::cout << filesRestored << " files restored";
+        if (linkMode)
+        {
+          std::cout << " (" << filesLinked << " hard-linked read-only)";
+        }
+        std::cout << std::endl;
       }
 
       return 0;
@@ -153,8 +376,22 @@ namespace cmd
         "Usage:\n"
         "  microgit checkout <commit>          - Restore all files from commit\n"
         "  microgit checkout <commit> <file>   - Restore specific file from commit\n"
-        "  microgit checkout <file>            - Restore file from most recent commit\n\n"
-        "When checking out a commit, HEAD will be updated to point to that commit.");
+        "  microgit checkout <file>            - Restore file from most recent commit\n"
+        "  microgit checkout [<commit>] -- <file> - Name the file explicitly\n"
+        "  microgit checkout --link <commit>   - Hard-link files to the object store\n\n"
+        "A commit can be named by the first four or more digits of its hash, as\n"
+        "long as no other SavePoint shares them. A single argument that names a\n"
+        "file of the most recent commit is taken as that file even if it also\n"
+        "spells a commit prefix; use \"checkout <commit> --\" for the commit.\n\n"
+        "When checking out a commit, HEAD will be updated to point to that commit.\n\n"
+        "With --link, files whose objects are stored uncompressed are hard-linked\n"
+        "to the loose object instead of copied, and made read-only. Other files\n"
+        "are copied as usual. A later checkout replaces linked files rather than\n"
+        "writing through them. Only the read-only mode protects the shared\n"
+        "objects, which does not hold for root, so --link is refused as root.\n"
+        "The owner can still chmod u+w a linked file and corrupt its object by\n"
+        "writing to it: --link rehashes every object before linking it and\n"
+        "skips those that no longer match, and fsck reports them as corrupt.");
 
     checkoutCmd->SetRunFunc([](const std::vector<std::string> &args)
                             { Checkout(args); });
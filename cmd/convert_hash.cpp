@@ -0,0 +1,403 @@
+#include "convert_hash.hpp"
+#include "../utils/main.hpp"
+#include "../utils/config.hpp"
+#include "../utils/hasher.hpp"
+#include "../utils/json.hpp"
+#include "../utils/tree.hpp"
+#include "../utils/index.hpp"
+#include "../utils/chunks.hpp"
+#include "../utils/pack.hpp"
+#include "../utils/object_store.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <vector>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+namespace cmd
+{
+  Command *convertHashCmd = nullptr;
+
+  // Rewrites objects under another hash algorithm. An object's content holds
+  // the names of the objects it refers to, so those are converted first and
+  // the object is rewritten with their new names before it is hashed.
+  class HashConverter
+  {
+  public:
+    explicit HashConverter(utils::HashAlgorithm target) : target(target) {}
+
+    // Convert an object and everything it refers to
+    bool Convert(const utils::ObjectId &root)
+    {
+      std::vector<utils::ObjectId> pending = {root};
+      while (!pending.empty())
+      {
+        utils::ObjectId hash = pending.back();
+        if (names.count(hash))
+        {
+          pending.pop_back();
+          continue;
+        }
+
+        utils::ObjectInfo info;
+        std::vector<uint8_t> content;
+        if (!utils::GetObjectStore().Info(hash, info) || !utils::ReadObject(hash, content))
+        {
+          error = "Object " + hash.Hex() + " is missing or unreadable";
+          return false;
+        }
+
+        // Objects it refers to that are not converted yet go first
+        std::vector<utils::ObjectId> references;
+        if (!Rewrite(content, info.type, &references))
+        {
+          error = std::string("Could not parse ") + utils::ObjectTypeName(info.type) + " " + hash.Hex();
+          return false;
+        }
+        bool ready = true;
+        for (const auto &reference : references)
+        {
+          if (!reference.IsNull() && !names.count(reference))
+          {
+            pending.push_back(reference);
+            ready = false;
+          }
+        }
+        if (!ready)
+        {
+          continue;
+        }
+
+        Rewrite(content, info.type, nullptr);
+        utils::Hasher hasher(target);
+        hasher.Update(content);
+        utils::ObjectId converted = hasher.Finish();
+        if (converted.IsNull() || !utils::WriteObject(converted, content, info.type))
+        {
+          error = "Could not write the converted copy of " + hash.Hex();
+          return false;
+        }
+        names[hash] = converted;
+        pending.pop_back();
+      }
+      return true;
+    }
+
+    // The new name of a converted object, the null id for anything else
+    utils::ObjectId Lookup(const utils::ObjectId &hash) const
+    {
+      auto it = names.find(hash);
+      return it != names.end() ? it->second : utils::ObjectId();
+    }
+
+    size_t Count() const { return names.size(); }
+
+    const std::string &Error() const { return error; }
+
+  private:
+    // With references set, only list the names content refers to. Without,
+    // replace them by their converted names.
+    bool Rewrite(std::vector<uint8_t> &content, utils::ObjectType type, std::vector<utils::ObjectId> *references)
+    {
+      auto rename = [&](utils::ObjectId &hash)
+      {
+        if (references)
+        {
+          references->push_back(hash);
+        }
+        else if (!hash.IsNull())
+        {
+          hash = names.at(hash);
+        }
+      };
+
+      if (type == utils::ObjectType::SavePoint)
+      {
+        utils::SavePoint savePoint;
+        try
+        {
+          savePoint = utils::JSON::Parse(std::string(content.begin(), content.end()));
+        }
+        catch (const std::exception &)
+        {
+          return false;
+        }
+        rename(savePoint.parent);
+        rename(savePoint.tree);
+        for (auto &file : savePoint.files)
+        {
+          rename(file.second);
+        }
+        if (!references)
+        {
+          std::string json = utils::JSON::Stringify(savePoint);
+          content.assign(json.begin(), json.end());
+        }
+        return true;
+      }
+
+      if (type == utils::ObjectType::Tree)
+      {
+        std::vector<utils::TreeEntry> entries;
+        if (!utils::ParseTree(content, entries))
+        {
+          return false;
+        }
+        for (auto &entry : entries)
+        {
+          rename(entry.hash);
+        }
+        if (!references)
+        {
+          content = utils::SerializeTree(std::move(entries));
+        }
+        return true;
+      }
+
+      if (type == utils::ObjectType::ChunkList)
+      {
+        std::vector<utils::Chunk> chunks;
+        if (!utils::ParseChunkList(content, chunks))
+        {
+          return false;
+        }
+        uint64_t total = 0;
+        for (auto &chunk : chunks)
+        {
+          rename(chunk.hash);
+          total += chunk.size;
+        }
+        if (!references)
+        {
+          content = utils::BuildChunkList(chunks, total);
+        }
+        return true;
+      }
+
+      // Blobs and chunks refer to nothing and keep their content
+      return true;
+    }
+
+    utils::HashAlgorithm target;
+    std::unordered_map<utils::ObjectId, utils::ObjectId> names;
+    std::string error;
+  };
+
+  // Write a file through a temp file, so it is either old or new
+  static bool ReplaceFile(const fs::path &path, const std::string &content)
+  {
+    fs::path tempPath = path;
+    tempPath += ".tmp";
+    {
+      std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+      if (!file || !(file << content) || !file.flush())
+      {
+        return false;
+      }
+    }
+    std::error_code ec;
+    fs::rename(tempPath, path, ec);
+    return !ec;
+  }
+
+  // Replace the hash at the start of line, which may also be empty
+  static bool RenameLine(const HashConverter &converter, std::string &line, size_t start, size_t size)
+  {
+    utils::ObjectId hash;
+    if (size == 0 || !utils::ObjectId::FromHex(line.data() + start, size, hash))
+    {
+      return true;
+    }
+    utils::ObjectId converted = converter.Lookup(hash);
+    if (converted.IsNull())
+    {
+      return false;
+    }
+    line.replace(start, size, converted.Hex());
+    return true;
+  }
+
+  // The new contents of HEAD, LATEST, the staging entries and the index.
+  // Fails if any of them names an object that was not converted.
+  static bool RenameReferences(const HashConverter &converter, std::vector<std::pair<fs::path, std::string>> &files)
+  {
+    fs::path repo(utils::DEFAULT_PATH);
+    std::vector<fs::path> paths = {repo / "HEAD", repo / "LATEST"};
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(repo / "staging", ec))
+    {
+      paths.push_back(entry.path());
+    }
+
+    for (const auto &path : paths)
+    {
+      std::ifstream file(path, std::ios::binary);
+      if (!file)
+      {
+        continue;
+      }
+
+      // Staging entries and the references start with the hash
+      std::ostringstream content;
+      std::string line;
+      bool first = true;
+      while (std::getline(file, line))
+      {
+        bool renamed = !first || RenameLine(converter, line, 0, line.size());
+        if (!renamed)
+        {
+          std::cerr << "Error: " << path.string() << " refers to an object that could not be converted" << std::endl;
+          return false;
+        }
+        content << line;
+        if (!file.eof())
+        {
+          content << '\n';
+        }
+        first = false;
+      }
+      files.push_back({path, content.str()});
+    }
+
+    // The index is binary and renamed entry by entry
+    utils::Index index;
+    if (!index.Load())
+    {
+      std::cerr << "Error: The index is damaged" << std::endl;
+      return false;
+    }
+    for (auto entry : index.Entries())
+    {
+      utils::ObjectId converted = converter.Lookup(entry.hash);
+      if (converted.IsNull())
+      {
+        std::cerr << "Error: The index refers to an object that could not be converted" << std::endl;
+        return false;
+      }
+      entry.hash = converted;
+      index.Set(entry);
+    }
+    std::vector<uint8_t> content = index.Serialize();
+    files.push_back({repo / "index", std::string(content.begin(), content.end())});
+    return true;
+  }
+
+  int ConvertHash(const std::vector<std::string> &args)
+  {
+    // Check for the .microgit directory
+    if (!fs::exists(utils::DEFAULT_PATH))
+    {
+      std::cerr << "Error: Not a MicroGit repository (or any parent up to mount point /)" << std::endl;
+      return 1;
+    }
+
+    utils::HashAlgorithm target;
+    if (args.size() != 1 || !utils::ParseHashAlgorithm(args[0], target))
+    {
+      std::cerr << "Usage: microgit convert-hash (sha256 | blake3)" << std::endl;
+      return 1;
+    }
+
+    utils::HashAlgorithm current = utils::GetHashAlgorithm();
+    if (target == current)
+    {
+      std::cout << "Repository already uses " << utils::HashAlgorithmName(target) << std::endl;
+      return 0;
+    }
+
+    // Every stored object is converted, not only the reachable ones
+    std::vector<utils::ObjectId> looseObjects = utils::ListLooseObjects();
+    std::vector<utils::ObjectId> objects = looseObjects;
+    for (const auto &pack : utils::GetPacks())
+    {
+      for (uint32_t i = 0; i < pack->Count(); i++)
+      {
+        objects.push_back(pack->HashAt(i));
+      }
+    }
+
+    // Nothing refers to the new names until the references are replaced,
+    // so an interrupted conversion only leaves unreachable objects behind
+    HashConverter converter(target);
+    std::vector<std::pair<fs::path, std::string>> references;
+    for (const auto &hash : objects)
+    {
+      if (!converter.Convert(hash))
+      {
+        std::cerr << "Error: " << converter.Error() << std::endl;
+        std::cerr << "Error: Conversion aborted, the repository still uses " << utils::HashAlgorithmName(current) << std::endl;
+        return 1;
+      }
+    }
+    if (!RenameReferences(converter, references) || !utils::SyncObjects())
+    {
+      std::cerr << "Error: Conversion aborted, the repository still uses " << utils::HashAlgorithmName(current) << std::endl;
+      return 1;
+    }
+
+    for (const auto &[path, content] : references)
+    {
+      if (!ReplaceFile(path, content))
+      {
+        std::cerr << "Error: Could not rewrite " << path.string() << std::endl;
+        return 1;
+      }
+    }
+    if (!utils::SetConfig("core.hash", utils::HashAlgorithmName(target)))
+    {
+      std::cerr << "Error: Could not update repository config" << std::endl;
+      return 1;
+    }
+
+    // The old names are gone from every reference, drop the old objects
+    std::error_code ec;
+    for (const auto &hash : looseObjects)
+    {
+      if (converter.Lookup(hash) != hash)
+      {
+        fs::remove(utils::ObjectPath(hash), ec);
+      }
+    }
+    size_t packs = utils::GetPacks().size();
+    for (const auto &pack : utils::GetPacks())
+    {
+      fs::path index = pack->Path();
+      index.replace_extension(".idx");
+      fs::remove(index, ec);
+      fs::remove(pack->Path(), ec);
+    }
+    utils::ReloadPacks();
+    utils::ForgetKnownObjects();
+
+    std::cout << "Converted " << converter.Count() << " object(s) from " << utils::HashAlgorithmName(current)
+              << " to " << utils::HashAlgorithmName(target) << std::endl;
+    if (packs > 0)
+    {
+      std::cout << "Packed objects were converted to loose ones, run 'microgit pack' to pack them again" << std::endl;
+    }
+    return 0;
+  }
+
+  void InitConvertHashCommand()
+  {
+    convertHashCmd = new Command(
+        "convert-hash",
+        "Switch the repository to another hash algorithm",
+        "Rename every object under another hash algorithm and rewrite the history.\n\n"
+        "Usage:\n"
+        "  microgit convert-hash (sha256 | blake3)\n\n"
+        "Each object is stored again under its name in the new algorithm, with\n"
+        "the names of the objects it refers to (parents, trees, files, chunks)\n"
+        "replaced first. HEAD, LATEST, the staging area and the index are then\n"
+        "rewritten, core.hash is updated and the old objects are deleted.\n"
+        "Packs are unpacked along the way. Every SavePoint gets a new hash.");
+
+    convertHashCmd->SetRunFunc([](const std::vector<std::string> &args)
+                               { ConvertHash(args); });
+
+    rootCmd->AddCommand(convertHashCmd);
+  }
+} // namespace cmd
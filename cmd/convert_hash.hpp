@@ -0,0 +1,16 @@
+#pragma once
+
+#include "root.hpp"
+#include <string>
+#include <vector>
+
+namespace cmd
+{
+  extern Command *convertHashCmd;
+
+  // Rename every object, and every reference to one, under another hash algorithm
+  int ConvertHash(const std::vector<std::string> &args);
+
+  // Initialize the convert-hash command
+  void InitConvertHashCommand();
+} // namespace cmd
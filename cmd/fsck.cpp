@@ -0,0 +1,415 @@
+#include "fsck.hpp"
+#include "gc.hpp"
+#include "save.hpp"
+#include "../utils/main.hpp"
+#include "../utils/pack.hpp"
+#include "../utils/cache.hpp"
+#include "../utils/chunks.hpp"
+#include "../utils/tree.hpp"
+#include "../utils/index.hpp"
+#include "../utils/object_store.hpp"
+#include "../utils/hasher.hpp"
+#include "../utils/parallel.hpp"
+#include "../utils/thread_pool.hpp"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <filesystem>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+namespace cmd
+{
+  Command *fsckCmd = nullptr;
+
+  // One stored copy of an object: a loose file or an entry in a pack
+  struct ObjectCopy
+  {
+    utils::ObjectId hash;
+    const utils::PackReader *pack = nullptr; // null for loose objects
+    bool ok = false;
+    uint64_t bytes = 0;
+  };
+
+  // Packed copies verified by one task, so small objects can be hashed together
+  const size_t FSCK_PACKED_BATCH = 64;
+
+  // Rehash a loose copy block by block without holding it in memory. Content
+  // that turns out to be a chunk list is kept in list so its chunk
+  // references can be checked afterwards.
+  static void VerifyLooseCopy(ObjectCopy &copy, std::vector<uint8_t> &list)
+  {
+    utils::Hasher hasher;
+    bool maybeList = true;
+    bool decoded = utils::LooseObjectStore().Stream(copy.hash, [&](const uint8_t *data, size_t size)
+                                                    {
+      hasher.Update(data, size);
+      copy.bytes += size;
+      if (maybeList)
+      {
+        list.insert(list.end(), data, data + size);
+        // Chunk lists start with a magic line, decide once it could have arrived
+        maybeList = list.size() < 32 || utils::IsChunkList(list);
+        if (!maybeList)
+        {
+          std::vector<uint8_t>().swap(list);
+        }
+      }
+      return true; });
+
+    copy.ok = decoded && hasher.Finish() == copy.hash;
+    if (!copy.ok)
+    {
+      list.clear();
+    }
+  }
+
+  // Rehash packed copies like VerifyLooseCopy, lists[i] for batch[i]. Small
+  // objects are kept until all are read and hashed together with HashBatch,
+  // larger ones are hashed as soon as they are read.
+  static void VerifyPackedCopies(const std::vector<ObjectCopy *> &batch, std::vector<std::vector<uint8_t>> &lists)
+  {
+    lists.assign(batch.size(), {});
+    std::vector<std::vector<uint8_t>> contents;
+    std::vector<size_t> contentIndexes;
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+      ObjectCopy &copy = *batch[i];
+      std::vector<uint8_t> content;
+      if (!copy.pack->ReadContent(copy.hash, content))
+      {
+        continue;
+      }
+      copy.bytes = content.size();
+      if (content.size() <= utils::HASH_BATCH_MAX_SIZE)
+      {
+        contents.push_back(std::move(content));
+        contentIndexes.push_back(i);
+        continue;
+      }
+      copy.ok = utils::HashContent(content) == copy.hash;
+      if (copy.ok && utils::IsChunkList(content))
+      {
+        lists[i].swap(content);
+      }
+    }
+
+    std::vector<utils::ObjectId> ids = utils::HashBatch(contents);
+    for (size_t k = 0; k < ids.size(); k++)
+    {
+      size_t i = contentIndexes[k];
+      batch[i]->ok = ids[k] == batch[i]->hash;
+      if (batch[i]->ok && utils::IsChunkList(contents[k]))
+      {
+        lists[i].swap(contents[k]);
+      }
+    }
+  }
+
+  static std::string Location(const ObjectCopy &copy)
+  {
+    return copy.pack ? copy.pack->Path().filename().string() : "loose";
+  }
+
+  int Fsck(const std::vector<std::string> &args)
+  {
+    // Check for the .microgit directory
+    if (!fs::exists(utils::DEFAULT_PATH))
+    {
+      std::cerr << "Error: Not a MicroGit repository (or any parent up to mount point /)" << std::endl;
+      return 1;
+    }
+
+    size_t threads = utils::DefaultWorkerCount();
+    for (const auto &arg : args)
+    {
+      if (utils::starts_with(arg, "--threads="))
+      {
+        try
+        {
+          threads = std::stoul(arg.substr(10));
+        }
+        catch (const std::exception &)
+        {
+          threads = 0;
+        }
+        if (threads == 0)
+        {
+          std::cerr << "Error: Invalid thread count '" << arg.substr(10) << "'" << std::endl;
+          return 1;
+        }
+      }
+      else
+      {
+        std::cerr << "Error: Unknown option '" << arg << "'" << std::endl;
+        std::cerr << "Usage: microgit fsck [--threads=<n>]" << std::endl;
+        return 1;
+      }
+    }
+
+    // Every stored copy is checked, so an object both loose and packed is read twice
+    std::vector<ObjectCopy> copies;
+    for (const auto &hash : utils::ListLooseObjects())
+    {
+      copies.push_back({hash});
+    }
+    for (const auto &pack : utils::GetPacks())
+    {
+      for (uint32_t i = 0; i < pack->Count(); i++)
+      {
+        copies.push_back({pack->HashAt(i), pack.get()});
+      }
+    }
+
+    // Objects vary from a few bytes to whole files, so workers that finish
+    // their share early steal from the ones still reading large objects
+    std::unordered_map<utils::ObjectId, std::vector<utils::Chunk>> chunkLists;
+    std::mutex mutex;
+    auto start = std::chrono::steady_clock::now();
+    size_t steals = 0;
+    {
+      auto recordList = [&chunkLists, &mutex](const ObjectCopy &copy, const std::vector<uint8_t> &list)
+      {
+        std::vector<utils::Chunk> chunks;
+        if (!list.empty() && utils::ParseChunkList(list, chunks))
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          chunkLists[copy.hash] = std::move(chunks);
+        }
+      };
+
+      utils::ThreadPool pool(threads);
+      std::vector<ObjectCopy *> packed;
+      auto submitPacked = [&]()
+      {
+        pool.Submit([batch = std::move(packed), recordList]()
+                    {
+          std::vector<std::vector<uint8_t>> lists;
+          VerifyPackedCopies(batch, lists);
+          for (size_t i = 0; i < batch.size(); i++)
+          {
+            recordList(*batch[i], lists[i]);
+          } });
+        packed.clear();
+      };
+
+      for (auto &copy : copies)
+      {
+        if (copy.pack)
+        {
+          packed.push_back(&copy);
+          if (packed.size() == FSCK_PACKED_BATCH)
+          {
+            submitPacked();
+          }
+          continue;
+        }
+        pool.Submit([&copy, recordList]()
+                    {
+          std::vector<uint8_t> list;
+          VerifyLooseCopy(copy, list);
+          recordList(copy, list); });
+      }
+      if (!packed.empty())
+      {
+        submitPacked();
+      }
+      pool.Wait();
+      steals = pool.Steals();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::unordered_set<utils::ObjectId> present;
+    std::unordered_set<utils::ObjectId> damaged;
+    uint64_t totalBytes = 0;
+    size_t corrupt = 0;
+    for (const auto &copy : copies)
+    {
+      totalBytes += copy.bytes;
+      if (copy.ok)
+      {
+        present.insert(copy.hash);
+      }
+      else
+      {
+        std::cout << "corrupt " << copy.hash << " (" << Location(copy) << ")" << std::endl;
+        damaged.insert(copy.hash);
+        corrupt++;
+      }
+    }
+
+    // Walk the history from HEAD and LATEST and check every reference
+    std::unordered_set<utils::ObjectId> reachable;
+    std::set<utils::ObjectId> missing;
+    std::vector<utils::ObjectId> blobs = PendingBlobs();
+    utils::Index index;
+    if (!index.Load())
+    {
+      std::cout << "broken index" << std::endl;
+      corrupt++;
+    }
+    std::vector<utils::ObjectId> pending = {GetHead(), GetLatest()};
+    size_t savePoints = 0;
+    while (!pending.empty())
+    {
+      utils::ObjectId hash = pending.back();
+      pending.pop_back();
+      if (hash.IsNull() || !reachable.insert(hash).second)
+      {
+        continue;
+      }
+      if (!present.count(hash))
+      {
+        missing.insert(hash);
+        continue;
+      }
+
+      std::shared_ptr<const utils::SavePoint> savePoint;
+      try
+      {
+        savePoint = utils::ReadSavePoint(hash);
+      }
+      catch (const std::exception &e)
+      {
+        std::cout << "broken SavePoint " << hash << ": " << e.what() << std::endl;
+        corrupt++;
+        continue;
+      }
+      if (!savePoint)
+      {
+        missing.insert(hash);
+        continue;
+      }
+
+      savePoints++;
+      pending.push_back(savePoint->parent);
+      for (const auto &file : savePoint->files)
+      {
+        blobs.push_back(file.second);
+      }
+
+      // Subtrees shared with an earlier SavePoint are already reachable and skipped
+      std::vector<utils::ObjectId> trees = {savePoint->tree};
+      while (!trees.empty())
+      {
+        utils::ObjectId tree = trees.back();
+        trees.pop_back();
+        if (tree.IsNull() || !reachable.insert(tree).second)
+        {
+          continue;
+        }
+        if (!present.count(tree))
+        {
+          missing.insert(tree);
+          continue;
+        }
+
+        std::vector<utils::TreeEntry> entries;
+        if (!utils::ReadTree(tree, entries))
+        {
+          std::cout << "broken tree " << tree << std::endl;
+          corrupt++;
+          continue;
+        }
+        for (const auto &entry : entries)
+        {
+          (entry.directory ? trees : blobs).push_back(entry.hash);
+        }
+      }
+    }
+
+    for (const auto &hash : blobs)
+    {
+      if (!reachable.insert(hash).second)
+      {
+        continue;
+      }
+      if (!present.count(hash))
+      {
+        missing.insert(hash);
+        continue;
+      }
+
+      auto list = chunkLists.find(hash);
+      if (list == chunkLists.end())
+      {
+        continue;
+      }
+      for (const auto &chunk : list->second)
+      {
+        reachable.insert(chunk.hash);
+        if (!present.count(chunk.hash))
+        {
+          missing.insert(chunk.hash);
+        }
+      }
+    }
+
+    // Objects with only corrupt copies were reported above
+    for (const auto &hash : damaged)
+    {
+      if (!present.count(hash))
+      {
+        missing.erase(hash);
+      }
+    }
+    for (const auto &hash : missing)
+    {
+      std::cout << "missing " << hash << std::endl;
+    }
+
+    std::vector<utils::ObjectId> dangling;
+    for (const auto &hash : present)
+    {
+      if (!reachable.count(hash))
+      {
+        dangling.push_back(hash);
+      }
+    }
+    std::sort(dangling.begin(), dangling.end());
+    for (const auto &hash : dangling)
+    {
+      std::cout << "dangling " << hash << std::endl;
+    }
+
+    double mib = totalBytes / (1024.0 * 1024.0);
+    std::cout << std::fixed << std::setprecision(2)
+              << "Checked " << copies.size() << " object(s) (" << mib << " MiB) in " << seconds
+              << " s: " << (seconds > 0 ? mib / seconds : 0.0) << " MiB/s on " << threads
+              << " thread(s), " << steals << " task(s) stolen" << std::endl;
+    std::cout << "Walked " << savePoints << " SavePoint(s): " << corrupt << " corrupt, "
+              << missing.size() << " missing, " << dangling.size() << " dangling" << std::endl;
+
+    return corrupt > 0 || !missing.empty() ? 1 : 0;
+  }
+
+  void InitFsckCommand()
+  {
+    fsckCmd = new Command(
+        "fsck",
+        "Verify the integrity of the object store",
+        "Rehash every stored object and check the references between them.\n\n"
+        "Usage:\n"
+        "  microgit fsck [--threads=<n>]\n\n"
+        "Each loose object and each packed object is decompressed and hashed\n"
+        "again on a work-stealing pool of threads (one per core by default), and\n"
+        "objects whose content no longer matches their name are reported as\n"
+        "corrupt. The history is then walked from HEAD and LATEST: parents, files\n"
+        "and chunks that are not stored are reported as missing, and stored\n"
+        "objects that nothing references as dangling (gc deletes those).\n\n"
+        "Exits with status 1 if anything is corrupt or missing.");
+
+    fsckCmd->SetRunFunc([](const std::vector<std::string> &args)
+                        { Fsck(args); });
+
+    rootCmd->AddCommand(fsckCmd);
+  }
+} // namespace cmd
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "root.hpp"
+#include <string>
+#include <vector>
+
+namespace cmd
+{
+  extern Command *fsckCmd;
+
+  // Verify the content hash of every object and the references between them
+  int Fsck(const std::vector<std::string> &args);
+
+  // Initialize the fsck command
+  void InitFsckCommand();
+} // namespace cmd
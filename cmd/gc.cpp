@@ -0,0 +1,393 @@
+#include "gc.hpp"
+#include "pack.hpp"
+#include "save.hpp"
+#include "../utils/main.hpp"
+#include "../utils/pack.hpp"
+#include "../utils/cache.hpp"
+#include "../utils/chunks.hpp"
+#include "../utils/tree.hpp"
+#include "../utils/index.hpp"
+#include "../utils/config.hpp"
+#include "../utils/parallel.hpp"
+#include "../utils/object_store.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <vector>
+#include <set>
+#include <map>
+#include <unordered_set>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+namespace cmd
+{
+  Command *gcCmd = nullptr;
+
+  // Unreachable objects younger than this many seconds are kept, so objects
+  // written by a command that is still running are never deleted
+  const long DEFAULT_GC_GRACE_PERIOD = 14 * 24 * 60 * 60;
+
+  std::vector<utils::ObjectId> PendingBlobs()
+  {
+    std::vector<utils::ObjectId> hashes;
+
+    fs::path stagingDir = fs::path(utils::DEFAULT_PATH) / "staging";
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(stagingDir, ec))
+    {
+      std::ifstream stageFile(entry.path());
+      std::string line;
+      utils::ObjectId hash;
+      if (std::getline(stageFile, line) && utils::ObjectId::FromHex(line, hash))
+      {
+        hashes.push_back(hash);
+      }
+    }
+
+    // A damaged index is skipped here, gc refuses to run on one
+    utils::Index index;
+    if (index.Load())
+    {
+      for (const auto &entry : index.Entries())
+      {
+        hashes.push_back(entry.hash);
+      }
+    }
+    return hashes;
+  }
+
+  // Mark every object reachable from HEAD, LATEST and the staging area.
+  // Returns false if the history could not be read completely.
+  static bool MarkReachable(std::unordered_set<utils::ObjectId> &reachable, size_t &savePoints)
+  {
+    // The objects a damaged index refers to are unknown
+    utils::Index index;
+    if (!index.Load())
+    {
+      std::cerr << "Error: The index is damaged" << std::endl;
+      return false;
+    }
+
+    // Walk the SavePoint chains; history is small next to the file data
+    std::vector<utils::ObjectId> blobs = PendingBlobs();
+    std::vector<utils::ObjectId> pending = {GetHead(), GetLatest()};
+    while (!pending.empty())
+    {
+      utils::ObjectId hash = pending.back();
+      pending.pop_back();
+      if (hash.IsNull() || !reachable.insert(hash).second)
+      {
+        continue;
+      }
+
+      std::shared_ptr<const utils::SavePoint> savePoint;
+      try
+      {
+        savePoint = utils::ReadSavePoint(hash);
+      }
+      catch (const std::exception &e)
+      {
+        std::cerr << "Error: SavePoint " << hash << " is corrupt: " << e.what() << std::endl;
+        return false;
+      }
+      if (!savePoint)
+      {
+        std::cerr << "Error: SavePoint " << hash << " is missing" << std::endl;
+        return false;
+      }
+
+      // Trees are marked whole, an unreadable one means unknown files
+      std::vector<utils::ObjectId> trees;
+      std::map<std::string, utils::ObjectId> files;
+      if (!utils::ListTrees(savePoint->tree, trees) || !utils::SavePointFiles(*savePoint, files))
+      {
+        std::cerr << "Error: The tree of SavePoint " << hash << " is missing or corrupt" << std::endl;
+        return false;
+      }
+      reachable.insert(trees.begin(), trees.end());
+
+      savePoints++;
+      pending.push_back(savePoint->parent);
+      for (const auto &file : files)
+      {
+        blobs.push_back(file.second);
+      }
+    }
+
+    std::sort(blobs.begin(), blobs.end());
+    blobs.erase(std::unique(blobs.begin(), blobs.end()), blobs.end());
+
+    // Chunked files reference their chunks. The object header tells which
+    // blobs are chunk lists, so only those are read.
+    std::mutex mutex;
+    std::atomic<size_t> missing{0};
+    utils::ParallelFor(blobs.size(), utils::DefaultWorkerCount(), [&](size_t i)
+                {
+      utils::ObjectInfo info;
+      std::vector<uint8_t> content;
+      if (!utils::GetObjectStore().Info(blobs[i], info) ||
+          (info.type == utils::ObjectType::ChunkList && !utils::ReadObject(blobs[i], content)))
+      {
+        missing++;
+        return;
+      }
+
+      std::vector<utils::Chunk> chunks;
+      std::lock_guard<std::mutex> lock(mutex);
+      reachable.insert(blobs[i]);
+      if (utils::ParseChunkList(content, chunks))
+      {
+        for (const auto &chunk : chunks)
+        {
+          reachable.insert(chunk.hash);
+        }
+      } });
+
+    if (missing > 0)
+    {
+      std::cerr << "Warning: " << missing << " referenced object(s) are missing" << std::endl;
+    }
+    return true;
+  }
+
+  static bool OlderThan(const fs::path &path, fs::file_time_type cutoff)
+  {
+    std::error_code ec;
+    fs::file_time_type modified = fs::last_write_time(path, ec);
+    return !ec && modified < cutoff;
+  }
+
+  // Remove temp files left behind by interrupted writes
+  static size_t RemoveStaleTempFiles(fs::file_time_type cutoff, std::atomic<uintmax_t> &bytesReclaimed)
+  {
+    size_t removed = 0;
+    std::vector<fs::path> dirs = {fs::path(utils::DEFAULT_PATH) / "objects"};
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(dirs[0], ec))
+    {
+      if (entry.is_directory())
+      {
+        dirs.push_back(entry.path());
+      }
+    }
+
+    for (const auto &dir : dirs)
+    {
+      for (const auto &entry : fs::directory_iterator(dir, ec))
+      {
+        std::string name = entry.path().filename().string();
+        if (utils::starts_with(name, utils::TEMP_OBJECT_PREFIX) && entry.is_regular_file() &&
+            OlderThan(entry.path(), cutoff))
+        {
+          uintmax_t size = entry.file_size(ec);
+          if (fs::remove(entry.path(), ec))
+          {
+            bytesReclaimed += ec ? 0 : size;
+            removed++;
+          }
+        }
+      }
+    }
+    return removed;
+  }
+
+  static uintmax_t PackSize(const fs::path &packPath)
+  {
+    fs::path indexPath = packPath;
+    indexPath.replace_extension(".idx");
+    std::error_code ec;
+    uintmax_t packSize = fs::file_size(packPath, ec);
+    packSize = ec ? 0 : packSize;
+    uintmax_t indexSize = fs::file_size(indexPath, ec);
+    return packSize + (ec ? 0 : indexSize);
+  }
+
+  int Gc(const std::vector<std::string> &args)
+  {
+    // Check for the .microgit directory
+    if (!fs::exists(utils::DEFAULT_PATH))
+    {
+      std::cerr << "Error: Not a MicroGit repository (or any parent up to mount point /)" << std::endl;
+      return 1;
+    }
+
+    long grace = utils::GetConfigInt("gc.graceperiod", DEFAULT_GC_GRACE_PERIOD);
+    for (const auto &arg : args)
+    {
+      if (arg == "--now")
+      {
+        grace = 0;
+      }
+      else if (utils::starts_with(arg, "--grace="))
+      {
+        try
+        {
+          grace = std::stol(arg.substr(8));
+        }
+        catch (const std::exception &)
+        {
+          std::cerr << "Error: Invalid grace period '" << arg.substr(8) << "'" << std::endl;
+          return 1;
+        }
+      }
+      else
+      {
+        std::cerr << "Error: Unknown option '" << arg << "'" << std::endl;
+        std::cerr << "Usage: microgit gc [--grace=<seconds>] [--now]" << std::endl;
+        return 1;
+      }
+    }
+    fs::file_time_type cutoff = fs::file_time_type::clock::now() - std::chrono::seconds(grace);
+
+    // Mark
+    std::unordered_set<utils::ObjectId> reachable;
+    size_t savePoints = 0;
+    if (!MarkReachable(reachable, savePoints))
+    {
+      std::cerr << "Error: Refusing to delete objects while history is unreadable" << std::endl;
+      return 1;
+    }
+
+    // Sweep loose objects
+    std::vector<utils::ObjectId> looseObjects = utils::ListLooseObjects();
+    std::vector<utils::ObjectId> unreachable;
+    for (const auto &hash : looseObjects)
+    {
+      if (!reachable.count(hash))
+      {
+        unreachable.push_back(hash);
+      }
+    }
+
+    std::atomic<uintmax_t> bytesReclaimed{0};
+    std::atomic<size_t> looseRemoved{0};
+    std::atomic<size_t> looseKept{0};
+    utils::ParallelFor(unreachable.size(), utils::DefaultWorkerCount(), [&](size_t i)
+                {
+      fs::path objectPath = utils::ObjectPath(unreachable[i]);
+      if (!OlderThan(objectPath, cutoff))
+      {
+        looseKept++;
+        return;
+      }
+
+      std::error_code ec;
+      uintmax_t size = fs::file_size(objectPath, ec);
+      if (fs::remove(objectPath, ec))
+      {
+        bytesReclaimed += size;
+        looseRemoved++;
+        // Drop the fan-out directory once it is empty (fails harmlessly otherwise)
+        if (objectPath.parent_path().filename() != "objects")
+        {
+          fs::remove(objectPath.parent_path(), ec);
+        }
+      } });
+
+    size_t tempRemoved = RemoveStaleTempFiles(cutoff, bytesReclaimed);
+
+    // Packs holding unreachable objects are rewritten with only the reachable ones
+    std::vector<fs::path> oldPacks;
+    std::vector<utils::ObjectId> keep;
+    size_t packedDropped = 0;
+    for (const auto &pack : utils::GetPacks())
+    {
+      std::vector<utils::ObjectId> live;
+      for (uint32_t i = 0; i < pack->Count(); i++)
+      {
+        utils::ObjectId hash = pack->HashAt(i);
+        if (reachable.count(hash))
+        {
+          live.push_back(hash);
+        }
+      }
+
+      if (live.size() < pack->Count() && OlderThan(pack->Path(), cutoff))
+      {
+        oldPacks.push_back(pack->Path());
+        packedDropped += pack->Count() - live.size();
+        keep.insert(keep.end(), live.begin(), live.end());
+      }
+    }
+
+    fs::path packPath;
+    if (!keep.empty())
+    {
+      int maxDepth = utils::GetConfigInt("pack.depth", utils::DEFAULT_PACK_DEPTH);
+      std::set<utils::ObjectId> available(keep.begin(), keep.end());
+      packPath = utils::WritePack(keep, PlanDeltaBases(available, maxDepth));
+      if (packPath.empty())
+      {
+        std::cerr << "Error: Could not write packfile" << std::endl;
+        return 1;
+      }
+
+      // The new pack must be on disk before the old ones go away
+      utils::MarkObjectsForSync();
+      if (!utils::SyncObjects())
+      {
+        std::cerr << "Error: Could not flush packfile to disk" << std::endl;
+        return 1;
+      }
+    }
+
+    uintmax_t packBytesBefore = 0;
+    for (const auto &oldPack : oldPacks)
+    {
+      packBytesBefore += PackSize(oldPack);
+      if (oldPack.filename() == packPath.filename())
+      {
+        continue;
+      }
+      fs::path oldIndex = oldPack;
+      oldIndex.replace_extension(".idx");
+      std::error_code ec;
+      fs::remove(oldIndex, ec);
+      fs::remove(oldPack, ec);
+    }
+    uintmax_t packBytesAfter = packPath.empty() ? 0 : PackSize(packPath);
+    if (packBytesBefore > packBytesAfter)
+    {
+      bytesReclaimed += packBytesBefore - packBytesAfter;
+    }
+    utils::ReloadPacks();
+
+    // Deleted hashes must not be treated as stored by later writes
+    utils::ForgetKnownObjects();
+
+    std::cout << "Marked " << reachable.size() << " reachable object(s) from "
+              << savePoints << " SavePoint(s)" << std::endl;
+    std::cout << "Removed " << looseRemoved << " loose object(s) and " << tempRemoved
+              << " stale temp file(s), kept " << looseKept << " within the grace period" << std::endl;
+    std::cout << "Repacked " << oldPacks.size() << " pack(s), dropping " << packedDropped
+              << " unreachable object(s)" << std::endl;
+    std::cout << "Reclaimed " << bytesReclaimed << " byte(s)" << std::endl;
+    return 0;
+  }
+
+  void InitGcCommand()
+  {
+    gcCmd = new Command(
+        "gc",
+        "Delete unreachable objects",
+        "Delete objects that nothing references any more.\n\n"
+        "Usage:\n"
+        "  microgit gc [--grace=<seconds>] [--now]\n\n"
+        "Objects reachable from HEAD, LATEST, their parent SavePoints, the staging\n"
+        "area and the index are kept. Unreachable loose objects are deleted and\n"
+        "packs holding unreachable objects are rewritten without them.\n\n"
+        "Objects younger than the grace period (gc.graceperiod, default two weeks)\n"
+        "are kept so that a concurrent add is never cut short. --now disables it.");
+
+    gcCmd->SetRunFunc([](const std::vector<std::string> &args)
+                      { Gc(args); });
+
+    rootCmd->AddCommand(gcCmd);
+  }
+} // namespace cmd
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "root.hpp"
+#include "../utils/object_id.hpp"
+#include <string>
+#include <vector>
+
+namespace cmd
+{
+  extern Command *gcCmd;
+
+  // Hashes referenced outside of any SavePoint: the staging area and the index
+  std::vector<utils::ObjectId> PendingBlobs();
+
+  // Delete objects that are no longer reachable from HEAD, LATEST or the staging area
+  int Gc(const std::vector<std::string> &args);
+
+  // Initialize the gc command
+  void InitGcCommand();
+} // namespace cmd
@@ -1,5 +1,8 @@
 #include "init.hpp"
 #include "../utils/main.hpp"
+#include "../utils/config.hpp"
+#include "../utils/hasher.hpp"
+#include "../utils/index.hpp"
 #include <iostream>
 #include <fstream>
 #include <filesystem>
@@ -16,6 +19,17 @@ namespace cmd
         std::string objectsDir = utils::DEFAULT_PATH + "/objects";
         std::string refsDir = utils::DEFAULT_PATH + "/refs";
 
+        utils::HashAlgorithm hashAlgorithm = utils::HashAlgorithm::Sha256;
+        for (const auto &arg : args)
+        {
+            if (!utils::starts_with(arg, "--hash=") || !utils::ParseHashAlgorithm(arg.substr(7), hashAlgorithm))
+            {
+                std::cerr << "Error: Unknown option '" << arg << "'" << std::endl;
+                std::cerr << "Usage: microgit init [--hash=sha256|blake3]" << std::endl;
+                return 1;
+            }
+        }
+
         if (fs::exists(repoDir))
         {
             std::cout << "\nRepository already initialized." << std::endl;
@@ -42,9 +56,20 @@ namespace cmd
             latestFile.close();
 
             // Create empty index file
-            std::ofstream indexFile(utils::DEFAULT_PATH + "/index");
-            indexFile << "{}";
-            indexFile.close();
+            utils::Index index;
+            if (!index.Write())
+            {
+                std::cerr << "Error: Could not write the index" << std::endl;
+                return 1;
+            }
+
+            // Record the repository format so later versions know the object layout
+            if (!utils::SetConfig("core.formatversion", std::to_string(utils::REPOSITORY_FORMAT_VERSION)) ||
+                !utils::SetConfig("core.hash", utils::HashAlgorithmName(hashAlgorithm)))
+            {
+                std::cerr << "Error: Could not write repository config" << std::endl;
+                return 1;
+            }
 
             std::cout << "Initialized empty MicroGit repository in " << fs::absolute(repoDir) << std::endl;
             return 0;
@@ -63,7 +88,12 @@ namespace cmd
             "Initialize a new MicroGit repository",
             "Initialize a new MicroGit repository in the current directory.\n"
             "This creates the necessary directory structure and files for version control.\n"
-            "The repository will be initialized in a .microgit directory.");
+            "The repository will be initialized in a .microgit directory.\n\n"
+            "Usage:\n"
+            "  microgit init [--hash=sha256|blake3]\n\n"
+            "--hash picks the function that names objects, SHA-256 by default.\n"
+            "BLAKE3 is several times faster on large files and hashes big inputs\n"
+            "on every core. convert-hash switches an existing repository.");
 
         initCmd->SetRunFunc([](const std::vector<std::string> &args)
                             { Init(args); });
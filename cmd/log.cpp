@@ -1,11 +1,14 @@
 #include "log.hpp"
 #include "../utils/main.hpp"
 #include "../utils/json.hpp"
+#include "../utils/cache.hpp"
+#include "../utils/tree.hpp"
 #include <iostream>
 #include <fstream>
 #include <filesystem>
 #include <string>
 #include <vector>
+#include <map>
 
 namespace fs = std::filesystem;
 
@@ -13,24 +16,17 @@ namespace cmd
 {
   Command *logCmd = nullptr;
 
-  utils::SavePoint ReadCommit(const std::string &hash)
+  utils::SavePoint ReadCommit(const utils::ObjectId &hash)
   {
-    if (hash.empty())
+    if (hash.IsNull())
     {
       return utils::SavePoint();
     }
 
-    std::string commitPath = utils::DEFAULT_PATH + "/objects/" + hash;
-    if (!utils::FileExists(commitPath))
-    {
-      return utils::SavePoint();
-    }
-
-    std::string commitContent = utils::ReadFile(commitPath);
     try
     {
-      // Replace the non-existent FromJson method with Parse
-      return utils::JSON::Parse(commitContent);
+      auto savePoint = utils::ReadSavePoint(hash);
+      return savePoint ? *savePoint : utils::SavePoint();
     }
     catch (const std::exception &e)
     {
@@ -39,6 +35,47 @@ namespace cmd
     }
   }
 
+  // Print the files a SavePoint changed relative to its parent. Between two
+  // trees only differing subtrees are read.
+  static void PrintChanges(const utils::SavePoint &savePoint)
+  {
+    auto print = [](const std::string &path, const utils::ObjectId &oldHash, const utils::ObjectId &newHash)
+    {
+      const char *kind = oldHash.IsNull() ? "added:    " : newHash.IsNull() ? "deleted:  " : "modified: ";
+      std::cout << "    " << kind << path << std::endl;
+    };
+
+    utils::SavePoint parent = ReadCommit(savePoint.parent);
+    if (!savePoint.tree.IsNull() && (savePoint.parent.IsNull() || !parent.tree.IsNull()))
+    {
+      if (!utils::DiffTrees(parent.tree, savePoint.tree, print))
+      {
+        std::cerr << "Warning: Could not read the trees of this commit" << std::endl;
+      }
+      return;
+    }
+
+    // SavePoints from before trees only list their files
+    std::map<std::string, utils::ObjectId> before, after;
+    utils::SavePointFiles(parent, before);
+    utils::SavePointFiles(savePoint, after);
+    for (const auto &[path, hash] : after)
+    {
+      auto old = before.find(path);
+      if (old == before.end() || old->second != hash)
+      {
+        print(path, old == before.end() ? utils::ObjectId() : old->second, hash);
+      }
+    }
+    for (const auto &[path, hash] : before)
+    {
+      if (!after.count(path))
+      {
+        print(path, hash, utils::ObjectId());
+      }
+    }
+  }
+
   int Log(const std::vector<std::string> &args)
   {
     // Check for the .microgit directory
@@ -49,14 +86,14 @@ namespace cmd
     }
 
     // Get current HEAD
-    std::string currentHash = "";
+    std::string head;
     fs::path headFile = fs::path(utils::DEFAULT_PATH) / "HEAD";
     if (fs::exists(headFile))
     {
-      std::ifstream head(headFile);
-      if (head)
+      std::ifstream headStream(headFile);
+      if (headStream)
       {
-        std::getline(head, currentHash);
+        std::getline(headStream, head);
       }
     }
     else
@@ -65,7 +102,8 @@ namespace cmd
       return 1;
     }
 
-    if (currentHash.empty())
+    utils::ObjectId currentHash;
+    if (!utils::ObjectId::FromHex(head, currentHash))
     {
       std::cerr << "No commits yet" << std::endl;
       return 0;
@@ -73,11 +111,17 @@ namespace cmd
 
     // Determine how many commits to show (default to all)
     int limit = -1; // -1 means no limit
-    if (!args.empty())
+    bool showChanges = false;
+    for (const auto &arg : args)
     {
+      if (arg == "--stat")
+      {
+        showChanges = true;
+        continue;
+      }
       try
       {
-        limit = std::stoi(args[0]);
+        limit = std::stoi(arg);
       }
       catch (const std::exception &)
       {
@@ -89,8 +133,8 @@ namespace cmd
     int commits_shown = 0;
 
     // Start from HEAD and follow parent chain
-    std::string hash = currentHash;
-    while (!hash.empty())
+    utils::ObjectId hash = currentHash;
+    while (!hash.IsNull())
     {
       if (limit > 0 && commits_shown >= limit)
       {
@@ -100,26 +144,27 @@ namespace cmd
       // Read savepoint from objects
       try
       {
-        fs::path objectPath = fs::path(utils::DEFAULT_PATH) / "objects" / hash;
-        if (!fs::exists(objectPath))
+        auto savePoint = utils::ReadSavePoint(hash);
+        if (!savePoint)
         {
           std::cerr << "Warning: Missing object for commit " << hash << std::endl;
           break;
         }
 
-        std::ifstream file(objectPath);
-        std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-        utils::SavePoint savePoint = utils::JSON::Parse(content);
-
         // Display commit information
-        std::cout << "Commit: " << hash.substr(0, 8) << "..." << std::endl;
-        std::cout << "Date:   " << savePoint.timestamp << std::endl;
+        std::cout << "Commit: " << hash.Hex().substr(0, 8) << "..." << std::endl;
+        std::cout << "Date:   " << savePoint->timestamp << std::endl;
         std::cout << std::endl;
-        std::cout << "    " << savePoint.message << std::endl;
+        std::cout << "    " << savePoint->message << std::endl;
         std::cout << std::endl;
+        if (showChanges)
+        {
+          PrintChanges(*savePoint);
+          std::cout << std::endl;
+        }
 
         // Move to parent
-        hash = savePoint.parent;
+        hash = savePoint->parent;
         commits_shown++;
       }
       catch (const std::exception &e)
@@ -145,7 +190,8 @@ namespace cmd
         "Show the commit history with the most recent commits first.\n\n"
         "Usage:\n"
         "  microgit log         - Show all commits\n"
-        "  microgit log <n>     - Show only the last n commits\n\n"
+        "  microgit log <n>     - Show only the last n commits\n"
+        "  microgit log --stat  - Also list the files each commit changed\n\n"
         "Each commit shows:\n"
         "- Commit hash (abbreviated)\n"
         "- Date and time\n"
@@ -10,7 +10,7 @@ namespace cmd
   extern Command *logCmd;
 
   // Read a commit from its hash
-  utils::SavePoint ReadCommit(const std::string &hash);
+  utils::SavePoint ReadCommit(const utils::ObjectId &hash);
 
   void InitLogCommand();
 
@@ -0,0 +1,130 @@
+#include "migrate.hpp"
+#include "../utils/main.hpp"
+#include "../utils/config.hpp"
+#include <iostream>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace cmd
+{
+  Command *migrateCmd = nullptr;
+
+  // Move flat objects/<hash> files into the fan-out layout
+  static bool MigrateToFanout(int &objectsMoved)
+  {
+    fs::path objectsDir = fs::path(utils::DEFAULT_PATH) / "objects";
+    if (!fs::exists(objectsDir))
+    {
+      return true;
+    }
+
+    // Collect first so we don't modify the directory while iterating it
+    std::vector<utils::ObjectId> hashes;
+    for (const auto &entry : fs::directory_iterator(objectsDir))
+    {
+      utils::ObjectId hash;
+      if (entry.is_regular_file() && utils::ObjectId::FromHex(entry.path().filename().string(), hash))
+      {
+        hashes.push_back(hash);
+      }
+    }
+
+    for (const auto &hash : hashes)
+    {
+      fs::path from = utils::ObjectPath(hash, utils::FORMAT_FLAT_OBJECTS);
+      fs::path to = utils::ObjectPath(hash, utils::FORMAT_FANOUT_OBJECTS);
+      if (from == to)
+      {
+        continue;
+      }
+
+      try
+      {
+        fs::create_directories(to.parent_path());
+        if (fs::exists(to))
+        {
+          // Same hash means same content, the flat copy is redundant
+          fs::remove(from);
+        }
+        else
+        {
+          fs::rename(from, to);
+        }
+        objectsMoved++;
+      }
+      catch (const std::exception &e)
+      {
+        std::cerr << "Error moving object " << hash << ": " << e.what() << std::endl;
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  int Migrate(const std::vector<std::string> &/*args*/)
+  {
+    // Check for the .microgit directory
+    if (!fs::exists(utils::DEFAULT_PATH))
+    {
+      std::cerr << "Error: Not a MicroGit repository (or any parent up to mount point /)" << std::endl;
+      return 1;
+    }
+
+    int version = utils::GetRepositoryFormatVersion();
+    if (version > utils::REPOSITORY_FORMAT_VERSION)
+    {
+      std::cerr << "Error: Repository format version " << version
+                << " is newer than this MicroGit supports (" << utils::REPOSITORY_FORMAT_VERSION << ")" << std::endl;
+      return 1;
+    }
+
+    if (version == utils::REPOSITORY_FORMAT_VERSION)
+    {
+      std::cout << "Repository is already at format version " << version << std::endl;
+      return 0;
+    }
+
+    int objectsMoved = 0;
+    if (version < utils::FORMAT_FANOUT_OBJECTS)
+    {
+      if (!MigrateToFanout(objectsMoved))
+      {
+        std::cerr << "Error: Migration aborted, run 'microgit migrate' again to resume" << std::endl;
+        return 1;
+      }
+      version = utils::FORMAT_FANOUT_OBJECTS;
+    }
+
+    // Only bump the version once every object is in its new place
+    if (!utils::SetConfig("core.formatversion", std::to_string(version)))
+    {
+      std::cerr << "Error: Could not update repository config" << std::endl;
+      return 1;
+    }
+
+    std::cout << "Migrated repository to format version " << version
+              << " (" << objectsMoved << " object(s) moved)" << std::endl;
+    return 0;
+  }
+
+  void InitMigrateCommand()
+  {
+    migrateCmd = new Command(
+        "migrate",
+        "Upgrade the repository to the current format",
+        "Upgrade an existing repository to the current on-disk format in place.\n\n"
+        "Usage:\n"
+        "  microgit migrate\n\n"
+        "Format version 1 stores objects in a two-level fan-out layout\n"
+        "(objects/ab/cdef...) instead of a single flat directory.\n"
+        "The migration can be interrupted and re-run safely.");
+
+    migrateCmd->SetRunFunc([](const std::vector<std::string> &args)
+                           { Migrate(args); });
+
+    rootCmd->AddCommand(migrateCmd);
+  }
+} // namespace cmd
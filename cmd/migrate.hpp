@@ -0,0 +1,16 @@
+#pragma once
+
+#include "root.hpp"
+#include <string>
+#include <vector>
+
+namespace cmd
+{
+  extern Command *migrateCmd;
+
+  // Upgrade the repository to the current on-disk format in place
+  int Migrate(const std::vector<std::string> &args);
+
+  // Initialize the migrate command
+  void InitMigrateCommand();
+} // namespace cmd
@@ -0,0 +1,191 @@
+#include "pack.hpp"
+#include "../utils/main.hpp"
+#include "../utils/pack.hpp"
+#include "../utils/config.hpp"
+#include "../utils/tree.hpp"
+#include "log.hpp"
+#include "save.hpp"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+namespace cmd
+{
+  Command *packCmd = nullptr;
+
+  // Pick a delta base for each file version: the previous version of the same
+  // path found by walking the SavePoint chains from HEAD and LATEST.
+  std::map<utils::ObjectId, utils::ObjectId> PlanDeltaBases(const std::set<utils::ObjectId> &available, int maxDepth)
+  {
+    std::map<utils::ObjectId, utils::ObjectId> bases;
+    std::unordered_map<utils::ObjectId, int> depth; // hash -> delta chain length, decided once per hash
+
+    std::unordered_set<utils::ObjectId> visited;
+    for (const auto &root : {GetHead(), GetLatest()})
+    {
+      // Collect the chain newest first, then replay it oldest first
+      std::vector<utils::SavePoint> chain;
+      for (utils::ObjectId hash = root; !hash.IsNull() && !visited.count(hash);)
+      {
+        visited.insert(hash);
+        utils::SavePoint savePoint = ReadCommit(hash);
+        hash = savePoint.parent;
+        chain.push_back(std::move(savePoint));
+      }
+      std::reverse(chain.begin(), chain.end());
+
+      std::map<std::string, utils::ObjectId> lastVersion; // path -> previous hash
+      for (const auto &savePoint : chain)
+      {
+        std::map<std::string, utils::ObjectId> files;
+        utils::SavePointFiles(savePoint, files);
+        for (const auto &[path, hash] : files)
+        {
+          utils::ObjectId previous = lastVersion[path];
+          lastVersion[path] = hash;
+          if (depth.count(hash) || !available.count(hash))
+          {
+            continue;
+          }
+
+          // Deciding each hash once, in history order, keeps chains acyclic
+          depth[hash] = 0;
+          if (!previous.IsNull() && previous != hash &&
+              depth.count(previous) && depth[previous] < maxDepth)
+          {
+            bases[hash] = previous;
+            depth[hash] = depth[previous] + 1;
+          }
+        }
+      }
+    }
+
+    return bases;
+  }
+
+  int Pack(const std::vector<std::string> &/*args*/)
+  {
+    // Check for the .microgit directory
+    if (!fs::exists(utils::DEFAULT_PATH))
+    {
+      std::cerr << "Error: Not a MicroGit repository (or any parent up to mount point /)" << std::endl;
+      return 1;
+    }
+
+    // Gather every object, loose and already packed
+    std::vector<utils::ObjectId> looseObjects = utils::ListLooseObjects();
+    std::vector<utils::ObjectId> hashes = looseObjects;
+    std::vector<fs::path> oldPacks;
+    for (const auto &pack : utils::GetPacks())
+    {
+      oldPacks.push_back(pack->Path());
+      for (uint32_t i = 0; i < pack->Count(); i++)
+      {
+        hashes.push_back(pack->HashAt(i));
+      }
+    }
+
+    if (hashes.empty())
+    {
+      std::cout << "Nothing to pack" << std::endl;
+      return 0;
+    }
+
+    int maxDepth = utils::GetConfigInt("pack.depth", utils::DEFAULT_PACK_DEPTH);
+    std::set<utils::ObjectId> available(hashes.begin(), hashes.end());
+    std::map<utils::ObjectId, utils::ObjectId> deltaBases = PlanDeltaBases(available, maxDepth);
+
+    fs::path packPath = utils::WritePack(hashes, deltaBases);
+    if (packPath.empty())
+    {
+      std::cerr << "Error: Could not write packfile" << std::endl;
+      return 1;
+    }
+
+    // The pack must be on disk before the loose copies go away
+    utils::MarkObjectsForSync();
+    if (!utils::SyncObjects())
+    {
+      std::cerr << "Error: Could not flush packfile to disk" << std::endl;
+      return 1;
+    }
+
+    // Make sure the new pack really serves every loose object before deleting them
+    auto newPack = utils::PackReader::Open(packPath);
+    if (!newPack)
+    {
+      std::cerr << "Error: Could not open new packfile " << packPath << std::endl;
+      return 1;
+    }
+
+    int looseRemoved = 0;
+    for (const auto &hash : looseObjects)
+    {
+      if (newPack->Contains(hash))
+      {
+        std::error_code ec;
+        fs::path objectPath = utils::ObjectPath(hash);
+        if (fs::remove(objectPath, ec))
+        {
+          looseRemoved++;
+          // Drop the fan-out directory once it is empty (fails harmlessly otherwise)
+          if (objectPath.parent_path().filename() != "objects")
+          {
+            fs::remove(objectPath.parent_path(), ec);
+          }
+        }
+      }
+    }
+
+    // Drop the packs that were consolidated into the new one
+    int packsRemoved = 0;
+    for (const auto &oldPack : oldPacks)
+    {
+      if (oldPack.filename() == packPath.filename())
+      {
+        continue;
+      }
+      fs::path oldIndex = oldPack;
+      oldIndex.replace_extension(".idx");
+      std::error_code ec;
+      fs::remove(oldIndex, ec);
+      fs::remove(oldPack, ec);
+      packsRemoved++;
+    }
+    utils::ReloadPacks();
+
+    std::cout << "Packed " << newPack->Count() << " object(s) into " << packPath.filename().string()
+              << " (" << looseRemoved << " loose object(s) removed, "
+              << packsRemoved << " old pack(s) consolidated)" << std::endl;
+    return 0;
+  }
+
+  void InitPackCommand()
+  {
+    packCmd = new Command(
+        "pack",
+        "Pack loose objects into a single packfile",
+        "Consolidate all loose objects and existing packs into one packfile.\n\n"
+        "Usage:\n"
+        "  microgit pack\n\n"
+        "The packfile is stored in .microgit/objects/pack/ together with a sorted\n"
+        "index that maps each hash to its offset. Reads memory-map the index and\n"
+        "binary-search it, so looking up an object no longer opens a loose file.\n\n"
+        "Each new version of a file is stored as a delta against the previous\n"
+        "version of the same path when that is smaller. Chains are limited to\n"
+        "pack.depth deltas (default 10) so reads stay fast.");
+
+    packCmd->SetRunFunc([](const std::vector<std::string> &args)
+                        { Pack(args); });
+
+    rootCmd->AddCommand(packCmd);
+  }
+} // namespace cmd
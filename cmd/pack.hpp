@@ -0,0 +1,22 @@
+#pragma once
+
+#include "root.hpp"
+#include "../utils/object_id.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+namespace cmd
+{
+  extern Command *packCmd;
+
+  // Consolidate loose objects and existing packs into a single packfile
+  int Pack(const std::vector<std::string> &args);
+
+  // Choose a delta base for each available file version, limiting chains to maxDepth
+  std::map<utils::ObjectId, utils::ObjectId> PlanDeltaBases(const std::set<utils::ObjectId> &available, int maxDepth);
+
+  // Initialize the pack command
+  void InitPackCommand();
+} // namespace cmd
@@ -1,10 +1,15 @@
 #include "remove.hpp"
 #include "root.hpp"
+#include "add.hpp"
+#include "save.hpp"
 #include "../utils/main.hpp"
+#include "../utils/index.hpp"
+#include "../utils/tree.hpp"
 #include <iostream>
 #include <fstream>
 #include <filesystem>
 #include <vector>
+#include <set>
 
 namespace fs = std::filesystem;
 
@@ -12,6 +17,28 @@ namespace cmd
 {
   Command *removeCmd = nullptr;
 
+  // Put the index entries of unstaged paths back to the last commit: the
+  // HEAD object for files HEAD records, no entry for files it does not. The
+  // stat data is left empty, as the working file may no longer hold that
+  // object, so status compares such files by content.
+  static void RestoreIndexEntries(utils::Index &index, const std::set<std::string> &paths)
+  {
+    std::map<std::string, utils::ObjectId> headFiles = FindHeadFiles(paths);
+    for (const auto &path : paths)
+    {
+      auto head = headFiles.find(path);
+      if (head == headFiles.end())
+      {
+        index.Remove(path);
+        continue;
+      }
+      utils::IndexEntry entry;
+      entry.path = path;
+      entry.hash = head->second;
+      index.Set(entry);
+    }
+  }
+
   int Remove(const std::vector<std::string> &args)
   {
     // Check for the .microgit directory
@@ -36,17 +63,57 @@ namespace cmd
       return 1;
     }
 
+    // Unstaged files get their index entries back as of HEAD, written once at the end
+    utils::Index index;
+    index.Load();
+
+    // "." unstages everything
+    if (args.size() == 1 && args[0] == ".")
+    {
+      std::error_code ec;
+      size_t removed = 0;
+      std::set<std::string> unstaged;
+      for (const auto &entry : fs::directory_iterator(stagingDir, ec))
+      {
+        // Each entry holds the hash, then the path it was added from. Only
+        // the staged paths are reset, other files keep their entries.
+        std::string path;
+        {
+          std::ifstream stageFile(entry.path());
+          std::string line;
+          std::getline(stageFile, line);
+          std::getline(stageFile, path);
+        }
+        path = utils::TreePath(path);
+        if (fs::remove(entry.path(), ec))
+        {
+          unstaged.insert(path.empty() ? entry.path().filename().string() : path);
+          removed++;
+        }
+      }
+      RestoreIndexEntries(index, unstaged);
+      if (removed > 0 && !index.Write())
+      {
+        std::cerr << "Error: Could not write the index" << std::endl;
+        return 1;
+      }
+      std::cout << "Summary: " << removed << " file(s) removed from staging" << std::endl;
+      return 0;
+    }
+
     int filesRemoved = 0;
     int filesSkipped = 0;
+    std::set<std::string> unstaged;
 
     for (const auto &file : args)
     {
-      fs::path stagePath = stagingDir / file;
+      fs::path stagePath = stagingDir / StagingName(file);
       if (fs::exists(stagePath))
       {
         try
         {
           fs::remove(stagePath);
+          unstaged.insert(utils::TreePath(file));
           std::cout << "Unstaged '" << file << "'" << std::endl;
           filesRemoved++;
         }
@@ -63,6 +130,13 @@ namespace cmd
       }
     }
 
+    RestoreIndexEntries(index, unstaged);
+    if (filesRemoved > 0 && !index.Write())
+    {
+      std::cerr << "Error: Could not write the index" << std::endl;
+      return 1;
+    }
+
     std::cout << "Summary: " << filesRemoved << " file(s) removed from staging, "
               << filesSkipped << " file(s) skipped" << std::endl;
     return filesSkipped > 0 ? 1 : 0;
@@ -78,69 +152,13 @@ namespace cmd
         "  microgit remove <file1> [file2 ...]  - Remove specific files from staging\n"
         "  microgit remove .                    - Remove all files from staging\n\n"
         "This command will:\n"
-        "1. Remove the specified files from the index\n"
+        "1. Remove the specified files from the staging area and reset their\n"
+        "   index entries to the last commit\n"
         "2. Keep the files in your working directory\n"
         "3. Allow you to re-stage them later if needed");
 
     removeCmd->SetRunFunc([](const std::vector<std::string> &args)
-                          {
-      if (args.empty()) {
-        std::cout << "Error: No files specified" << std::endl;
-        return;
-      }
-      
-      if (args[0] == ".") {
-        // Remove all from staging
-        std::string indexPath = utils::DEFAULT_PATH + "/index";
-        std::ofstream indexFile(indexPath, std::ios::trunc);
-        indexFile.close();
-        return;
-      }
-      
-      // Remove specific files from staging
-      std::string indexPath = utils::DEFAULT_PATH + "/index";
-      
-      try {
-        // Read current index
-        std::ifstream file(indexPath);
-        if (!file.is_open()) {
-          std::cout << "Failed to read index file" << std::endl;
-          return;
-        }
-        
-        std::string line;
-        std::vector<std::string> lines;
-        while (std::getline(file, line)) {
-          if (!line.empty()) {
-            bool keep = true;
-            
-            // Check if this line starts with any of the files to remove
-            for (const auto& fileToRemove : args) {
-              if (line.substr(0, fileToRemove.size()) == fileToRemove) {
-                keep = false;
-                break;
-              }
-            }
-            
-            if (keep) {
-              lines.push_back(line);
-            }
-          }
-        }
-        file.close();
-        
-        // Write back filtered index
-        std::ofstream outFile(indexPath);
-        for (size_t i = 0; i < lines.size(); i++) {
-          outFile << lines[i];
-          if (i < lines.size() - 1) {
-            outFile << std::endl;
-          }
-        }
-        
-      } catch (const std::exception& e) {
-        std::cout << "Error: " << e.what() << std::endl;
-      } });
+                          { Remove(args); });
 
     rootCmd->AddCommand(removeCmd);
   }
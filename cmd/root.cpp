@@ -6,6 +6,12 @@
 #include "status.hpp"
 #include "checkout.hpp"
 #include "remove.hpp"
+#include "migrate.hpp"
+#include "pack.hpp"
+#include "gc.hpp"
+#include "fsck.hpp"
+#include "cat_object.hpp"
+#include "convert_hash.hpp"
 #include <iostream>
 #include <string>
 #include <map>
@@ -88,6 +94,12 @@ namespace cmd
   extern int Status(const std::vector<std::string> &args);
   extern int Checkout(const std::vector<std::string> &args);
   extern int Remove(const std::vector<std::string> &args);
+  extern int Migrate(const std::vector<std::string> &args);
+  extern int Pack(const std::vector<std::string> &args);
+  extern int Gc(const std::vector<std::string> &args);
+  extern int Fsck(const std::vector<std::string> &args);
+  extern int CatObject(const std::vector<std::string> &args);
+  extern int ConvertHash(const std::vector<std::string> &args);
 
   void ShowHelp()
   {
@@ -101,6 +113,12 @@ namespace cmd
     std::cout << "  status   - Show working directory status\n";
     std::cout << "  checkout - Checkout files from a commit\n";
     std::cout << "  remove   - Remove files from staging area\n";
+    std::cout << "  migrate  - Upgrade the repository to the current format\n";
+    std::cout << "  pack     - Pack loose objects into a single packfile\n";
+    std::cout << "  gc       - Delete unreachable objects\n";
+    std::cout << "  fsck     - Verify the integrity of the object store\n";
+    std::cout << "  cat-object - Show an object's type, size or content\n";
+    std::cout << "  convert-hash - Switch the repository to another hash algorithm\n";
     std::cout << "  --help   - Show this help message\n";
     std::cout << "\nFor more information, use 'microgit <command> --help'\n";
   }
@@ -153,6 +171,30 @@ namespace cmd
     {
       return Remove(args);
     }
+    else if (cmd == "migrate")
+    {
+      return Migrate(args);
+    }
+    else if (cmd == "pack")
+    {
+      return Pack(args);
+    }
+    else if (cmd == "gc")
+    {
+      return Gc(args);
+    }
+    else if (cmd == "fsck")
+    {
+      return Fsck(args);
+    }
+    else if (cmd == "cat-object")
+    {
+      return CatObject(args);
+    }
+    else if (cmd == "convert-hash")
+    {
+      return ConvertHash(args);
+    }
     else
     {
       std::cout << "Unknown command: " << cmd << std::endl;
@@ -1,6 +1,9 @@
 #include "save.hpp"
 #include "../utils/main.hpp"
 #include "../utils/json.hpp"
+#include "../utils/tree.hpp"
+#include "../utils/cache.hpp"
+#include "../utils/index.hpp"
 #include <iostream>
 #include <fstream>
 #include <filesystem>
@@ -15,29 +18,59 @@ namespace cmd
 {
   Command *saveCmd = nullptr;
 
-  std::string GetHead()
+  // Read the SavePoint id stored in a reference file, the null id if there is none
+  static utils::ObjectId ReadReference(const std::string &path)
   {
-    std::string headPath = utils::DEFAULT_PATH + "/HEAD";
-
+    utils::ObjectId hash;
     try
     {
-      std::ifstream file(headPath);
-      if (!file.is_open())
+      std::ifstream file(path);
+      std::string line;
+      if (file.is_open() && std::getline(file, line))
       {
-        return "";
+        utils::ObjectId::FromHex(line, hash);
       }
-
-      std::string head;
-      std::getline(file, head);
-      return head;
     }
     catch (const std::exception &e)
     {
-      return "";
     }
+    return hash;
+  }
+
+  utils::ObjectId GetHead()
+  {
+    return ReadReference(utils::DEFAULT_PATH + "/HEAD");
+  }
+
+  utils::ObjectId GetLatest()
+  {
+    return ReadReference(utils::DEFAULT_PATH + "/LATEST");
+  }
+
+  std::map<std::string, utils::ObjectId> FindHeadFiles(const std::set<std::string> &paths)
+  {
+    std::map<std::string, utils::ObjectId> files;
+    utils::ObjectId head = GetHead();
+    if (head.IsNull())
+    {
+      return files;
+    }
+    try
+    {
+      auto savePoint = utils::ReadSavePoint(head);
+      if (!savePoint || !utils::SavePointFindFiles(*savePoint, paths, files))
+      {
+        files.clear();
+      }
+    }
+    catch (const std::exception &)
+    {
+      files.clear();
+    }
+    return files;
   }
 
-  bool SetHead(const std::string &hash)
+  bool SetHead(const utils::ObjectId &hash)
   {
     std::string headPath = utils::DEFAULT_PATH + "/HEAD";
     std::string latestPath = utils::DEFAULT_PATH + "/LATEST";
@@ -68,43 +101,46 @@ namespace cmd
     return headResult && latestResult;
   }
 
-  std::map<std::string, std::string> ReadIndex()
+  std::map<std::string, utils::ObjectId> ReadIndex()
   {
-    std::map<std::string, std::string> index;
-    std::string indexPath = utils::DEFAULT_PATH + "/index";
+    std::map<std::string, utils::ObjectId> files;
+    utils::Index index;
+    if (!index.Load())
+    {
+      std::cerr << "Error reading index: the index is damaged" << std::endl;
+      return files;
+    }
 
-    try
+    for (const auto &entry : index.Entries())
     {
-      std::ifstream file(indexPath);
-      if (!file.is_open())
-      {
-        return index;
-      }
+      files[entry.path] = entry.hash;
+    }
+    return files;
+  }
 
-      std::string line;
-      while (std::getline(file, line))
+  std::map<std::string, utils::ObjectId> ReadStaging()
+  {
+    std::map<std::string, utils::ObjectId> staged;
+    fs::path stagingDir = fs::path(utils::DEFAULT_PATH) / "staging";
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(stagingDir, ec))
+    {
+      // Each entry holds the hash, then the path it was added from. An
+      // empty hash stages the removal of the path.
+      std::ifstream stageFile(entry.path());
+      std::string line, path;
+      utils::ObjectId hash;
+      if (stageFile && std::getline(stageFile, line) && (line.empty() || utils::ObjectId::FromHex(line, hash)))
       {
-        if (line.empty())
-          continue;
-
-        size_t spacePos = line.find_first_of(' ');
-        if (spacePos != std::string::npos)
-        {
-          std::string path = line.substr(0, spacePos);
-          std::string hash = line.substr(spacePos + 1);
-          index[path] = hash;
-        }
+        std::getline(stageFile, path);
+        path = utils::TreePath(path);
+        staged[path.empty() ? entry.path().filename().string() : path] = hash;
       }
     }
-    catch (const std::exception &e)
-    {
-      std::cerr << "Error reading index: " << e.what() << std::endl;
-    }
-
-    return index;
+    return staged;
   }
 
-  std::string WriteSavePointObject(const utils::SavePoint &savePoint)
+  utils::ObjectId WriteSavePointObject(const utils::SavePoint &savePoint)
   {
     try
     {
@@ -113,10 +149,10 @@ namespace cmd
 
       // Hash the JSON data
       std::vector<uint8_t> content(jsonData.begin(), jsonData.end());
-      std::string hash = utils::HashContent(content);
+      utils::ObjectId hash = utils::HashContent(content);
 
       // Write the object
-      if (!utils::WriteObject(hash, content))
+      if (!utils::WriteObject(hash, content, utils::ObjectType::SavePoint))
       {
         throw std::runtime_error("Failed to write object");
       }
@@ -180,16 +216,8 @@ namespace cmd
     }
 
     // Get current HEAD
-    std::string parent = "";
+    utils::ObjectId parent = GetHead();
     fs::path headFile = fs::path(utils::DEFAULT_PATH) / "HEAD";
-    if (fs::exists(headFile))
-    {
-      std::ifstream head(headFile);
-      if (head)
-      {
-        std::getline(head, parent);
-      }
-    }
 
     // Create SavePoint with staged files
     utils::SavePoint savePoint;
@@ -197,17 +225,39 @@ namespace cmd
     savePoint.timestamp = timestamp;
     savePoint.parent = parent;
 
-    // Process staging directory
-    for (const auto &entry : fs::directory_iterator(stagingDir))
+    // The new tree is the parent's with the staged files applied, so only the
+    // directories holding them are written again
+    std::map<std::string, utils::ObjectId> changes = ReadStaging();
+    utils::ObjectId baseTree;
+    if (!parent.IsNull())
     {
-      std::string filename = entry.path().filename().string();
-      std::ifstream stageFile(entry.path());
-      if (stageFile)
+      std::shared_ptr<const utils::SavePoint> parentSavePoint;
+      try
       {
-        std::string hash;
-        std::getline(stageFile, hash);
-        savePoint.files[filename] = hash;
+        parentSavePoint = utils::ReadSavePoint(parent);
       }
+      catch (const std::exception &)
+      {
+        // Reported below like a missing one
+      }
+      if (!parentSavePoint)
+      {
+        std::cerr << "Error: Could not read parent SavePoint " << parent << std::endl;
+        return 1;
+      }
+      baseTree = parentSavePoint->tree;
+      if (baseTree.IsNull())
+      {
+        // A SavePoint from before trees, carry its files over
+        changes.insert(parentSavePoint->files.begin(), parentSavePoint->files.end());
+      }
+    }
+
+    savePoint.tree = utils::UpdateTree(baseTree, changes);
+    if (savePoint.tree.IsNull())
+    {
+      std::cerr << "Error: Could not write tree objects" << std::endl;
+      return 1;
     }
 
     // Convert SavePoint to JSON
@@ -215,15 +265,22 @@ namespace cmd
 
     // Hash the savepoint data
     std::vector<uint8_t> savePointData(jsonData.begin(), jsonData.end());
-    std::string savePointHash = utils::HashContent(savePointData);
+    utils::ObjectId savePointHash = utils::HashContent(savePointData);
 
     // Write savepoint to objects
-    if (!utils::WriteObject(savePointHash, savePointData))
+    if (!utils::WriteObject(savePointHash, savePointData, utils::ObjectType::SavePoint))
     {
       std::cerr << "Error: Could not write savepoint to object store" << std::endl;
       return 1;
     }
 
+    // Objects must be durable before HEAD can point at them
+    if (!utils::SyncObjects())
+    {
+      std::cerr << "Error: Could not flush objects to disk" << std::endl;
+      return 1;
+    }
+
     // Update HEAD
     std::ofstream head(headFile);
     if (!head)
@@ -240,7 +297,7 @@ namespace cmd
       fs::remove(entry.path());
     }
 
-    std::cout << "Saved [" << savePointHash.substr(0, 8) << "]: " << message << std::endl;
+    std::cout << "Saved [" << savePointHash.Hex().substr(0, 8) << "]: " << message << std::endl;
     return 0;
   }
 
@@ -251,6 +308,9 @@ namespace cmd
         "Save the current state of staged files",
         "Save the current state of all staged files as a new commit.\n"
         "This command requires a commit message that describes the changes being saved.\n"
+        "Each commit is a full snapshot: the files of the previous commit with the\n"
+        "staged files and staged removals applied, so files that were not staged\n"
+        "again are carried over unchanged.\n"
         "The staged files will be committed and the staging area will be cleared after the save.");
 
     saveCmd->SetRunFunc([](const std::vector<std::string> &args)
@@ -4,23 +4,35 @@
 #include "../utils/main.hpp"
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 
 namespace cmd
 {
   extern Command *saveCmd;
 
-  // Get the current HEAD commit hash
-  std::string GetHead();
+  // Get the current HEAD commit hash, the null id before the first save
+  utils::ObjectId GetHead();
+
+  // Get the most recent SavePoint recorded in LATEST, which a checkout of an
+  // older commit leaves in place
+  utils::ObjectId GetLatest();
+
+  // The files among paths (repository paths) that the HEAD SavePoint records,
+  // empty before the first save or when HEAD cannot be read
+  std::map<std::string, utils::ObjectId> FindHeadFiles(const std::set<std::string> &paths);
 
   // Set the HEAD and LATEST to point to the given commit hash
-  bool SetHead(const std::string &hash);
+  bool SetHead(const utils::ObjectId &hash);
 
   // Read the index file into a map
-  std::map<std::string, std::string> ReadIndex();
+  std::map<std::string, utils::ObjectId> ReadIndex();
+
+  // Read the staging area into a map of repository path -> hash
+  std::map<std::string, utils::ObjectId> ReadStaging();
 
   // Write a SavePoint to a new object and return its hash
-  std::string WriteSavePointObject(const utils::SavePoint &savePoint);
+  utils::ObjectId WriteSavePointObject(const utils::SavePoint &savePoint);
 
   void InitSaveCommand();
 
@@ -1,6 +1,10 @@
 #include "status.hpp"
 #include "../utils/main.hpp"
 #include "../utils/json.hpp"
+#include "../utils/chunks.hpp"
+#include "../utils/cache.hpp"
+#include "../utils/tree.hpp"
+#include "../utils/index.hpp"
 #include "save.hpp" // Add this include for GetHead
 #include "log.hpp"  // Add this include for ReadCommit
 #include <iostream>
@@ -16,9 +20,9 @@ namespace cmd
 {
   Command *statusCmd = nullptr;
 
-  std::map<std::string, std::string> GetWorkingFiles()
+  std::map<std::string, utils::ObjectId> GetWorkingFiles()
   {
-    std::map<std::string, std::string> files;
+    std::map<std::string, utils::ObjectId> files;
 
     try
     {
@@ -33,8 +37,7 @@ namespace cmd
 
         std::ifstream file(entry.path(), std::ios::binary);
         std::vector<uint8_t> content((std::istreambuf_iterator<char>(file)), {});
-        std::string hash = utils::HashContent(content);
-        files[entry.path().string()] = hash;
+        files[entry.path().string()] = utils::HashBlob(content);
       }
     }
     catch (const std::exception &e)
@@ -45,12 +48,12 @@ namespace cmd
     return files;
   }
 
-  std::map<std::string, std::string> GetCommittedFiles()
+  std::map<std::string, utils::ObjectId> GetCommittedFiles()
   {
-    std::map<std::string, std::string> files;
-    std::string head = cmd::GetHead(); // Assuming GetHead() is defined in save.hpp
+    std::map<std::string, utils::ObjectId> files;
+    utils::ObjectId head = cmd::GetHead(); // Assuming GetHead() is defined in save.hpp
 
-    if (head.empty())
+    if (head.IsNull())
     {
       return files;
     }
@@ -58,7 +61,7 @@ namespace cmd
     try
     {
       utils::SavePoint savePoint = ReadCommit(head); // Using ReadCommit from log.hpp
-      files = savePoint.files;
+      utils::SavePointFiles(savePoint, files);
     }
     catch (const std::exception &e)
     {
@@ -68,7 +71,7 @@ namespace cmd
     return files;
   }
 
-  int Status(const std::vector<std::string> &args)
+  int Status(const std::vector<std::string> &/*args*/)
   {
     // Check for the .microgit directory
     if (!fs::exists(utils::DEFAULT_PATH))
@@ -78,77 +81,57 @@ namespace cmd
     }
 
     // Get current HEAD
-    std::string currentHash = "";
-    fs::path headFile = fs::path(utils::DEFAULT_PATH) / "HEAD";
-    if (fs::exists(headFile))
-    {
-      std::ifstream head(headFile);
-      if (head)
-      {
-        std::getline(head, currentHash);
-      }
-    }
+    utils::ObjectId currentHash = GetHead();
 
     // Track files from HEAD, staged files, and working directory
-    std::map<std::string, std::string> headFiles;   // filename -> hash
-    std::map<std::string, std::string> stagedFiles; // filename -> hash
-    std::set<std::string> workingDirFiles;          // just filenames
+    std::map<std::string, utils::ObjectId> headFiles;   // filename -> hash
+    std::map<std::string, utils::ObjectId> stagedFiles; // filename -> hash
+    std::set<std::string> workingDirFiles;              // just filenames
+
+    // Get staged files
+    stagedFiles = ReadStaging();
 
-    // Get files from HEAD
-    if (!currentHash.empty())
+    // Get files in working directory (excluding .microgit)
+    for (const auto &entry : fs::directory_iterator("."))
     {
-      try
-      {
-        fs::path objectPath = fs::path(utils::DEFAULT_PATH) / "objects" / currentHash;
-        if (fs::exists(objectPath))
-        {
-          std::ifstream file(objectPath);
-          std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-          utils::SavePoint savePoint = utils::JSON::Parse(content);
-          headFiles = savePoint.files;
-        }
-      }
-      catch (const std::exception &e)
+      if (entry.path() != utils::DEFAULT_PATH && !entry.is_directory())
       {
-        std::cerr << "Warning: Could not read HEAD commit: " << e.what() << std::endl;
+        workingDirFiles.insert(entry.path().filename().string());
       }
     }
 
-    // Get staged files
-    fs::path stagingDir = fs::path(utils::DEFAULT_PATH) / "staging";
-    if (fs::exists(stagingDir))
+    // Get the HEAD entries of those files. Only the directories on the way
+    // to them are read, every other subtree of HEAD is skipped.
+    if (!currentHash.IsNull())
     {
-      for (const auto &entry : fs::directory_iterator(stagingDir))
+      std::set<std::string> paths(workingDirFiles.begin(), workingDirFiles.end());
+      for (const auto &staged : stagedFiles)
       {
-        std::string filename = entry.path().filename().string();
-        std::ifstream stageFile(entry.path());
-        if (stageFile)
+        paths.insert(staged.first);
+      }
+      try
+      {
+        auto savePoint = utils::ReadSavePoint(currentHash);
+        if (savePoint && !utils::SavePointFindFiles(*savePoint, paths, headFiles))
         {
-          std::string hash;
-          std::getline(stageFile, hash);
-          stagedFiles[filename] = hash;
+          std::cerr << "Warning: Could not read the tree of the HEAD commit" << std::endl;
         }
       }
-    }
-
-    // Get files in working directory (excluding .microgit)
-    for (const auto &entry : fs::directory_iterator("."))
-    {
-      if (entry.path() != utils::DEFAULT_PATH && !entry.is_directory())
+      catch (const std::exception &e)
       {
-        workingDirFiles.insert(entry.path().filename().string());
+        std::cerr << "Warning: Could not read HEAD commit: " << e.what() << std::endl;
       }
     }
 
     // Display branch information
     std::cout << "On branch main" << std::endl;
-    if (currentHash.empty())
+    if (currentHash.IsNull())
     {
       std::cout << "No commits yet" << std::endl;
     }
     else
     {
-      std::cout << "HEAD: " << currentHash.substr(0, 8) << std::endl;
+      std::cout << "HEAD: " << currentHash.Hex().substr(0, 8) << std::endl;
     }
     std::cout << std::endl;
 
@@ -161,8 +144,12 @@ namespace cmd
 
       for (const auto &[file, hash] : stagedFiles)
       {
-        // Check if file is new or modified
-        if (headFiles.find(file) == headFiles.end())
+        // Check if file is new, modified or removed
+        if (hash.IsNull())
+        {
+          std::cout << "        deleted:    " << file << std::endl;
+        }
+        else if (headFiles.find(file) == headFiles.end())
         {
           std::cout << "        new file:   " << file << std::endl;
         }
@@ -177,6 +164,13 @@ namespace cmd
     // Display working directory changes (files that are tracked but not staged)
     std::vector<std::string> modifiedFiles;
     std::vector<std::string> untrackedFiles;
+    std::vector<std::string> trackedFiles;
+    std::vector<utils::ObjectId> trackedHashes;
+    utils::Index index;
+    if (!index.Load())
+    {
+      std::cerr << "Warning: The index is damaged, every tracked file is read" << std::endl;
+    }
 
     for (const auto &file : workingDirFiles)
     {
@@ -186,29 +180,19 @@ namespace cmd
         continue;
       }
 
-      // If file is tracked (in HEAD) but modified
+      // If file is tracked (in HEAD) it is checked for changes below, unless
+      // the index shows it still holds the committed object
       if (headFiles.find(file) != headFiles.end())
       {
-        // Read current content and compute hash
-        try
-        {
-          std::ifstream input(file, std::ios::binary);
-          if (input)
-          {
-            std::vector<uint8_t> buffer(std::istreambuf_iterator<char>(input), {});
-            std::string hash = utils::HashContent(buffer);
-
-            if (hash != headFiles[file])
-            {
-              modifiedFiles.push_back(file);
-            }
-          }
-        }
-        catch (const std::exception &)
+        utils::IndexEntry entry;
+        utils::IndexStat stat;
+        if (index.Find(utils::TreePath(file), entry) && entry.hash == headFiles[file] &&
+            utils::StatFile(file, stat) && index.IsUnchanged(entry, stat))
         {
-          // If we can't read the file, consider it modified
-          modifiedFiles.push_back(file);
+          continue;
         }
+        trackedFiles.push_back(file);
+        trackedHashes.push_back(headFiles[file]);
       }
       else
       {
@@ -217,6 +201,25 @@ namespace cmd
       }
     }
 
+    // Compare current contents with the committed objects, small files
+    // hashed together and large ones chunk by chunk
+    try
+    {
+      std::vector<bool> matches = utils::FilesMatchBlobs(trackedFiles, trackedHashes);
+      for (size_t i = 0; i < trackedFiles.size(); i++)
+      {
+        if (!matches[i])
+        {
+          modifiedFiles.push_back(trackedFiles[i]);
+        }
+      }
+    }
+    catch (const std::exception &)
+    {
+      // If we can't read the files, consider them modified
+      modifiedFiles = trackedFiles;
+    }
+
     if (!modifiedFiles.empty())
     {
       std::cout << "Changes not staged for commit:" << std::endl;
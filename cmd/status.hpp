@@ -1,6 +1,7 @@
 #pragma once
 
 #include "root.hpp"
+#include "../utils/object_id.hpp"
 #include <string>
 #include <map>
 #include <vector>
@@ -10,10 +11,10 @@ namespace cmd
   extern Command *statusCmd;
 
   // Get files in the working directory with their content hashes
-  std::map<std::string, std::string> GetWorkingFiles();
+  std::map<std::string, utils::ObjectId> GetWorkingFiles();
 
   // Get files from the latest commit
-  std::map<std::string, std::string> GetCommittedFiles();
+  std::map<std::string, utils::ObjectId> GetCommittedFiles();
 
   void InitStatusCommand();
 
@@ -6,6 +6,18 @@
 #include "./cmd/status.hpp"
 #include "./cmd/checkout.hpp"
 #include "./cmd/remove.hpp"
+#include "./cmd/migrate.hpp"
+#include "./cmd/pack.hpp"
+#include "./cmd/gc.hpp"
+#include "./cmd/fsck.hpp"
+#include "./cmd/cat_object.hpp"
+#include "./cmd/convert_hash.hpp"
+#include "./utils/cache.hpp"
+#include "./utils/io_engine.hpp"
+#include "./utils/file_copy.hpp"
+#include "./utils/hasher.hpp"
+#include <cstdlib>
+#include <iostream>
 
 int main(int argc, char **argv)
 {
@@ -19,9 +31,25 @@ int main(int argc, char **argv)
   cmd::InitStatusCommand();
   cmd::InitCheckoutCommand();
   cmd::InitRemoveCommand();
+  cmd::InitMigrateCommand();
+  cmd::InitPackCommand();
+  cmd::InitGcCommand();
+  cmd::InitFsckCommand();
+  cmd::InitCatObjectCommand();
+  cmd::InitConvertHashCommand();
 
   int result = cmd::Execute(argc, argv);
 
+  // Report each subsystem's counters for benchmarking
+  if (std::getenv("MICROGIT_STATS"))
+  {
+    utils::PrintCacheStats(std::cerr);
+    utils::PrintObjectStoreStats(std::cerr);
+    utils::PrintIoStats(std::cerr);
+    utils::PrintCopyStats(std::cerr);
+    utils::PrintHashBatchStats(std::cerr);
+  }
+
   // Cleanup
   delete cmd::rootCmd;
 
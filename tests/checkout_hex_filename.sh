@@ -0,0 +1,47 @@
+#!/bin/sh
+# A file whose name spells a SavePoint prefix is restored as a file by
+# "checkout <name>", and "--" picks the file or the commit explicitly.
+# Usage: checkout_hex_filename.sh <path to microgit>
+set -e
+
+microgit=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work"
+
+fail()
+{
+  echo "FAIL: $*" >&2
+  exit 1
+}
+
+"$microgit" init >/dev/null
+echo base >base
+"$microgit" add base >/dev/null
+"$microgit" save "first" >/dev/null
+first=$(cat .microgit/HEAD)
+
+# Name a tracked file after the first SavePoint's prefix
+name=$(echo "$first" | cut -c1-8)
+echo original >"$name"
+"$microgit" add "$name" >/dev/null
+"$microgit" save "second" >/dev/null
+second=$(cat .microgit/HEAD)
+
+echo changed >"$name"
+"$microgit" checkout "$name" >/dev/null
+[ "$(cat "$name")" = original ] || fail "checkout <name> did not restore the file"
+[ "$(cat .microgit/HEAD)" = "$second" ] || fail "checkout <name> moved HEAD"
+
+echo changed >"$name"
+"$microgit" checkout -- "$name" >/dev/null
+[ "$(cat "$name")" = original ] || fail "checkout -- <name> did not restore the file"
+
+"$microgit" checkout "$name" -- >/dev/null
+[ "$(cat .microgit/HEAD)" = "$first" ] || fail "checkout <prefix> -- did not check out the commit"
+
+echo changed >"$name"
+"$microgit" checkout "$second" -- "$name" >/dev/null
+[ "$(cat "$name")" = original ] || fail "checkout <commit> -- <name> did not restore the file"
+
+echo "PASS"
@@ -0,0 +1,328 @@
+#include "blake3.hpp"
+#include "parallel.hpp"
+#include <cstring>
+#include <thread>
+
+namespace utils
+{
+  namespace
+  {
+    const uint32_t IV[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                            0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+    const uint8_t PERMUTATION[16] = {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8};
+
+    const uint32_t CHUNK_START = 1;
+    const uint32_t CHUNK_END = 2;
+    const uint32_t PARENT = 4;
+    const uint32_t ROOT = 8;
+
+    // Halves of a subtree at least this large are hashed on separate threads
+    const size_t PARALLEL_SUBTREE_SIZE = 1024 * 1024;
+
+    inline uint32_t Rotr(uint32_t x, int n)
+    {
+      return (x >> n) | (x << (32 - n));
+    }
+
+    inline void G(uint32_t *s, int a, int b, int c, int d, uint32_t mx, uint32_t my)
+    {
+      s[a] = s[a] + s[b] + mx;
+      s[d] = Rotr(s[d] ^ s[a], 16);
+      s[c] = s[c] + s[d];
+      s[b] = Rotr(s[b] ^ s[c], 12);
+      s[a] = s[a] + s[b] + my;
+      s[d] = Rotr(s[d] ^ s[a], 8);
+      s[c] = s[c] + s[d];
+      s[b] = Rotr(s[b] ^ s[c], 7);
+    }
+
+    void Compress(const uint32_t cv[8], const uint32_t block[16], uint64_t counter,
+                  uint32_t blockLen, uint32_t flags, uint32_t out[16])
+    {
+      uint32_t s[16] = {cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+                        IV[0], IV[1], IV[2], IV[3],
+                        static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), blockLen, flags};
+      uint32_t m[16];
+      std::memcpy(m, block, sizeof(m));
+
+      for (int round = 0; round < 7; round++)
+      {
+        G(s, 0, 4, 8, 12, m[0], m[1]);
+        G(s, 1, 5, 9, 13, m[2], m[3]);
+        G(s, 2, 6, 10, 14, m[4], m[5]);
+        G(s, 3, 7, 11, 15, m[6], m[7]);
+        G(s, 0, 5, 10, 15, m[8], m[9]);
+        G(s, 1, 6, 11, 12, m[10], m[11]);
+        G(s, 2, 7, 8, 13, m[12], m[13]);
+        G(s, 3, 4, 9, 14, m[14], m[15]);
+
+        uint32_t permuted[16];
+        for (int i = 0; i < 16; i++)
+        {
+          permuted[i] = m[PERMUTATION[i]];
+        }
+        std::memcpy(m, permuted, sizeof(m));
+      }
+
+      for (int i = 0; i < 8; i++)
+      {
+        out[i] = s[i] ^ s[i + 8];
+        out[i + 8] = s[i + 8] ^ cv[i];
+      }
+    }
+
+    void LoadWords(const uint8_t *bytes, uint32_t words[16])
+    {
+      for (int i = 0; i < 16; i++)
+      {
+        const uint8_t *p = bytes + 4 * i;
+        words[i] = static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+                   static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+      }
+    }
+
+    // A node's last compression, held back until it is known whether the
+    // node is the root
+    struct Output
+    {
+      uint32_t cv[8];
+      uint32_t block[16];
+      uint64_t counter;
+      uint32_t blockLen;
+      uint32_t flags;
+
+      void ChainingValue(uint32_t out[8]) const
+      {
+        uint32_t full[16];
+        Compress(cv, block, counter, blockLen, flags, full);
+        std::memcpy(out, full, 8 * sizeof(uint32_t));
+      }
+
+      void Root(uint8_t out[BLAKE3_OUT_LEN]) const
+      {
+        uint32_t full[16];
+        Compress(cv, block, 0, blockLen, flags | ROOT, full);
+        for (int i = 0; i < 8; i++)
+        {
+          out[4 * i] = static_cast<uint8_t>(full[i]);
+          out[4 * i + 1] = static_cast<uint8_t>(full[i] >> 8);
+          out[4 * i + 2] = static_cast<uint8_t>(full[i] >> 16);
+          out[4 * i + 3] = static_cast<uint8_t>(full[i] >> 24);
+        }
+      }
+    };
+
+    Output ChunkOutput(const Blake3Chunk &chunk)
+    {
+      Output output;
+      std::memcpy(output.cv, chunk.cv, sizeof(output.cv));
+      LoadWords(chunk.block, output.block);
+      output.counter = chunk.counter;
+      output.blockLen = chunk.blockLen;
+      output.flags = (chunk.blocksCompressed == 0 ? CHUNK_START : 0) | CHUNK_END;
+      return output;
+    }
+
+    Output ParentOutput(const uint32_t left[8], const uint32_t right[8])
+    {
+      Output output;
+      std::memcpy(output.cv, IV, sizeof(output.cv));
+      std::memcpy(output.block, left, 8 * sizeof(uint32_t));
+      std::memcpy(output.block + 8, right, 8 * sizeof(uint32_t));
+      output.counter = 0;
+      output.blockLen = BLAKE3_BLOCK_LEN;
+      output.flags = PARENT;
+      return output;
+    }
+
+    void SubtreeCv(const uint8_t *data, size_t size, uint64_t chunkCounter, size_t threads, uint32_t cv[8]);
+
+    // Chaining values of the two halves of a subtree of a power of two
+    // chunks, two or more
+    void SubtreeChildren(const uint8_t *data, size_t size, uint64_t chunkCounter, size_t threads,
+                         uint32_t left[8], uint32_t right[8])
+    {
+      size_t half = size / 2;
+      uint64_t rightCounter = chunkCounter + half / BLAKE3_CHUNK_LEN;
+      if (threads > 1 && half >= PARALLEL_SUBTREE_SIZE)
+      {
+        std::thread worker([&]()
+                           { SubtreeCv(data, half, chunkCounter, threads / 2, left); });
+        SubtreeCv(data + half, half, rightCounter, threads - threads / 2, right);
+        worker.join();
+        return;
+      }
+      SubtreeCv(data, half, chunkCounter, 1, left);
+      SubtreeCv(data + half, half, rightCounter, 1, right);
+    }
+
+    void SubtreeCv(const uint8_t *data, size_t size, uint64_t chunkCounter, size_t threads, uint32_t cv[8])
+    {
+      if (size <= BLAKE3_CHUNK_LEN)
+      {
+        Blake3Chunk chunk;
+        chunk.Reset(chunkCounter);
+        chunk.Update(data, size);
+        ChunkOutput(chunk).ChainingValue(cv);
+        return;
+      }
+
+      uint32_t left[8], right[8];
+      SubtreeChildren(data, size, chunkCounter, threads, left, right);
+      ParentOutput(left, right).ChainingValue(cv);
+    }
+  }
+
+  void Blake3Chunk::Reset(uint64_t chunkCounter)
+  {
+    std::memcpy(cv, IV, sizeof(cv));
+    counter = chunkCounter;
+    std::memset(block, 0, sizeof(block));
+    blockLen = 0;
+    blocksCompressed = 0;
+  }
+
+  void Blake3Chunk::Update(const uint8_t *data, size_t size)
+  {
+    while (size > 0)
+    {
+      // The block is only compressed once more input shows it isn't the last
+      if (blockLen == BLAKE3_BLOCK_LEN)
+      {
+        uint32_t words[16], full[16];
+        LoadWords(block, words);
+        Compress(cv, words, counter, BLAKE3_BLOCK_LEN, blocksCompressed == 0 ? CHUNK_START : 0, full);
+        std::memcpy(cv, full, sizeof(cv));
+        blocksCompressed++;
+        std::memset(block, 0, sizeof(block));
+        blockLen = 0;
+      }
+
+      size_t take = std::min(BLAKE3_BLOCK_LEN - blockLen, size);
+      std::memcpy(block + blockLen, data, take);
+      blockLen = static_cast<uint8_t>(blockLen + take);
+      data += take;
+      size -= take;
+    }
+  }
+
+  void Blake3::Reset()
+  {
+    chunk.Reset(0);
+    cvStackLen = 0;
+  }
+
+  void Blake3::MergeCvStack(uint64_t totalChunks)
+  {
+    // Completed subtrees correspond to the set bits of the chunk count
+    size_t target = static_cast<size_t>(__builtin_popcountll(totalChunks));
+    while (cvStackLen > target)
+    {
+      auto &left = cvStack[cvStackLen - 2];
+      ParentOutput(left.data(), cvStack[cvStackLen - 1].data()).ChainingValue(left.data());
+      cvStackLen--;
+    }
+  }
+
+  void Blake3::PushCv(const uint32_t cv[8], uint64_t chunkCounter)
+  {
+    MergeCvStack(chunkCounter);
+    std::memcpy(cvStack[cvStackLen].data(), cv, 8 * sizeof(uint32_t));
+    cvStackLen++;
+  }
+
+  void Blake3::Update(const void *data, size_t size)
+  {
+    const uint8_t *input = static_cast<const uint8_t *>(data);
+
+    // Finish a partly filled chunk first, unless it may be the last one
+    if (chunk.Length() > 0)
+    {
+      size_t take = std::min(BLAKE3_CHUNK_LEN - chunk.Length(), size);
+      chunk.Update(input, take);
+      input += take;
+      size -= take;
+      if (size == 0)
+      {
+        return;
+      }
+
+      uint32_t cv[8];
+      ChunkOutput(chunk).ChainingValue(cv);
+      PushCv(cv, chunk.counter);
+      chunk.Reset(chunk.counter + 1);
+    }
+
+    // Hash the largest whole subtrees the input holds. A subtree has a power
+    // of two chunks and must start at a multiple of its size, and the last
+    // chunk is kept back since it may turn out to be the root.
+    size_t threads = DefaultWorkerCount();
+    while (size > BLAKE3_CHUNK_LEN)
+    {
+      size_t subtreeSize = size_t(1) << (63 - __builtin_clzll(static_cast<unsigned long long>(size)));
+      uint64_t offset = chunk.counter * BLAKE3_CHUNK_LEN;
+      while (((subtreeSize - 1) & offset) != 0)
+      {
+        subtreeSize /= 2;
+      }
+      uint64_t subtreeChunks = subtreeSize / BLAKE3_CHUNK_LEN;
+
+      if (subtreeSize <= BLAKE3_CHUNK_LEN)
+      {
+        uint32_t cv[8];
+        SubtreeCv(input, subtreeSize, chunk.counter, 1, cv);
+        PushCv(cv, chunk.counter);
+      }
+      else
+      {
+        // Push the two halves, the subtree itself could be the whole tree
+        uint32_t left[8], right[8];
+        SubtreeChildren(input, subtreeSize, chunk.counter, threads, left, right);
+        PushCv(left, chunk.counter);
+        PushCv(right, chunk.counter + subtreeChunks / 2);
+      }
+      chunk.counter += subtreeChunks;
+      input += subtreeSize;
+      size -= subtreeSize;
+    }
+
+    if (size > 0)
+    {
+      chunk.Update(input, size);
+      MergeCvStack(chunk.counter);
+    }
+  }
+
+  void Blake3::Finish(uint8_t out[BLAKE3_OUT_LEN]) const
+  {
+    if (cvStackLen == 0)
+    {
+      ChunkOutput(chunk).Root(out);
+      return;
+    }
+
+    // Fold the pending chunk, or the top two subtrees, into every subtree
+    // on the stack from right to left
+    Output output;
+    size_t remaining;
+    if (chunk.Length() > 0)
+    {
+      remaining = cvStackLen;
+      output = ChunkOutput(chunk);
+    }
+    else
+    {
+      remaining = cvStackLen - 2;
+      output = ParentOutput(cvStack[remaining].data(), cvStack[remaining + 1].data());
+    }
+    while (remaining > 0)
+    {
+      remaining--;
+      uint32_t cv[8];
+      output.ChainingValue(cv);
+      output = ParentOutput(cvStack[remaining].data(), cv);
+    }
+    output.Root(out);
+  }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace utils
+{
+  // BLAKE3 in its default hash mode with a 32-byte output, written from the
+  // specification so the build needs nothing beyond OpenSSL and zlib.
+  //
+  // Input is split into 1 KiB chunks that are hashed independently and
+  // combined in a binary tree. Whole subtrees that arrive in one Update call
+  // are hashed on several threads, so hashing a large mapped file uses every
+  // core; input fed in small pieces is hashed on the calling thread.
+
+  const size_t BLAKE3_OUT_LEN = 32;
+  const size_t BLAKE3_BLOCK_LEN = 64;
+  const size_t BLAKE3_CHUNK_LEN = 1024;
+
+  // The chunk being filled: its chaining value so far and the block not yet
+  // compressed, which is kept because the last block is compressed with
+  // different flags
+  struct Blake3Chunk
+  {
+    uint32_t cv[8];
+    uint64_t counter;
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    uint8_t blockLen;
+    uint8_t blocksCompressed;
+
+    void Reset(uint64_t chunkCounter);
+    void Update(const uint8_t *data, size_t size);
+    size_t Length() const { return BLAKE3_BLOCK_LEN * blocksCompressed + blockLen; }
+  };
+
+  class Blake3
+  {
+  public:
+    Blake3() { Reset(); }
+
+    void Reset();
+    void Update(const void *data, size_t size);
+
+    // Write the digest, the state is left as it was
+    void Finish(uint8_t out[BLAKE3_OUT_LEN]) const;
+
+  private:
+    void PushCv(const uint32_t cv[8], uint64_t chunkCounter);
+    void MergeCvStack(uint64_t totalChunks);
+
+    Blake3Chunk chunk;
+
+    // Chaining values of completed subtrees, at most one per bit of the chunk count
+    std::array<std::array<uint32_t, 8>, 54> cvStack;
+    size_t cvStackLen = 0;
+  };
+}
@@ -0,0 +1,154 @@
+#include "bloom.hpp"
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace utils
+{
+  namespace
+  {
+    const char BLOOM_MAGIC[4] = {'M', 'G', 'B', 'F'};
+    // Version 1 filters were keyed by hex hashes and are rebuilt on load
+    const uint32_t BLOOM_VERSION = 2;
+
+    // Two independent 64-bit hashes of the key for double hashing. Ids are
+    // digests, so two words of the key are already independent and uniform.
+    void HashKey(const ObjectId &key, uint64_t &h1, uint64_t &h2)
+    {
+      std::memcpy(&h1, key.Data(), sizeof(h1));
+      std::memcpy(&h2, key.Data() + sizeof(h1), sizeof(h2));
+      // Forced odd so the probes cover the table
+      h2 |= 1;
+    }
+
+    template <typename T>
+    void Put(std::ofstream &out, T value)
+    {
+      out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    bool Get(std::ifstream &in, T &value)
+    {
+      return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+    }
+  }
+
+  BloomFilter::BloomFilter(size_t capacity)
+      : capacity(std::max(capacity, BLOOM_MIN_CAPACITY))
+  {
+    bits.assign((this->capacity * BLOOM_BITS_PER_ENTRY + 63) / 64, 0);
+  }
+
+  void BloomFilter::Add(const ObjectId &key)
+  {
+    if (bits.empty())
+    {
+      return;
+    }
+
+    uint64_t h1, h2;
+    HashKey(key, h1, h2);
+    uint64_t size = bits.size() * 64;
+    for (uint32_t i = 0; i < BLOOM_HASH_COUNT; i++)
+    {
+      uint64_t bit = (h1 + i * h2) % size;
+      bits[bit / 64] |= 1ull << (bit % 64);
+    }
+    count++;
+  }
+
+  bool BloomFilter::MayContain(const ObjectId &key) const
+  {
+    if (bits.empty())
+    {
+      return false;
+    }
+
+    uint64_t h1, h2;
+    HashKey(key, h1, h2);
+    uint64_t size = bits.size() * 64;
+    for (uint32_t i = 0; i < BLOOM_HASH_COUNT; i++)
+    {
+      uint64_t bit = (h1 + i * h2) % size;
+      if (!(bits[bit / 64] & (1ull << (bit % 64))))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool BloomFilter::Merge(const BloomFilter &other)
+  {
+    if (bits.size() != other.bits.size())
+    {
+      return false;
+    }
+    for (size_t i = 0; i < bits.size(); i++)
+    {
+      bits[i] |= other.bits[i];
+    }
+    // Keys both filters hold would be counted twice, so the count stays an estimate
+    count = std::max(count, other.count);
+    return true;
+  }
+
+  bool BloomFilter::Load(const fs::path &path)
+  {
+    std::ifstream in(path, std::ios::binary);
+    char magic[4];
+    uint32_t version = 0, hashCount = 0;
+    uint64_t words = 0;
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, BLOOM_MAGIC, sizeof(magic)) != 0 ||
+        !Get(in, version) || version != BLOOM_VERSION ||
+        !Get(in, hashCount) || hashCount != BLOOM_HASH_COUNT ||
+        !Get(in, count) || !Get(in, capacity) || !Get(in, words) ||
+        words != (capacity * BLOOM_BITS_PER_ENTRY + 63) / 64)
+    {
+      return false;
+    }
+
+    bits.resize(words);
+    if (!in.read(reinterpret_cast<char *>(bits.data()), words * sizeof(uint64_t)))
+    {
+      bits.clear();
+      return false;
+    }
+    return true;
+  }
+
+  bool BloomFilter::Save(const fs::path &path) const
+  {
+    fs::path tempPath = path;
+    tempPath += ".tmp-" + std::to_string(getpid());
+    {
+      std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+      out.write(BLOOM_MAGIC, sizeof(BLOOM_MAGIC));
+      Put(out, BLOOM_VERSION);
+      Put(out, BLOOM_HASH_COUNT);
+      Put(out, count);
+      Put(out, capacity);
+      Put(out, static_cast<uint64_t>(bits.size()));
+      out.write(reinterpret_cast<const char *>(bits.data()), bits.size() * sizeof(uint64_t));
+      if (!out.flush())
+      {
+        std::error_code ec;
+        fs::remove(tempPath, ec);
+        return false;
+      }
+    }
+
+    std::error_code ec;
+    fs::rename(tempPath, path, ec);
+    if (ec)
+    {
+      fs::remove(tempPath, ec);
+      return false;
+    }
+    return true;
+  }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+#include "object_id.hpp"
+
+namespace utils
+{
+  // Bits per expected entry and probes per key, about a 1% false positive rate
+  const size_t BLOOM_BITS_PER_ENTRY = 10;
+  const uint32_t BLOOM_HASH_COUNT = 7;
+
+  // Smallest number of entries a filter is sized for
+  const size_t BLOOM_MIN_CAPACITY = 1024;
+
+  // Fixed-size Bloom filter over object ids. MayContain never returns false for
+  // a key that was added, so a negative answer is definitive.
+  class BloomFilter
+  {
+  public:
+    BloomFilter() = default;
+    explicit BloomFilter(size_t capacity);
+
+    void Add(const ObjectId &key);
+    bool MayContain(const ObjectId &key) const;
+
+    // Add every key of a filter of the same size, false if the sizes differ
+    bool Merge(const BloomFilter &other);
+
+    // Keys added so far and the number the filter was sized for
+    size_t Count() const { return count; }
+    size_t Capacity() const { return capacity; }
+
+    // Read or atomically replace a filter file, Load fails on a missing or corrupt file
+    bool Load(const std::filesystem::path &path);
+    bool Save(const std::filesystem::path &path) const;
+
+  private:
+    std::vector<uint64_t> bits;
+    uint64_t count = 0;
+    uint64_t capacity = 0;
+  };
+}
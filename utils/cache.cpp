@@ -0,0 +1,165 @@
+#include "cache.hpp"
+#include "config.hpp"
+#include "json.hpp"
+#include <algorithm>
+
+namespace utils
+{
+  namespace
+  {
+    // Rough in-memory footprint of a parsed SavePoint
+    size_t SavePointBytes(const SavePoint &savePoint)
+    {
+      size_t bytes = sizeof(SavePoint) + savePoint.message.size() + savePoint.timestamp.size();
+      for (const auto &[path, hash] : savePoint.files)
+      {
+        // Key, value and map node overhead
+        bytes += path.size() + sizeof(hash) + 64;
+      }
+      return bytes;
+    }
+  }
+
+  ObjectCache::ObjectCache(size_t budget) : budget(budget) {}
+
+  ObjectCache &ObjectCache::Instance()
+  {
+    static ObjectCache cache(static_cast<size_t>(
+        std::max(0, GetConfigInt("cache.size", static_cast<int>(DEFAULT_OBJECT_CACHE_SIZE)))));
+    return cache;
+  }
+
+  ObjectCache::Entry *ObjectCache::Touch(const ObjectId &hash)
+  {
+    auto it = index.find(hash);
+    if (it == index.end())
+    {
+      return nullptr;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    return &*it->second;
+  }
+
+  void ObjectCache::Store(Entry entry)
+  {
+    if (entry.bytes > budget)
+    {
+      return;
+    }
+
+    auto it = index.find(entry.hash);
+    if (it != index.end())
+    {
+      stats.bytes -= it->second->bytes;
+      entries.erase(it->second);
+      index.erase(it);
+    }
+
+    stats.bytes += entry.bytes;
+    entries.push_front(std::move(entry));
+    index[entries.front().hash] = entries.begin();
+
+    while (stats.bytes > budget && !entries.empty())
+    {
+      Entry &oldest = entries.back();
+      stats.bytes -= oldest.bytes;
+      stats.evictions++;
+      index.erase(oldest.hash);
+      entries.pop_back();
+    }
+  }
+
+  std::shared_ptr<const std::vector<uint8_t>> ObjectCache::GetObject(const ObjectId &hash)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Entry *entry = Touch(hash);
+      if (entry && entry->content)
+      {
+        stats.hits++;
+        return entry->content;
+      }
+      stats.misses++;
+    }
+
+    // Read outside the lock so a slow read doesn't stall other threads
+    auto content = std::make_shared<std::vector<uint8_t>>();
+    if (!ReadObject(hash, *content))
+    {
+      return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry *existing = Touch(hash);
+    Entry entry;
+    entry.hash = hash;
+    entry.content = content;
+    if (existing)
+    {
+      entry.savePoint = existing->savePoint;
+      entry.bytes = existing->bytes;
+    }
+    entry.bytes += content->size();
+    Store(std::move(entry));
+    return content;
+  }
+
+  std::shared_ptr<const SavePoint> ObjectCache::GetSavePoint(const ObjectId &hash)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Entry *entry = Touch(hash);
+      if (entry && entry->savePoint)
+      {
+        stats.hits++;
+        return entry->savePoint;
+      }
+      stats.misses++;
+    }
+
+    // Parsed SavePoints replace their raw bytes, nothing reads both
+    std::vector<uint8_t> content;
+    if (!ReadObject(hash, content))
+    {
+      return nullptr;
+    }
+    auto savePoint = std::make_shared<const SavePoint>(
+        JSON::Parse(std::string(content.begin(), content.end())));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry entry;
+    entry.hash = hash;
+    entry.savePoint = savePoint;
+    entry.bytes = SavePointBytes(*savePoint);
+    Store(std::move(entry));
+    return savePoint;
+  }
+
+  CacheStats ObjectCache::Stats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+  }
+
+  std::shared_ptr<const std::vector<uint8_t>> ReadCachedObject(const ObjectId &hash)
+  {
+    return ObjectCache::Instance().GetObject(hash);
+  }
+
+  std::shared_ptr<const SavePoint> ReadSavePoint(const ObjectId &hash)
+  {
+    return ObjectCache::Instance().GetSavePoint(hash);
+  }
+
+  void PrintCacheStats(std::ostream &out)
+  {
+    CacheStats cache = ObjectCache::Instance().Stats();
+    size_t lookups = cache.hits + cache.misses;
+    out << "Object cache: " << cache.hits << " hit(s), " << cache.misses << " miss(es)";
+    if (lookups > 0)
+    {
+      out << " (" << (100 * cache.hits / lookups) << "% hit rate)";
+    }
+    out << ", " << cache.evictions << " eviction(s), " << cache.bytes << " byte(s) held" << std::endl;
+  }
+}
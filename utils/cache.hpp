@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include "main.hpp"
+
+namespace utils
+{
+  // Byte budget of the object cache when no cache.size setting exists
+  const size_t DEFAULT_OBJECT_CACHE_SIZE = 64 * 1024 * 1024;
+
+  struct CacheStats
+  {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t bytes = 0; // currently held
+  };
+
+  // Process-wide LRU cache of decoded objects and parsed SavePoints, keyed by
+  // hash. Objects are immutable so entries never need invalidating.
+  class ObjectCache
+  {
+  public:
+    explicit ObjectCache(size_t budget);
+
+    // The shared cache, sized from cache.size
+    static ObjectCache &Instance();
+
+    // Decoded object content, or nullptr if the object does not exist
+    std::shared_ptr<const std::vector<uint8_t>> GetObject(const ObjectId &hash);
+
+    // Parsed SavePoint, or nullptr if the object does not exist.
+    // Throws std::runtime_error if the object is not a valid SavePoint.
+    std::shared_ptr<const SavePoint> GetSavePoint(const ObjectId &hash);
+
+    CacheStats Stats() const;
+
+  private:
+    struct Entry
+    {
+      ObjectId hash;
+      std::shared_ptr<const std::vector<uint8_t>> content;
+      std::shared_ptr<const SavePoint> savePoint;
+      size_t bytes = 0;
+    };
+
+    // Find an entry and mark it most recently used, nullptr on a miss
+    Entry *Touch(const ObjectId &hash);
+
+    // Add or update an entry and evict least recently used ones over budget
+    void Store(Entry entry);
+
+    size_t budget;
+    std::list<Entry> entries;
+    std::unordered_map<ObjectId, std::list<Entry>::iterator> index;
+    CacheStats stats;
+    mutable std::mutex mutex;
+  };
+
+  // Read an object's content through the shared cache
+  std::shared_ptr<const std::vector<uint8_t>> ReadCachedObject(const ObjectId &hash);
+
+  // Read a SavePoint through the shared cache
+  std::shared_ptr<const SavePoint> ReadSavePoint(const ObjectId &hash);
+
+  // Print the cache counters (shown when MICROGIT_STATS is set)
+  void PrintCacheStats(std::ostream &out);
+}
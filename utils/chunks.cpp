@@ -0,0 +1,534 @@
+#include "chunks.hpp"
+#include "main.hpp"
+#include "config.hpp"
+#include "object_store.hpp"
+#include "file_copy.hpp"
+#include "hasher.hpp"
+#include "io_engine.hpp"
+#include "cache.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace utils
+{
+  namespace
+  {
+    const char CHUNK_LIST_MAGIC[] = "\0microgit-chunks 1\n";
+    const size_t CHUNK_LIST_MAGIC_SIZE = sizeof(CHUNK_LIST_MAGIC) - 1;
+
+    // Read a file's object. Chunk lists are small and read again by every
+    // status and checkout of the file, so they go through the object cache;
+    // blobs are read directly rather than pushing everything else out of it.
+    bool ReadFileObject(const ObjectId &hash, std::vector<uint8_t> &content)
+    {
+      ObjectInfo info;
+      if (GetObjectStore().Info(hash, info) && info.type == ObjectType::ChunkList)
+      {
+        auto cached = ReadCachedObject(hash);
+        if (!cached)
+        {
+          return false;
+        }
+        content = *cached;
+        return true;
+      }
+      return ReadObject(hash, content);
+    }
+
+    // Normalized chunking: a stricter mask before the average size and a
+    // looser one after it pulls chunk sizes towards the average
+    const uint64_t MASK_SMALL = 0xfffffc0000000000ull; // 22 bits
+    const uint64_t MASK_LARGE = 0xffffc00000000000ull; // 18 bits
+
+    // Small files FilesMatchBlobs reads and hashes together
+    const size_t MATCH_BATCH_FILES = 256;
+
+    // Gear table of pseudo-random values, fixed forever so that chunk
+    // boundaries (and therefore deduplication) stay stable across versions
+    struct GearTable
+    {
+      uint64_t values[256];
+
+      GearTable()
+      {
+        uint64_t state = 0x6d6963726f676974ull; // "microgit"
+        for (int i = 0; i < 256; i++)
+        {
+          // splitmix64
+          state += 0x9e3779b97f4a7c15ull;
+          uint64_t z = state;
+          z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+          z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+          values[i] = z ^ (z >> 31);
+        }
+      }
+    };
+
+    const GearTable gear;
+
+    // Reads a stream and hands out content-defined chunks in order
+    class ChunkReader
+    {
+    public:
+      explicit ChunkReader(std::istream &input) : input(input) {}
+
+      bool Next(std::vector<uint8_t> &chunk)
+      {
+        // Keep a full maximum-size window so boundaries match whole-buffer chunking
+        if (buffer.size() - start < CHUNK_MAX_SIZE && input)
+        {
+          buffer.erase(buffer.begin(), buffer.begin() + start);
+          start = 0;
+          size_t have = buffer.size();
+          buffer.resize(CHUNK_MAX_SIZE * 2);
+          input.read(reinterpret_cast<char *>(buffer.data() + have), buffer.size() - have);
+          buffer.resize(have + static_cast<size_t>(input.gcount()));
+        }
+
+        if (start >= buffer.size())
+        {
+          return false;
+        }
+
+        size_t length = NextChunkSize(buffer.data() + start, buffer.size() - start);
+        chunk.assign(buffer.begin() + start, buffer.begin() + start + length);
+        start += length;
+        return true;
+      }
+
+    private:
+      std::istream &input;
+      std::vector<uint8_t> buffer;
+      size_t start = 0;
+    };
+
+    // Split content into chunks, storing each one when store is set
+    bool SplitContent(const std::vector<uint8_t> &content, bool store, std::vector<Chunk> &chunks)
+    {
+      size_t offset = 0;
+      while (offset < content.size())
+      {
+        size_t length = NextChunkSize(content.data() + offset, content.size() - offset);
+        std::vector<uint8_t> data(content.begin() + offset, content.begin() + offset + length);
+        ObjectId hash = HashContent(data);
+        if (store && !WriteObject(hash, data))
+        {
+          return false;
+        }
+        chunks.push_back({hash, length});
+        offset += length;
+      }
+      return true;
+    }
+
+    bool ShouldChunk(size_t size)
+    {
+      size_t threshold = GetChunkingThreshold();
+      return threshold > 0 && size >= threshold;
+    }
+  }
+
+  size_t GetChunkingThreshold()
+  {
+    int threshold = GetConfigInt("chunking.threshold", static_cast<int>(DEFAULT_CHUNKING_THRESHOLD));
+    return threshold > 0 ? static_cast<size_t>(threshold) : 0;
+  }
+
+  size_t NextChunkSize(const uint8_t *data, size_t size)
+  {
+    if (size <= CHUNK_MIN_SIZE)
+    {
+      return size;
+    }
+
+    size_t limit = size < CHUNK_MAX_SIZE ? size : CHUNK_MAX_SIZE;
+    size_t normal = limit < CHUNK_AVG_SIZE ? limit : CHUNK_AVG_SIZE;
+
+    uint64_t fingerprint = 0;
+    size_t i = CHUNK_MIN_SIZE;
+    for (; i < normal; i++)
+    {
+      fingerprint = (fingerprint << 1) + gear.values[data[i]];
+      if (!(fingerprint & MASK_SMALL))
+      {
+        return i + 1;
+      }
+    }
+    for (; i < limit; i++)
+    {
+      fingerprint = (fingerprint << 1) + gear.values[data[i]];
+      if (!(fingerprint & MASK_LARGE))
+      {
+        return i + 1;
+      }
+    }
+    return limit;
+  }
+
+  bool IsChunkList(const std::vector<uint8_t> &content)
+  {
+    return content.size() >= CHUNK_LIST_MAGIC_SIZE &&
+           std::memcmp(content.data(), CHUNK_LIST_MAGIC, CHUNK_LIST_MAGIC_SIZE) == 0;
+  }
+
+  bool ParseChunkList(const std::vector<uint8_t> &content, std::vector<Chunk> &chunks)
+  {
+    if (!IsChunkList(content))
+    {
+      return false;
+    }
+
+    std::istringstream list(std::string(content.begin() + CHUNK_LIST_MAGIC_SIZE, content.end()));
+    std::string keyword;
+    uint64_t total = 0;
+    if (!(list >> keyword >> total) || keyword != "size")
+    {
+      return false;
+    }
+
+    chunks.clear();
+    uint64_t sum = 0;
+    Chunk chunk;
+    std::string hex;
+    while (list >> hex >> chunk.size)
+    {
+      if (!ObjectId::FromHex(hex, chunk.hash))
+      {
+        return false;
+      }
+      sum += chunk.size;
+      chunks.push_back(chunk);
+    }
+    return sum == total;
+  }
+
+  std::vector<uint8_t> BuildChunkList(const std::vector<Chunk> &chunks, uint64_t total)
+  {
+    std::ostringstream list;
+    list.write(CHUNK_LIST_MAGIC, CHUNK_LIST_MAGIC_SIZE);
+    list << "size " << total << "\n";
+    for (const auto &chunk : chunks)
+    {
+      list << chunk.hash << " " << chunk.size << "\n";
+    }
+    std::string data = list.str();
+    return std::vector<uint8_t>(data.begin(), data.end());
+  }
+
+  ObjectId WriteBlob(const std::vector<uint8_t> &content)
+  {
+    if (!ShouldChunk(content.size()))
+    {
+      ObjectId hash = HashContent(content);
+      return WriteObject(hash, content) ? hash : ObjectId();
+    }
+
+    std::vector<Chunk> chunks;
+    if (!SplitContent(content, true, chunks))
+    {
+      return ObjectId();
+    }
+
+    std::vector<uint8_t> list = BuildChunkList(chunks, content.size());
+    ObjectId hash = HashContent(list);
+    return WriteObject(hash, list, ObjectType::ChunkList) ? hash : ObjectId();
+  }
+
+  ObjectId WriteBlobFile(const std::string &path)
+  {
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    std::ifstream input(path, std::ios::binary);
+    if (ec || !input)
+    {
+      return ObjectId();
+    }
+
+    if (!ShouldChunk(size))
+    {
+      ObjectId hash;
+      return GetObjectStore().WriteFile(path, hash) ? hash : ObjectId();
+    }
+
+    // Only the chunker's window is ever held in memory
+    ChunkReader reader(input);
+    std::vector<Chunk> chunks;
+    std::vector<uint8_t> data;
+    uint64_t total = 0;
+    while (reader.Next(data))
+    {
+      ObjectId hash = HashContent(data);
+      if (!WriteObject(hash, data))
+      {
+        return ObjectId();
+      }
+      chunks.push_back({hash, data.size()});
+      total += data.size();
+    }
+    if (input.bad())
+    {
+      return ObjectId();
+    }
+
+    std::vector<uint8_t> list = BuildChunkList(chunks, total);
+    ObjectId hash = HashContent(list);
+    return WriteObject(hash, list, ObjectType::ChunkList) ? hash : ObjectId();
+  }
+
+  ObjectId HashBlob(const std::vector<uint8_t> &content)
+  {
+    if (!ShouldChunk(content.size()))
+    {
+      return HashContent(content);
+    }
+
+    std::vector<Chunk> chunks;
+    SplitContent(content, false, chunks);
+    return HashContent(BuildChunkList(chunks, content.size()));
+  }
+
+  bool ReadBlob(const ObjectId &hash, std::vector<uint8_t> &content)
+  {
+    if (!ReadFileObject(hash, content))
+    {
+      return false;
+    }
+
+    std::vector<Chunk> chunks;
+    if (!ParseChunkList(content, chunks))
+    {
+      return !IsChunkList(content);
+    }
+
+    content.clear();
+    std::vector<uint8_t> data;
+    for (const auto &chunk : chunks)
+    {
+      if (!ReadObject(chunk.hash, data) || data.size() != chunk.size)
+      {
+        return false;
+      }
+      content.insert(content.end(), data.begin(), data.end());
+    }
+    return true;
+  }
+
+  bool RestoreBlob(const ObjectId &hash, const std::string &path)
+  {
+    // A raw loose object already is the file, let the kernel copy it
+    std::string rawPath = GetObjectStore().RawPath(hash, CLONE_MIN_SIZE);
+    if (!rawPath.empty() && CloneFile(rawPath, path))
+    {
+      return true;
+    }
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+      return false;
+    }
+    auto output = [fd](const uint8_t *data, size_t size)
+    {
+      while (size > 0)
+      {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+        {
+          continue;
+        }
+        if (written <= 0)
+        {
+          return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+      }
+      return true;
+    };
+
+    // Stream plain blobs straight to the file; only chunk lists, recognised
+    // by their first bytes, are buffered so they can be parsed
+    std::vector<uint8_t> head;
+    bool passthrough = false;
+    auto sink = [&](const uint8_t *data, size_t size)
+    {
+      if (passthrough)
+      {
+        return output(data, size);
+      }
+
+      head.insert(head.end(), data, data + size);
+      size_t compared = std::min(head.size(), CHUNK_LIST_MAGIC_SIZE);
+      if (std::memcmp(head.data(), CHUNK_LIST_MAGIC, compared) != 0)
+      {
+        passthrough = true;
+        bool ok = output(head.data(), head.size());
+        head.clear();
+        return ok;
+      }
+      return true;
+    };
+
+    std::vector<Chunk> chunks;
+    bool ok = GetObjectStore().Stream(hash, sink);
+    if (ok && (passthrough || !IsChunkList(head)))
+    {
+      // Short blobs that look like a prefix of the magic end up here
+      ok = output(head.data(), head.size());
+    }
+    else if (ok && ParseChunkList(head, chunks))
+    {
+      // Reassemble without holding more than one chunk in memory, copying
+      // raw chunks inside the kernel
+      for (const auto &chunk : chunks)
+      {
+        off_t before = lseek(fd, 0, SEEK_CUR);
+        std::string chunkPath = GetObjectStore().RawPath(chunk.hash, 0);
+        if (!chunkPath.empty() && AppendFile(chunkPath, fd) &&
+            lseek(fd, 0, SEEK_CUR) - before == static_cast<off_t>(chunk.size))
+        {
+          continue;
+        }
+
+        // Fall back to decoding the chunk, overwriting any partial copy
+        lseek(fd, before, SEEK_SET);
+        uint64_t written = 0;
+        ok = GetObjectStore().Stream(chunk.hash, [&](const uint8_t *data, size_t size)
+                                     {
+          written += size;
+          return output(data, size); });
+        if (!ok || written != chunk.size)
+        {
+          ok = false;
+          break;
+        }
+      }
+      ok = ok && ftruncate(fd, lseek(fd, 0, SEEK_CUR)) == 0;
+    }
+    else
+    {
+      ok = false;
+    }
+
+    return close(fd) == 0 && ok;
+  }
+
+  bool FileMatchesBlob(const std::string &path, const ObjectId &hash)
+  {
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    if (ec)
+    {
+      return false;
+    }
+
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+    {
+      return false;
+    }
+
+    if (ShouldChunk(size))
+    {
+      std::vector<uint8_t> list;
+      std::vector<Chunk> chunks;
+      if (ReadFileObject(hash, list) && ParseChunkList(list, chunks))
+      {
+        // A different total size settles it without reading the file
+        uint64_t total = 0;
+        for (const auto &chunk : chunks)
+        {
+          total += chunk.size;
+        }
+        if (total != size)
+        {
+          return false;
+        }
+
+        ChunkReader reader(input);
+        std::vector<uint8_t> data;
+        for (const auto &chunk : chunks)
+        {
+          if (!reader.Next(data) || data.size() != chunk.size || HashContent(data) != chunk.hash)
+          {
+            return false;
+          }
+        }
+        return !reader.Next(data);
+      }
+    }
+
+    // Hash the file where it lies instead of copying it into memory
+    input.close();
+    Hasher hasher;
+    return hasher.UpdateFile(path) && hasher.Finish() == hash;
+  }
+
+  std::vector<bool> FilesMatchBlobs(const std::vector<std::string> &paths, const std::vector<ObjectId> &hashes)
+  {
+    std::vector<bool> matches(paths.size(), false);
+    std::vector<FileRead> reads;
+    std::vector<size_t> readIndexes;
+
+    auto hashReads = [&]()
+    {
+      GetIoEngine().Read(reads);
+      std::vector<std::vector<uint8_t>> contents;
+      std::vector<size_t> contentIndexes;
+      for (size_t j = 0; j < reads.size(); j++)
+      {
+        if (reads[j].ok)
+        {
+          contents.push_back(std::move(reads[j].data));
+          contentIndexes.push_back(readIndexes[j]);
+        }
+      }
+      std::vector<ObjectId> ids = HashBatch(contents);
+      for (size_t k = 0; k < ids.size(); k++)
+      {
+        matches[contentIndexes[k]] = ids[k] == hashes[contentIndexes[k]];
+      }
+      reads.clear();
+      readIndexes.clear();
+    };
+
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+      std::error_code ec;
+      uint64_t size = fs::file_size(paths[i], ec);
+      if (ec)
+      {
+        continue;
+      }
+
+      // Chunked and larger files are compared as they are read
+      if (ShouldChunk(size) || size > HASH_BATCH_MAX_SIZE)
+      {
+        matches[i] = FileMatchesBlob(paths[i], hashes[i]);
+        continue;
+      }
+
+      FileRead read;
+      read.path = paths[i];
+      reads.push_back(std::move(read));
+      readIndexes.push_back(i);
+      if (reads.size() == MATCH_BATCH_FILES)
+      {
+        hashReads();
+      }
+    }
+    if (!reads.empty())
+    {
+      hashReads();
+    }
+    return matches;
+  }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "object_id.hpp"
+
+namespace utils
+{
+  // Files at or above the chunking threshold are split with FastCDC into
+  // content-defined chunks, each stored as its own object. The file is then
+  // represented by a chunk-list object:
+  //   "\0microgit-chunks 1\n" | "size <total>\n" | "<chunk hash> <length>\n"...
+  // Because boundaries follow the content, an edit only changes the chunks
+  // around it and every other chunk is shared with the previous version.
+
+  // Files smaller than this are stored whole when no chunking.threshold setting exists
+  const size_t DEFAULT_CHUNKING_THRESHOLD = 8 * 1024 * 1024;
+
+  // FastCDC chunk size bounds
+  const size_t CHUNK_MIN_SIZE = 256 * 1024;
+  const size_t CHUNK_AVG_SIZE = 1024 * 1024;
+  const size_t CHUNK_MAX_SIZE = 4 * 1024 * 1024;
+
+  struct Chunk
+  {
+    ObjectId hash;
+    uint64_t size;
+  };
+
+  // The repository's chunking threshold from chunking.threshold (0 disables chunking)
+  size_t GetChunkingThreshold();
+
+  // Length of the next content-defined chunk at the start of data
+  size_t NextChunkSize(const uint8_t *data, size_t size);
+
+  // Check whether object content is a chunk list
+  bool IsChunkList(const std::vector<uint8_t> &content);
+
+  // Parse a chunk list object, returns false if it is malformed
+  bool ParseChunkList(const std::vector<uint8_t> &content, std::vector<Chunk> &chunks);
+
+  // The content of a chunk list object for chunks covering total bytes
+  std::vector<uint8_t> BuildChunkList(const std::vector<Chunk> &chunks, uint64_t total);
+
+  // Store file content, chunking it when it is large, and return the hash
+  // recorded for the file (the chunk list's hash for chunked files).
+  // Returns the null id on failure.
+  ObjectId WriteBlob(const std::vector<uint8_t> &content);
+
+  // Store the file at path like WriteBlob, reading it in blocks so memory use
+  // does not grow with the file size
+  ObjectId WriteBlobFile(const std::string &path);
+
+  // Compute the hash WriteBlob would record for the content without storing it
+  ObjectId HashBlob(const std::vector<uint8_t> &content);
+
+  // Read a file's full content, reassembling chunked files
+  bool ReadBlob(const ObjectId &hash, std::vector<uint8_t> &content);
+
+  // Write a file's content to path, one chunk at a time for chunked files
+  bool RestoreBlob(const ObjectId &hash, const std::string &path);
+
+  // Check whether the file at path matches the stored blob, comparing chunk
+  // by chunk and stopping at the first difference for chunked files
+  bool FileMatchesBlob(const std::string &path, const ObjectId &hash);
+
+  // FileMatchesBlob for many files, matches[i] for paths[i] and hashes[i].
+  // Small files are read in batches and hashed together with HashBatch.
+  std::vector<bool> FilesMatchBlobs(const std::vector<std::string> &paths, const std::vector<ObjectId> &hashes);
+}
@@ -0,0 +1,430 @@
+#include "codec.hpp"
+#include "config.hpp"
+#include <cstring>
+#include <algorithm>
+#include <zlib.h>
+
+namespace utils
+{
+  namespace
+  {
+    const uint8_t CODEC_MAGIC[4] = {0x00, 'M', 'G', 'O'};
+    const uint8_t TYPED_MAGIC[4] = {0x00, 'M', 'G', 'T'};
+
+    // Size of the sample ObjectEncoder compresses to choose a codec
+    const size_t ENCODER_SAMPLE_SIZE = 64 * 1024;
+
+    void WriteHeader(std::vector<uint8_t> &out, Codec codec, ObjectType type, uint64_t size)
+    {
+      out.insert(out.end(), TYPED_MAGIC, TYPED_MAGIC + 4);
+      out.push_back(static_cast<uint8_t>(codec));
+      out.push_back(static_cast<uint8_t>(type));
+      out.resize(out.size() + 8);
+      PutObjectSize(size, out.data() + out.size() - 8);
+    }
+
+    bool Inflate(const uint8_t *data, size_t size, std::vector<uint8_t> &content)
+    {
+      z_stream stream;
+      std::memset(&stream, 0, sizeof(stream));
+      if (inflateInit(&stream) != Z_OK)
+      {
+        return false;
+      }
+
+      content.clear();
+      content.resize(size * 3 + 64);
+      stream.next_in = const_cast<Bytef *>(data);
+      stream.avail_in = static_cast<uInt>(size);
+
+      int result = Z_OK;
+      while (result == Z_OK)
+      {
+        if (stream.total_out == content.size())
+        {
+          content.resize(content.size() * 2);
+        }
+        stream.next_out = content.data() + stream.total_out;
+        stream.avail_out = static_cast<uInt>(content.size() - stream.total_out);
+        result = inflate(&stream, Z_NO_FLUSH);
+        if (result == Z_BUF_ERROR && stream.avail_out == 0)
+        {
+          // Output buffer was full, grow it and continue
+          result = Z_OK;
+        }
+      }
+
+      content.resize(stream.total_out);
+      inflateEnd(&stream);
+      return result == Z_STREAM_END;
+    }
+  }
+
+  bool DecodeObjectStream(std::istream &in, const ByteSink &sink)
+  {
+    const size_t BLOCK_SIZE = 64 * 1024;
+    std::vector<uint8_t> input(BLOCK_SIZE);
+
+    in.read(reinterpret_cast<char *>(input.data()), CODEC_HEADER_SIZE);
+    size_t headerRead = static_cast<size_t>(in.gcount());
+    Codec codec = Codec::None;
+    if (HasCodecHeader(input.data(), headerRead))
+    {
+      codec = static_cast<Codec>(input[4]);
+      if (std::memcmp(input.data(), TYPED_MAGIC, 4) == 0)
+      {
+        // The rest of a typed header, which the content itself does not need
+        in.read(reinterpret_cast<char *>(input.data()), TYPED_HEADER_SIZE - CODEC_HEADER_SIZE);
+        if (static_cast<size_t>(in.gcount()) != TYPED_HEADER_SIZE - CODEC_HEADER_SIZE)
+        {
+          return false;
+        }
+      }
+    }
+    else if (headerRead > 0 && !sink(input.data(), headerRead))
+    {
+      // Raw object, the bytes we peeked at are content
+      return false;
+    }
+
+    if (codec == Codec::None)
+    {
+      while (in.read(reinterpret_cast<char *>(input.data()), BLOCK_SIZE) || in.gcount() > 0)
+      {
+        if (!sink(input.data(), static_cast<size_t>(in.gcount())))
+        {
+          return false;
+        }
+      }
+      return !in.bad();
+    }
+
+    if (codec != Codec::Zlib)
+    {
+      return false;
+    }
+
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK)
+    {
+      return false;
+    }
+
+    std::vector<uint8_t> output(BLOCK_SIZE);
+    int result = Z_OK;
+    while (result != Z_STREAM_END)
+    {
+      in.read(reinterpret_cast<char *>(input.data()), BLOCK_SIZE);
+      stream.next_in = input.data();
+      stream.avail_in = static_cast<uInt>(in.gcount());
+      if (stream.avail_in == 0)
+      {
+        // Truncated stream
+        break;
+      }
+
+      do
+      {
+        stream.next_out = output.data();
+        stream.avail_out = static_cast<uInt>(output.size());
+        result = inflate(&stream, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+        {
+          inflateEnd(&stream);
+          return false;
+        }
+
+        size_t produced = output.size() - stream.avail_out;
+        if (produced > 0 && !sink(output.data(), produced))
+        {
+          inflateEnd(&stream);
+          return false;
+        }
+      } while (stream.avail_out == 0 && result != Z_STREAM_END);
+    }
+
+    inflateEnd(&stream);
+    return result == Z_STREAM_END;
+  }
+
+  int GetCompressionLevel()
+  {
+    int level = GetConfigInt("core.compression", DEFAULT_COMPRESSION_LEVEL);
+    if (level < -1 || level > 9)
+    {
+      return DEFAULT_COMPRESSION_LEVEL;
+    }
+    return level;
+  }
+
+  bool HasCodecHeader(const uint8_t *data, size_t size)
+  {
+    return size >= CODEC_HEADER_SIZE &&
+           (std::memcmp(data, TYPED_MAGIC, 4) == 0 || std::memcmp(data, CODEC_MAGIC, 4) == 0);
+  }
+
+  bool ParseObjectHeader(const uint8_t *data, size_t size, ObjectHeader &header)
+  {
+    header = ObjectHeader();
+    if (!HasCodecHeader(data, size))
+    {
+      // Raw objects are content, their size is the stored size
+      header.size = size;
+      return true;
+    }
+
+    header.codec = static_cast<Codec>(data[4]);
+    header.length = CODEC_HEADER_SIZE;
+    if (std::memcmp(data, TYPED_MAGIC, 4) != 0)
+    {
+      return true;
+    }
+    if (size < TYPED_HEADER_SIZE)
+    {
+      return false;
+    }
+
+    header.type = static_cast<ObjectType>(data[5]);
+    header.size = 0;
+    for (int i = 7; i >= 0; i--)
+    {
+      header.size = (header.size << 8) | data[OBJECT_SIZE_OFFSET + i];
+    }
+    header.length = TYPED_HEADER_SIZE;
+    return true;
+  }
+
+  ObjectType RawObjectType(const uint8_t *data, size_t size)
+  {
+    // SavePoints are JSON objects and chunk lists start with a zero byte
+    return size > 0 && (data[0] == '{' || data[0] == 0) ? ObjectType::Unknown : ObjectType::Blob;
+  }
+
+  void PutObjectSize(uint64_t size, uint8_t *field)
+  {
+    for (int i = 0; i < 8; i++)
+    {
+      field[i] = static_cast<uint8_t>(size >> (8 * i));
+    }
+  }
+
+  const char *ObjectTypeName(ObjectType type)
+  {
+    switch (type)
+    {
+    case ObjectType::Blob:
+      return "blob";
+    case ObjectType::SavePoint:
+      return "savepoint";
+    case ObjectType::ChunkList:
+      return "chunklist";
+    case ObjectType::Delta:
+      return "delta";
+    case ObjectType::Tree:
+      return "tree";
+    default:
+      return "unknown";
+    }
+  }
+
+  bool StoresRaw(const uint8_t *sample, size_t size, int level)
+  {
+    if (HasCodecHeader(sample, size))
+    {
+      return false;
+    }
+    if (level == 0)
+    {
+      return true;
+    }
+
+    std::vector<uint8_t> stored = EncodeObject(std::vector<uint8_t>(sample, sample + size), level);
+    return !HasCodecHeader(stored.data(), stored.size());
+  }
+
+  std::vector<uint8_t> EncodeObject(const std::vector<uint8_t> &content, int level, ObjectType type)
+  {
+    std::vector<uint8_t> stored;
+
+    if (level != 0)
+    {
+      uLongf compressedSize = compressBound(content.size());
+      stored.resize(TYPED_HEADER_SIZE + compressedSize);
+      if (compress2(stored.data() + TYPED_HEADER_SIZE, &compressedSize,
+                    content.data(), content.size(), level) == Z_OK &&
+          TYPED_HEADER_SIZE + compressedSize < content.size())
+      {
+        std::vector<uint8_t> header;
+        WriteHeader(header, Codec::Zlib, type, content.size());
+        std::memcpy(stored.data(), header.data(), header.size());
+        stored.resize(TYPED_HEADER_SIZE + compressedSize);
+        return stored;
+      }
+      stored.clear();
+    }
+
+    // Incompressible or uncompressed blobs are stored raw unless the content
+    // itself looks like a header; everything else keeps its type
+    bool untyped = type == ObjectType::Blob || type == ObjectType::Unknown;
+    if (!untyped || HasCodecHeader(content.data(), content.size()))
+    {
+      WriteHeader(stored, Codec::None, type, content.size());
+    }
+    stored.insert(stored.end(), content.begin(), content.end());
+    return stored;
+  }
+
+  bool DecodeObject(const std::vector<uint8_t> &stored, std::vector<uint8_t> &content)
+  {
+    ObjectHeader header;
+    if (!ParseObjectHeader(stored.data(), stored.size(), header))
+    {
+      return false;
+    }
+    if (header.length == 0)
+    {
+      // Raw object written without a header
+      content = stored;
+      return true;
+    }
+
+    const uint8_t *payload = stored.data() + header.length;
+    size_t payloadSize = stored.size() - header.length;
+    bool ok;
+    switch (header.codec)
+    {
+    case Codec::None:
+      content.assign(payload, payload + payloadSize);
+      ok = true;
+      break;
+    case Codec::Zlib:
+      ok = Inflate(payload, payloadSize, content);
+      break;
+    default:
+      return false;
+    }
+    return ok && (header.size == OBJECT_SIZE_UNKNOWN || header.size == content.size());
+  }
+
+  ObjectEncoder::ObjectEncoder(int level, ByteSink out) : level(level), out(std::move(out)) {}
+
+  ObjectEncoder::~ObjectEncoder()
+  {
+    if (stream)
+    {
+      deflateEnd(stream);
+      delete stream;
+    }
+  }
+
+  bool ObjectEncoder::Write(const uint8_t *data, size_t size)
+  {
+    if (!started)
+    {
+      size_t take = std::min(size, ENCODER_SAMPLE_SIZE - first.size());
+      first.insert(first.end(), data, data + take);
+      data += take;
+      size -= take;
+      if (first.size() < ENCODER_SAMPLE_SIZE)
+      {
+        return true;
+      }
+      if (!Start())
+      {
+        return false;
+      }
+    }
+
+    if (size == 0)
+    {
+      return true;
+    }
+    return stream ? Deflate(data, size, false) : out(data, size);
+  }
+
+  bool ObjectEncoder::Finish()
+  {
+    if (!started)
+    {
+      // Small objects are encoded exactly like EncodeObject would
+      started = true;
+      std::vector<uint8_t> stored = EncodeObject(first, level);
+      return out(stored.data(), stored.size());
+    }
+    return stream ? Deflate(nullptr, 0, true) : true;
+  }
+
+  bool ObjectEncoder::Start()
+  {
+    started = true;
+    std::vector<uint8_t> header;
+
+    if (level != 0)
+    {
+      std::vector<uint8_t> sample = EncodeObject(first, level);
+      if (HasCodecHeader(sample.data(), sample.size()) && sample[4] == static_cast<uint8_t>(Codec::Zlib))
+      {
+        stream = new z_stream();
+        if (deflateInit(stream, level) != Z_OK)
+        {
+          delete stream;
+          stream = nullptr;
+          return false;
+        }
+        WriteHeader(header, Codec::Zlib, ObjectType::Blob, OBJECT_SIZE_UNKNOWN);
+        sizePending = true;
+        bool ok = out(header.data(), header.size()) && Deflate(first.data(), first.size(), false);
+        first.clear();
+        return ok;
+      }
+    }
+
+    // Raw, with an explicit header only if the content looks like one
+    if (HasCodecHeader(first.data(), first.size()))
+    {
+      WriteHeader(header, Codec::None, ObjectType::Blob, OBJECT_SIZE_UNKNOWN);
+      sizePending = true;
+    }
+    bool ok = (header.empty() || out(header.data(), header.size())) && out(first.data(), first.size());
+    first.clear();
+    return ok;
+  }
+
+  bool ObjectEncoder::Deflate(const uint8_t *data, size_t size, bool finish)
+  {
+    // zlib counts input in 32 bits, feed huge buffers in slices
+    const size_t MAX_SLICE = 1u << 30;
+    while (size > MAX_SLICE)
+    {
+      if (!Deflate(data, MAX_SLICE, false))
+      {
+        return false;
+      }
+      data += MAX_SLICE;
+      size -= MAX_SLICE;
+    }
+
+    uint8_t output[ENCODER_SAMPLE_SIZE];
+    stream->next_in = const_cast<Bytef *>(data);
+    stream->avail_in = static_cast<uInt>(size);
+
+    int result;
+    do
+    {
+      stream->next_out = output;
+      stream->avail_out = sizeof(output);
+      result = deflate(stream, finish ? Z_FINISH : Z_NO_FLUSH);
+      if (result == Z_STREAM_ERROR)
+      {
+        return false;
+      }
+      size_t produced = sizeof(output) - stream->avail_out;
+      if (produced > 0 && !out(output, produced))
+      {
+        return false;
+      }
+    } while (stream->avail_out == 0 || (finish && result != Z_STREAM_END));
+    return true;
+  }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <istream>
+#include <functional>
+
+struct z_stream_s;
+
+namespace utils
+{
+  // Stored objects are either raw content or a header followed by the payload:
+  //   0x00 'M' 'G' 'T' | codec u8 | type u8 | size u64 | payload
+  // where size is the decoded length (little-endian). Only blobs are stored
+  // raw, and only when they do not compress, so that a checkout can link or
+  // clone the object file itself. Objects written before the type was
+  // recorded may carry the older 5-byte header instead:
+  //   0x00 'M' 'G' 'O' | codec u8 | payload
+
+  // Codecs recorded in the object header
+  enum class Codec : uint8_t
+  {
+    None = 0,
+    Zlib = 1,
+  };
+
+  // Object types recorded in the typed header
+  enum class ObjectType : uint8_t
+  {
+    Unknown = 0, // older objects, the content has to be inspected
+    Blob = 1,
+    SavePoint = 2,
+    ChunkList = 3,
+    Delta = 4, // pack delta payloads
+    Tree = 5,
+  };
+
+  const size_t CODEC_HEADER_SIZE = 5;
+  const size_t TYPED_HEADER_SIZE = 14;
+
+  // Offset of the size field inside a typed header
+  const size_t OBJECT_SIZE_OFFSET = 6;
+
+  // Size recorded by encoders that did not know it up front
+  const uint64_t OBJECT_SIZE_UNKNOWN = UINT64_MAX;
+
+  // What a stored object's header says about it
+  struct ObjectHeader
+  {
+    Codec codec = Codec::None;
+    ObjectType type = ObjectType::Unknown;
+    uint64_t size = OBJECT_SIZE_UNKNOWN;
+    size_t length = 0; // header bytes before the payload, 0 for raw objects
+  };
+
+  // An object's type and decoded size, as answered without reading the content
+  struct ObjectInfo
+  {
+    ObjectType type = ObjectType::Unknown;
+    uint64_t size = OBJECT_SIZE_UNKNOWN;
+  };
+
+  // Parse the header at the start of stored bytes. Returns false if the header
+  // is truncated; raw objects parse as a header of length 0.
+  bool ParseObjectHeader(const uint8_t *data, size_t size, ObjectHeader &header);
+
+  // Type of a headerless object from its first bytes: a blob, or Unknown when
+  // it may be an older SavePoint or chunk list that has to be inspected
+  ObjectType RawObjectType(const uint8_t *data, size_t size);
+
+  // Fill a typed header's size field
+  void PutObjectSize(uint64_t size, uint8_t *field);
+
+  // Name of a type as printed by cat-object
+  const char *ObjectTypeName(ObjectType type);
+
+  // Compression level used when no core.compression setting exists
+  const int DEFAULT_COMPRESSION_LEVEL = -1;
+
+  // The repository's zlib level from core.compression (0 stores objects uncompressed)
+  int GetCompressionLevel();
+
+  // Encode object content for storage with the given zlib level
+  std::vector<uint8_t> EncodeObject(const std::vector<uint8_t> &content, int level,
+                                    ObjectType type = ObjectType::Blob);
+
+  // Decode a stored object back to its content, returns false if it is corrupt
+  bool DecodeObject(const std::vector<uint8_t> &stored, std::vector<uint8_t> &content);
+
+  // Receives decoded content piece by piece, returns false to stop
+  using ByteSink = std::function<bool(const uint8_t *data, size_t size)>;
+
+  // Decode a stored object read from a stream, passing content to sink in
+  // pieces so large objects never have to fit in memory
+  bool DecodeObjectStream(std::istream &in, const ByteSink &sink);
+
+  // Check whether EncodeObject would store content starting with this sample
+  // raw and headerless, i.e. byte for byte identical to the content
+  bool StoresRaw(const uint8_t *sample, size_t size, int level);
+
+  // Encodes a blob for storage as its content arrives, so large blobs never
+  // have to fit in memory. The codec is chosen from the first block: content
+  // that does not compress there is stored raw, as EncodeObject does. The
+  // total size is only known at the end, so a header written before then
+  // records OBJECT_SIZE_UNKNOWN; SizePending() tells the caller to patch it.
+  class ObjectEncoder
+  {
+  public:
+    ObjectEncoder(int level, ByteSink out);
+    ~ObjectEncoder();
+
+    ObjectEncoder(const ObjectEncoder &) = delete;
+    ObjectEncoder &operator=(const ObjectEncoder &) = delete;
+
+    bool Write(const uint8_t *data, size_t size);
+
+    // Flush the remaining output, must be called once after the last Write
+    bool Finish();
+
+    // Whether a header with an unknown size was written
+    bool SizePending() const { return sizePending; }
+
+  private:
+    // Pick the codec for the buffered first block and emit it
+    bool Start();
+
+    bool Deflate(const uint8_t *data, size_t size, bool finish);
+
+    int level;
+    ByteSink out;
+    std::vector<uint8_t> first;
+    bool started = false;
+    bool sizePending = false;
+    ::z_stream_s *stream = nullptr; // set while compressing
+  };
+
+  // Check whether stored bytes carry a header (typed or older)
+  bool HasCodecHeader(const uint8_t *data, size_t size);
+}
@@ -0,0 +1,119 @@
+#include "config.hpp"
+#include "main.hpp"
+#include <fstream>
+#include <filesystem>
+#include <mutex>
+
+namespace fs = std::filesystem;
+
+namespace utils
+{
+  namespace
+  {
+    bool configLoaded = false;
+    std::map<std::string, std::string> configValues;
+
+    // Commands read settings from worker threads too
+    std::mutex configMutex;
+
+    std::string Trim(const std::string &str)
+    {
+      size_t start = str.find_first_not_of(" \t\r");
+      if (start == std::string::npos)
+      {
+        return "";
+      }
+      size_t end = str.find_last_not_of(" \t\r");
+      return str.substr(start, end - start + 1);
+    }
+
+    std::string ConfigPath()
+    {
+      return DEFAULT_PATH + "/config";
+    }
+
+    void LoadConfig()
+    {
+      if (configLoaded)
+      {
+        return;
+      }
+
+      configValues.clear();
+      configLoaded = true;
+
+      std::ifstream file(ConfigPath());
+      if (!file.is_open())
+      {
+        return;
+      }
+
+      std::string line;
+      while (std::getline(file, line))
+      {
+        line = Trim(line);
+        if (line.empty() || line[0] == '#')
+        {
+          continue;
+        }
+
+        size_t eqPos = line.find('=');
+        if (eqPos == std::string::npos)
+        {
+          continue;
+        }
+
+        configValues[Trim(line.substr(0, eqPos))] = Trim(line.substr(eqPos + 1));
+      }
+    }
+  }
+
+  std::string GetConfig(const std::string &key, const std::string &defaultValue)
+  {
+    std::lock_guard<std::mutex> lock(configMutex);
+    LoadConfig();
+    auto it = configValues.find(key);
+    return it != configValues.end() ? it->second : defaultValue;
+  }
+
+  int GetConfigInt(const std::string &key, int defaultValue)
+  {
+    std::string value = GetConfig(key);
+    if (value.empty())
+    {
+      return defaultValue;
+    }
+
+    // Trailing garbage such as "12abc" is invalid too, not 12
+    try
+    {
+      size_t end = 0;
+      int result = std::stoi(value, &end);
+      return end == value.size() ? result : defaultValue;
+    }
+    catch (const std::exception &)
+    {
+      return defaultValue;
+    }
+  }
+
+  bool SetConfig(const std::string &key, const std::string &value)
+  {
+    std::lock_guard<std::mutex> lock(configMutex);
+    LoadConfig();
+    configValues[key] = value;
+
+    std::string content;
+    for (const auto &[k, v] : configValues)
+    {
+      content += k + " = " + v + "\n";
+    }
+    return ReplaceFile(ConfigPath(), content);
+  }
+
+  void ReloadConfig()
+  {
+    std::lock_guard<std::mutex> lock(configMutex);
+    configLoaded = false;
+  }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <map>
+
+namespace utils
+{
+  // Repository configuration stored in .microgit/config as "key = value" lines
+
+  // Get a configuration value, or defaultValue when the key is not set
+  std::string GetConfig(const std::string &key, const std::string &defaultValue = "");
+
+  // Get an integer configuration value, or defaultValue when unset or invalid
+  int GetConfigInt(const std::string &key, int defaultValue);
+
+  // Set a configuration value and write the config file back
+  bool SetConfig(const std::string &key, const std::string &value);
+
+  // Drop the cached configuration so the next lookup re-reads the file
+  void ReloadConfig();
+}
@@ -0,0 +1,192 @@
+#include "delta.hpp"
+#include <cstring>
+#include <unordered_map>
+
+namespace utils
+{
+  namespace
+  {
+    // Matches shorter than a block are not worth a copy op
+    const size_t BLOCK_SIZE = 16;
+    const uint32_t ROLL_PRIME = 16777619u;
+    const uint8_t OP_COPY = 0x80;
+    const size_t MAX_INSERT = 0x7f;
+
+    void PutVarint(std::vector<uint8_t> &out, uint64_t value)
+    {
+      while (value >= 0x80)
+      {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+      }
+      out.push_back(static_cast<uint8_t>(value));
+    }
+
+    bool GetVarint(const std::vector<uint8_t> &in, size_t &pos, uint64_t &value)
+    {
+      value = 0;
+      for (int shift = 0; shift < 64; shift += 7)
+      {
+        if (pos >= in.size())
+        {
+          return false;
+        }
+        uint8_t byte = in[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    uint32_t BlockHash(const uint8_t *data)
+    {
+      uint32_t hash = 0;
+      for (size_t i = 0; i < BLOCK_SIZE; i++)
+      {
+        hash = hash * ROLL_PRIME + data[i];
+      }
+      return hash;
+    }
+
+    void FlushInsert(std::vector<uint8_t> &out, const uint8_t *data, size_t length)
+    {
+      while (length > 0)
+      {
+        size_t chunk = length < MAX_INSERT ? length : MAX_INSERT;
+        out.push_back(static_cast<uint8_t>(chunk));
+        out.insert(out.end(), data, data + chunk);
+        data += chunk;
+        length -= chunk;
+      }
+    }
+  }
+
+  std::vector<uint8_t> CreateDelta(const std::vector<uint8_t> &base, const std::vector<uint8_t> &target)
+  {
+    std::vector<uint8_t> delta;
+    PutVarint(delta, base.size());
+    PutVarint(delta, target.size());
+
+    if (base.size() < BLOCK_SIZE || target.size() < BLOCK_SIZE)
+    {
+      FlushInsert(delta, target.data(), target.size());
+      return delta;
+    }
+
+    // Index every aligned block of the base, keeping the first occurrence
+    std::unordered_map<uint32_t, size_t> blocks;
+    blocks.reserve(base.size() / BLOCK_SIZE);
+    for (size_t offset = 0; offset + BLOCK_SIZE <= base.size(); offset += BLOCK_SIZE)
+    {
+      blocks.emplace(BlockHash(base.data() + offset), offset);
+    }
+
+    // Weight of the byte leaving the rolling window
+    uint32_t outWeight = 1;
+    for (size_t i = 1; i < BLOCK_SIZE; i++)
+    {
+      outWeight *= ROLL_PRIME;
+    }
+
+    size_t insertStart = 0;
+    size_t pos = 0;
+    uint32_t hash = BlockHash(target.data());
+    while (pos + BLOCK_SIZE <= target.size())
+    {
+      auto it = blocks.find(hash);
+      if (it != blocks.end() && std::memcmp(base.data() + it->second, target.data() + pos, BLOCK_SIZE) == 0)
+      {
+        size_t baseOffset = it->second;
+        size_t length = BLOCK_SIZE;
+
+        // Extend the match forwards, then backwards into pending literals
+        while (baseOffset + length < base.size() && pos + length < target.size() &&
+               base[baseOffset + length] == target[pos + length])
+        {
+          length++;
+        }
+        while (baseOffset > 0 && pos > insertStart && base[baseOffset - 1] == target[pos - 1])
+        {
+          baseOffset--;
+          pos--;
+          length++;
+        }
+
+        FlushInsert(delta, target.data() + insertStart, pos - insertStart);
+        delta.push_back(OP_COPY);
+        PutVarint(delta, baseOffset);
+        PutVarint(delta, length);
+
+        pos += length;
+        insertStart = pos;
+        if (pos + BLOCK_SIZE <= target.size())
+        {
+          hash = BlockHash(target.data() + pos);
+        }
+        continue;
+      }
+
+      // Slide the window by one byte
+      if (pos + BLOCK_SIZE < target.size())
+      {
+        hash = (hash - target[pos] * outWeight) * ROLL_PRIME + target[pos + BLOCK_SIZE];
+      }
+      pos++;
+    }
+
+    FlushInsert(delta, target.data() + insertStart, target.size() - insertStart);
+    return delta;
+  }
+
+  bool DeltaTargetSize(const std::vector<uint8_t> &delta, uint64_t &size)
+  {
+    size_t pos = 0;
+    uint64_t baseSize;
+    return GetVarint(delta, pos, baseSize) && GetVarint(delta, pos, size);
+  }
+
+  bool ApplyDelta(const std::vector<uint8_t> &base, const std::vector<uint8_t> &delta, std::vector<uint8_t> &target)
+  {
+    size_t pos = 0;
+    uint64_t baseSize, targetSize;
+    if (!GetVarint(delta, pos, baseSize) || !GetVarint(delta, pos, targetSize) || baseSize != base.size())
+    {
+      return false;
+    }
+
+    target.clear();
+    target.reserve(targetSize);
+    while (pos < delta.size())
+    {
+      uint8_t op = delta[pos++];
+      if (op == OP_COPY)
+      {
+        uint64_t offset, length;
+        if (!GetVarint(delta, pos, offset) || !GetVarint(delta, pos, length) ||
+            offset > base.size() || length > base.size() - offset)
+        {
+          return false;
+        }
+        target.insert(target.end(), base.begin() + offset, base.begin() + offset + length);
+      }
+      else if (op != 0 && op <= MAX_INSERT)
+      {
+        if (op > delta.size() - pos)
+        {
+          return false;
+        }
+        target.insert(target.end(), delta.begin() + pos, delta.begin() + pos + op);
+        pos += op;
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    return target.size() == targetSize;
+  }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+namespace utils
+{
+  // Binary deltas describe a target buffer as copies from a base buffer plus
+  // inserted literals:
+  //   base size varint | target size varint | ops...
+  //   op 0x80           copy: offset varint | length varint
+  //   op 0x01..0x7f     insert: the next op bytes verbatim
+
+  // Encode target as a delta against base
+  std::vector<uint8_t> CreateDelta(const std::vector<uint8_t> &base, const std::vector<uint8_t> &target);
+
+  // Read the target size from a delta's header without applying it
+  bool DeltaTargetSize(const std::vector<uint8_t> &delta, uint64_t &size);
+
+  // Rebuild the target from base and delta, returns false if the delta is malformed
+  bool ApplyDelta(const std::vector<uint8_t> &base, const std::vector<uint8_t> &delta, std::vector<uint8_t> &target);
+}
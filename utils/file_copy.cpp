@@ -0,0 +1,152 @@
+#include "file_copy.hpp"
+#include <atomic>
+#include <cerrno>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+namespace utils
+{
+  namespace
+  {
+    std::atomic<size_t> reflinked{0};
+    std::atomic<size_t> copyRanged{0};
+    std::atomic<size_t> buffered{0};
+
+    bool BufferedCopy(int inFd, int outFd)
+    {
+      std::vector<char> buffer(64 * 1024);
+      while (true)
+      {
+        ssize_t got = read(inFd, buffer.data(), buffer.size());
+        if (got < 0 && errno == EINTR)
+        {
+          continue;
+        }
+        if (got <= 0)
+        {
+          return got == 0;
+        }
+
+        for (ssize_t done = 0; done < got;)
+        {
+          ssize_t written = write(outFd, buffer.data() + done, static_cast<size_t>(got - done));
+          if (written < 0 && errno == EINTR)
+          {
+            continue;
+          }
+          if (written <= 0)
+          {
+            return false;
+          }
+          done += written;
+        }
+      }
+    }
+
+    // Copy the rest of inFd to outFd, both from their current positions
+    bool CopyRest(int inFd, int outFd)
+    {
+#ifdef __linux__
+      bool copiedAny = false;
+      while (true)
+      {
+        ssize_t copied = copy_file_range(inFd, nullptr, outFd, nullptr, 1u << 30, 0);
+        if (copied < 0 && errno == EINTR)
+        {
+          continue;
+        }
+        if (copied == 0)
+        {
+          copyRanged++;
+          return true;
+        }
+        if (copied < 0)
+        {
+          // Unsupported here (old kernel, cross-filesystem, special files):
+          // the positions have not moved, so carry on with a buffered copy
+          if (!copiedAny && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                             errno == EOPNOTSUPP || errno == EBADF))
+          {
+            break;
+          }
+          return false;
+        }
+        copiedAny = true;
+      }
+#endif
+      buffered++;
+      return BufferedCopy(inFd, outFd);
+    }
+  }
+
+  bool CopyFileContents(int inFd, int outFd)
+  {
+    if (lseek(inFd, 0, SEEK_SET) != 0)
+    {
+      return false;
+    }
+
+#if defined(__linux__) && defined(FICLONE)
+    if (ioctl(outFd, FICLONE, inFd) == 0)
+    {
+      reflinked++;
+      return true;
+    }
+#endif
+
+    return ftruncate(outFd, 0) == 0 && lseek(outFd, 0, SEEK_SET) == 0 && CopyRest(inFd, outFd);
+  }
+
+  bool CloneFile(const std::string &from, const std::string &to)
+  {
+    int inFd = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (inFd < 0)
+    {
+      return false;
+    }
+    int outFd = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (outFd < 0)
+    {
+      close(inFd);
+      return false;
+    }
+
+    bool ok = CopyFileContents(inFd, outFd);
+    close(inFd);
+    return close(outFd) == 0 && ok;
+  }
+
+  bool AppendFile(const std::string &from, int outFd)
+  {
+    int inFd = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (inFd < 0)
+    {
+      return false;
+    }
+    bool ok = CopyRest(inFd, outFd);
+    close(inFd);
+    return ok;
+  }
+
+  CopyStats GetCopyStats()
+  {
+    CopyStats stats;
+    stats.reflinked = reflinked;
+    stats.copyRanged = copyRanged;
+    stats.buffered = buffered;
+    return stats;
+  }
+
+  void PrintCopyStats(std::ostream &out)
+  {
+    CopyStats copies = GetCopyStats();
+    out << "File copies: " << copies.reflinked << " reflinked, " << copies.copyRanged << " with copy_file_range, "
+        << copies.buffered << " buffered" << std::endl;
+  }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+namespace utils
+{
+  // Kernel-side file copies. A whole-file copy first tries a reflink
+  // (FICLONE, btrfs/XFS), which shares the data blocks instead of copying
+  // them, then copy_file_range, then falls back to a buffered copy.
+
+  // Objects smaller than this are cheaper to copy through user space
+  const size_t CLONE_MIN_SIZE = 64 * 1024;
+
+  struct CopyStats
+  {
+    size_t reflinked = 0;
+    size_t copyRanged = 0; // copied with copy_file_range
+    size_t buffered = 0;
+  };
+
+  // Replace the contents of outFd with all of inFd, reading from its start
+  bool CopyFileContents(int inFd, int outFd);
+
+  // Copy the file at from to to, creating or truncating it
+  bool CloneFile(const std::string &from, const std::string &to);
+
+  // Append the file at from to outFd at its current position (no reflink,
+  // but copy_file_range still shares blocks on filesystems that can)
+  bool AppendFile(const std::string &from, int outFd);
+
+  // Copy counters for this process
+  CopyStats GetCopyStats();
+
+  // Print the copy counters (shown when MICROGIT_STATS is set)
+  void PrintCopyStats(std::ostream &out);
+}
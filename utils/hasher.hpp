@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "object_id.hpp"
+#include "blake3.hpp"
+
+typedef struct evp_md_ctx_st EVP_MD_CTX;
+
+namespace utils
+{
+  // Hash function that names a repository's objects, recorded as core.hash
+  // by init. Both produce 32-byte digests, so ids look the same either way.
+  enum class HashAlgorithm
+  {
+    Sha256, // repositories without core.hash
+    Blake3,
+  };
+
+  // Name used in core.hash and on the command line
+  const char *HashAlgorithmName(HashAlgorithm algorithm);
+
+  // Parse a name from core.hash or the command line
+  bool ParseHashAlgorithm(const std::string &name, HashAlgorithm &algorithm);
+
+  // The repository's hash algorithm, SHA-256 when none is recorded
+  HashAlgorithm GetHashAlgorithm();
+
+  // Incremental object hashing. SHA-256 goes through OpenSSL's EVP
+  // interface, which selects the SHA-NI, AVX2 or plain code path for the CPU
+  // at run time; BLAKE3 uses the implementation in blake3.hpp. Content can be
+  // fed in pieces as it is read, so nothing has to be held in memory whole.
+  //
+  // SHA-256 contexts are reused: each thread keeps the contexts of finished
+  // Hashers and hands them to the next one, so hashing many small objects
+  // does not allocate a context per object.
+  class Hasher
+  {
+  public:
+    explicit Hasher(HashAlgorithm algorithm = GetHashAlgorithm());
+    ~Hasher();
+
+    Hasher(const Hasher &) = delete;
+    Hasher &operator=(const Hasher &) = delete;
+
+    // Add bytes to the digest
+    void Update(const void *data, size_t size);
+    void Update(const std::vector<uint8_t> &data) { Update(data.data(), data.size()); }
+
+    // Add everything read from fd up to end of file, false on a read error
+    bool UpdateFd(int fd);
+
+    // Add the whole file at path through a read-only mapping, or by reading
+    // it when it cannot be mapped. False if the file cannot be read.
+    bool UpdateFile(const std::string &path);
+
+    // The digest of everything added since construction or the last Finish,
+    // which starts a new digest. The null id if OpenSSL failed.
+    ObjectId Finish();
+
+  private:
+    void Start();
+
+    HashAlgorithm algorithm;
+    EVP_MD_CTX *context = nullptr;
+    Blake3 blake3;
+    bool ok = false;
+  };
+
+  // Buffers up to this size are hashed in SIMD lanes by HashBatch; larger
+  // ones are hashed one at a time, so callers can bound what they hold
+  const size_t HASH_BATCH_MAX_SIZE = 64 * 1024;
+
+  // Hash many buffers at once, the ids in the order of contents. Under
+  // SHA-256, small buffers go through the multi-buffer code of
+  // sha256_multi.hpp when the CPU has a lane width that beats hashing them
+  // one by one: AVX-512 always, AVX2 only without the SHA extensions. The
+  // hash.multibuffer config picks the code path, anything unavailable falls
+  // back to a Hasher per buffer, as does BLAKE3.
+  std::vector<ObjectId> HashBatch(const std::vector<std::vector<uint8_t>> &contents,
+                                  HashAlgorithm algorithm = GetHashAlgorithm());
+
+  // How HashBatch has hashed its buffers, for MICROGIT_STATS
+  struct HashBatchStats
+  {
+    const char *engine; // "avx512", "avx2" or "off"
+    size_t laned = 0;   // buffers hashed in SIMD lanes
+    size_t single = 0;  // buffers hashed one at a time
+  };
+
+  HashBatchStats GetHashBatchStats();
+
+  // Print the HashBatch counters (shown when MICROGIT_STATS is set)
+  void PrintHashBatchStats(std::ostream &out);
+}
@@ -0,0 +1,342 @@
+#include "index.hpp"
+#include "main.hpp"
+#include "hasher.hpp"
+#include "tree.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace utils
+{
+  namespace
+  {
+    const char INDEX_FILE_MAGIC[4] = {'M', 'G', 'I', 'N'};
+    const size_t INDEX_FILE_HEADER_SIZE = 16;
+    const size_t INDEX_CHECKSUM_SIZE = OBJECT_ID_SIZE;
+
+    uint32_t ReadU32(const uint8_t *p)
+    {
+      return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+             static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+    }
+
+    uint64_t ReadU64(const uint8_t *p)
+    {
+      return static_cast<uint64_t>(ReadU32(p)) | static_cast<uint64_t>(ReadU32(p + 4)) << 32;
+    }
+
+    void PutU32(std::vector<uint8_t> &out, uint32_t value)
+    {
+      for (int i = 0; i < 4; i++)
+      {
+        out.push_back(static_cast<uint8_t>((value >> (8 * i)) & 0xff));
+      }
+    }
+
+    void PutU64(std::vector<uint8_t> &out, uint64_t value)
+    {
+      PutU32(out, static_cast<uint32_t>(value));
+      PutU32(out, static_cast<uint32_t>(value >> 32));
+    }
+
+    std::string IndexPath()
+    {
+      return DEFAULT_PATH + "/index";
+    }
+
+    int64_t Nanoseconds(const struct timespec &time)
+    {
+      return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+    }
+
+    // The checksum of a serialized index, always SHA-256 so it does not
+    // depend on the repository's object hash
+    ObjectId Checksum(const uint8_t *data, size_t size)
+    {
+      Hasher hasher(HashAlgorithm::Sha256);
+      hasher.Update(data, size);
+      return hasher.Finish();
+    }
+  }
+
+  bool StatFile(const std::string &path, IndexStat &stat)
+  {
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0)
+    {
+      return false;
+    }
+    stat.mtimeNs = Nanoseconds(info.st_mtim);
+    stat.ctimeNs = Nanoseconds(info.st_ctim);
+    stat.inode = static_cast<uint64_t>(info.st_ino);
+    stat.size = static_cast<uint64_t>(info.st_size);
+    stat.mode = static_cast<uint32_t>(info.st_mode);
+    return true;
+  }
+
+  Index::~Index()
+  {
+    Unmap();
+  }
+
+  void Index::Unmap()
+  {
+    if (data)
+    {
+      munmap(const_cast<uint8_t *>(data), size);
+    }
+    data = nullptr;
+    size = 0;
+    count = 0;
+  }
+
+  bool Index::Load()
+  {
+    Unmap();
+    changes.clear();
+    removed.clear();
+    cleared = false;
+    loadedMtimeNs = 0;
+
+    int fd = open(IndexPath().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      return true;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+      close(fd);
+      return false;
+    }
+    loadedMtimeNs = Nanoseconds(info.st_mtim);
+    size_t fileSize = static_cast<size_t>(info.st_size);
+
+    // Text indexes start with a path, never with the magic
+    uint8_t magic[4] = {0, 0, 0, 0};
+    bool binary = fileSize >= sizeof(magic) && pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+                  std::memcmp(magic, INDEX_FILE_MAGIC, sizeof(magic)) == 0;
+    if (!binary)
+    {
+      close(fd);
+      std::ifstream file(IndexPath());
+      std::string line;
+      while (std::getline(file, line))
+      {
+        size_t space = line.rfind(' ');
+        IndexEntry entry;
+        if (space != std::string::npos &&
+            ObjectId::FromHex(line.data() + space + 1, line.size() - space - 1, entry.hash))
+        {
+          entry.path = TreePath(line.substr(0, space));
+          if (!entry.path.empty())
+          {
+            changes[entry.path] = entry;
+          }
+        }
+      }
+      return true;
+    }
+
+    void *mapped = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+      return false;
+    }
+    data = static_cast<const uint8_t *>(mapped);
+    size = fileSize;
+
+    // Check the layout and every path before trusting any of it
+    bool valid = size >= INDEX_FILE_HEADER_SIZE + INDEX_CHECKSUM_SIZE && ReadU32(data + 4) == INDEX_VERSION;
+    if (valid)
+    {
+      count = ReadU32(data + 8);
+      size_t pathsStart = INDEX_FILE_HEADER_SIZE + static_cast<size_t>(count) * INDEX_ENTRY_SIZE;
+      size_t pathsEnd = size - INDEX_CHECKSUM_SIZE;
+      valid = pathsStart <= pathsEnd;
+      for (uint32_t i = 0; valid && i < count; i++)
+      {
+        const uint8_t *entry = data + INDEX_FILE_HEADER_SIZE + static_cast<size_t>(i) * INDEX_ENTRY_SIZE;
+        uint64_t offset = ReadU32(entry);
+        uint64_t length = ReadU32(entry + 4);
+        valid = offset >= pathsStart && offset + length <= pathsEnd;
+      }
+      valid = valid && Checksum(data, pathsEnd) == ObjectId(data + pathsEnd);
+    }
+    if (!valid)
+    {
+      Unmap();
+      return false;
+    }
+    return true;
+  }
+
+  IndexEntry Index::EntryAt(uint32_t i) const
+  {
+    const uint8_t *p = data + INDEX_FILE_HEADER_SIZE + static_cast<size_t>(i) * INDEX_ENTRY_SIZE;
+    IndexEntry entry;
+    entry.path.assign(reinterpret_cast<const char *>(data + ReadU32(p)), ReadU32(p + 4));
+    entry.hash = ObjectId(p + 8);
+    entry.stat.mtimeNs = static_cast<int64_t>(ReadU64(p + 40));
+    entry.stat.ctimeNs = static_cast<int64_t>(ReadU64(p + 48));
+    entry.stat.inode = ReadU64(p + 56);
+    entry.stat.size = ReadU64(p + 64);
+    entry.stat.mode = ReadU32(p + 72);
+    return entry;
+  }
+
+  bool Index::Find(const std::string &path, IndexEntry &entry) const
+  {
+    auto changed = changes.find(path);
+    if (changed != changes.end())
+    {
+      entry = changed->second;
+      return true;
+    }
+    if (cleared || removed.count(path))
+    {
+      return false;
+    }
+
+    // Binary search the mapped entries, which are sorted by path bytes
+    uint32_t low = 0, high = count;
+    while (low < high)
+    {
+      uint32_t mid = low + (high - low) / 2;
+      const uint8_t *p = data + INDEX_FILE_HEADER_SIZE + static_cast<size_t>(mid) * INDEX_ENTRY_SIZE;
+      size_t length = ReadU32(p + 4);
+      int cmp = std::memcmp(data + ReadU32(p), path.data(), std::min(length, path.size()));
+      if (cmp == 0)
+      {
+        cmp = length < path.size() ? -1 : (length > path.size() ? 1 : 0);
+      }
+      if (cmp == 0)
+      {
+        entry = EntryAt(mid);
+        return true;
+      }
+      if (cmp < 0)
+      {
+        low = mid + 1;
+      }
+      else
+      {
+        high = mid;
+      }
+    }
+    return false;
+  }
+
+  bool Index::IsUnchanged(const IndexEntry &entry, const IndexStat &current) const
+  {
+    return entry.stat == current && entry.stat.mtimeNs < loadedMtimeNs;
+  }
+
+  void Index::Set(const IndexEntry &entry)
+  {
+    removed.erase(entry.path);
+    changes[entry.path] = entry;
+  }
+
+  void Index::Remove(const std::string &path)
+  {
+    changes.erase(path);
+    removed.insert(path);
+  }
+
+  void Index::Clear()
+  {
+    changes.clear();
+    removed.clear();
+    cleared = true;
+  }
+
+  std::vector<IndexEntry> Index::Entries() const
+  {
+    // Merge the mapped entries with the changes, both in path order
+    std::vector<IndexEntry> entries;
+    auto changed = changes.begin();
+    uint32_t mappedCount = cleared ? 0 : count;
+    for (uint32_t i = 0; i < mappedCount; i++)
+    {
+      IndexEntry entry = EntryAt(i);
+      while (changed != changes.end() && changed->first < entry.path)
+      {
+        entries.push_back(changed->second);
+        ++changed;
+      }
+      if (changed != changes.end() && changed->first == entry.path)
+      {
+        entries.push_back(changed->second);
+        ++changed;
+      }
+      else if (!removed.count(entry.path))
+      {
+        entries.push_back(std::move(entry));
+      }
+    }
+    for (; changed != changes.end(); ++changed)
+    {
+      entries.push_back(changed->second);
+    }
+    return entries;
+  }
+
+  std::vector<uint8_t> Index::Serialize() const
+  {
+    std::vector<IndexEntry> entries = Entries();
+    size_t pathsStart = INDEX_FILE_HEADER_SIZE + entries.size() * INDEX_ENTRY_SIZE;
+
+    std::vector<uint8_t> out(INDEX_FILE_MAGIC, INDEX_FILE_MAGIC + sizeof(INDEX_FILE_MAGIC));
+    PutU32(out, INDEX_VERSION);
+    PutU32(out, static_cast<uint32_t>(entries.size()));
+    PutU32(out, 0);
+
+    size_t offset = pathsStart;
+    for (const auto &entry : entries)
+    {
+      PutU32(out, static_cast<uint32_t>(offset));
+      PutU32(out, static_cast<uint32_t>(entry.path.size()));
+      out.insert(out.end(), entry.hash.bytes.begin(), entry.hash.bytes.end());
+      PutU64(out, static_cast<uint64_t>(entry.stat.mtimeNs));
+      PutU64(out, static_cast<uint64_t>(entry.stat.ctimeNs));
+      PutU64(out, entry.stat.inode);
+      PutU64(out, entry.stat.size);
+      PutU32(out, entry.stat.mode);
+      PutU32(out, 0);
+      offset += entry.path.size();
+    }
+    for (const auto &entry : entries)
+    {
+      out.insert(out.end(), entry.path.begin(), entry.path.end());
+    }
+
+    ObjectId checksum = Checksum(out.data(), out.size());
+    out.insert(out.end(), checksum.bytes.begin(), checksum.bytes.end());
+    return out;
+  }
+
+  bool Index::Write() const
+  {
+    std::vector<uint8_t> content = Serialize();
+    std::string tempPath = IndexPath() + ".tmp";
+    {
+      std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+      if (!file || !file.write(reinterpret_cast<const char *>(content.data()), content.size()) || !file.flush())
+      {
+        return false;
+      }
+    }
+    std::error_code ec;
+    fs::rename(tempPath, IndexPath(), ec);
+    return !ec;
+  }
+}
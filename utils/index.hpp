@@ -0,0 +1,113 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "object_id.hpp"
+
+namespace utils
+{
+  // The index records, for every path add has seen, the object its content
+  // was stored as and the file's stat data at the time. A file whose stat
+  // data still matches is known to hold that object without being read.
+  //
+  // .microgit/index: "MGIN" | version u32 | count u32 | reserved u32, then
+  //   count entries sorted by path, each INDEX_ENTRY_SIZE bytes:
+  //   path offset u32 | path length u32 | object id (32 bytes) |
+  //   mtime ns u64 | ctime ns u64 | inode u64 | size u64 | mode u32 | reserved u32
+  //   then the path table the offsets point into, then the SHA-256 of
+  //   everything before it. All integers are little-endian.
+  //
+  // Older repositories have a text index of "path hash" lines, which is read
+  // as well and replaced by the binary format the next time it is written.
+
+  const uint32_t INDEX_VERSION = 1;
+  const size_t INDEX_ENTRY_SIZE = 80;
+
+  // Stat data kept with an entry
+  struct IndexStat
+  {
+    int64_t mtimeNs = 0;
+    int64_t ctimeNs = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    uint32_t mode = 0;
+
+    bool operator==(const IndexStat &other) const
+    {
+      return mtimeNs == other.mtimeNs && ctimeNs == other.ctimeNs && inode == other.inode &&
+             size == other.size && mode == other.mode;
+    }
+  };
+
+  // Stat data of the file at path, following symbolic links. False if the
+  // file cannot be stat'ed.
+  bool StatFile(const std::string &path, IndexStat &stat);
+
+  struct IndexEntry
+  {
+    std::string path; // repository path, see TreePath
+    ObjectId hash;
+    IndexStat stat;
+  };
+
+  // The index as loaded, with changes kept in memory until Write. Lookups
+  // binary search the mapped file, so loading does not parse the entries.
+  class Index
+  {
+  public:
+    Index() = default;
+    ~Index();
+
+    Index(const Index &) = delete;
+    Index &operator=(const Index &) = delete;
+
+    // Map the index file. A missing file is an empty index. False, leaving
+    // the index empty, if the file is damaged: wrong magic or version,
+    // entries outside the file or a checksum that does not match.
+    bool Load();
+
+    // The entry of a repository path, false if there is none
+    bool Find(const std::string &path, IndexEntry &entry) const;
+
+    // Whether a file with stat data current is known to still hold the
+    // entry's object. Files changed within the timestamp granularity of the
+    // index write could look the same, so entries not older than the loaded
+    // index never count as unchanged.
+    bool IsUnchanged(const IndexEntry &entry, const IndexStat &current) const;
+
+    void Set(const IndexEntry &entry);
+    void Remove(const std::string &path);
+
+    // Remove every entry
+    void Clear();
+
+    // Every entry in path order, changes included
+    std::vector<IndexEntry> Entries() const;
+
+    // The file Write produces
+    std::vector<uint8_t> Serialize() const;
+
+    // Write the index through a temp file renamed over the old one, so
+    // readers see either the old or the new index
+    bool Write() const;
+
+  private:
+    void Unmap();
+    IndexEntry EntryAt(uint32_t i) const;
+
+    const uint8_t *data = nullptr; // mapped binary index
+    size_t size = 0;
+    uint32_t count = 0;
+    int64_t loadedMtimeNs = 0;
+
+    // Entries added or replaced and paths removed since Load. Once cleared
+    // the mapped entries are ignored.
+    std::map<std::string, IndexEntry> changes;
+    std::set<std::string> removed;
+    bool cleared = false;
+  };
+}
@@ -0,0 +1,682 @@
+#include "io_engine.hpp"
+#include "config.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <mutex>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef MICROGIT_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cstring>
+#endif
+
+namespace utils
+{
+  namespace
+  {
+    // Largest single read or write, the kernel caps transfers below 2 GiB
+    const size_t MAX_TRANSFER = 1u << 30;
+
+    bool ReadFileBlocking(FileRead &request)
+    {
+      int fd = open(request.path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+      {
+        return false;
+      }
+
+      struct stat info;
+      bool ok = fstat(fd, &info) == 0;
+      if (ok)
+      {
+        request.data.resize(static_cast<size_t>(info.st_size));
+        size_t done = 0;
+        while (done < request.data.size())
+        {
+          ssize_t got = read(fd, request.data.data() + done, std::min(request.data.size() - done, MAX_TRANSFER));
+          if (got < 0 && errno == EINTR)
+          {
+            continue;
+          }
+          if (got <= 0)
+          {
+            // Error, or the file shrank while we read it
+            ok = got == 0;
+            request.data.resize(done);
+            break;
+          }
+          done += static_cast<size_t>(got);
+        }
+      }
+      close(fd);
+      return ok;
+    }
+
+    bool WriteFileBlocking(const FileWrite &request)
+    {
+      int fd = open(request.path.c_str(), request.flags | O_CLOEXEC, request.mode);
+      if (fd < 0)
+      {
+        return false;
+      }
+
+      bool ok = true;
+      size_t done = 0;
+      while (ok && done < request.size)
+      {
+        ssize_t written = write(fd, request.data + done, std::min(request.size - done, MAX_TRANSFER));
+        if (written < 0 && errno == EINTR)
+        {
+          continue;
+        }
+        ok = written > 0;
+        done += ok ? static_cast<size_t>(written) : 0;
+      }
+      if (ok && request.sync)
+      {
+        ok = fsync(fd) == 0;
+      }
+      return close(fd) == 0 && ok;
+    }
+
+#ifdef MICROGIT_HAVE_IO_URING
+    // One io_uring instance driven through the raw system calls. A ring is
+    // used by one thread at a time, so its queues need no locking.
+    class Ring
+    {
+    public:
+      explicit Ring(unsigned depth) : depth(depth) {}
+
+      ~Ring()
+      {
+        if (sqes)
+        {
+          munmap(sqes, sqesSize);
+        }
+        if (cqRing && cqRing != sqRing)
+        {
+          munmap(cqRing, cqRingSize);
+        }
+        if (sqRing)
+        {
+          munmap(sqRing, sqRingSize);
+        }
+        if (ringFd >= 0)
+        {
+          close(ringFd);
+        }
+      }
+
+      // False when the kernel lacks io_uring or the needed opcodes
+      bool Setup()
+      {
+        io_uring_params params = {};
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (ringFd < 0)
+        {
+          return false;
+        }
+
+        // OPENAT, STATX, READ, WRITE and CLOSE arrived together with this feature (5.6)
+        if (!(params.features & IORING_FEAT_RW_CUR_POS))
+        {
+          return false;
+        }
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+        {
+          sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+        {
+          sqRing = nullptr;
+          return false;
+        }
+        cqRing = single ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+        {
+          cqRing = nullptr;
+          return false;
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqesMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (sqesMap == MAP_FAILED)
+        {
+          return false;
+        }
+        sqes = static_cast<io_uring_sqe *>(sqesMap);
+
+        char *sq = static_cast<char *>(sqRing);
+        char *cq = static_cast<char *>(cqRing);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        depth = params.sq_entries;
+        return true;
+      }
+
+      bool Broken() const { return broken; }
+
+      // Submit ops with at most depth in flight and wait for all of them.
+      // Result i is the completion result of ops[i] (a negative errno on failure).
+      std::vector<int> Run(std::vector<io_uring_sqe> &ops)
+      {
+        std::vector<int> results(ops.size(), -ECANCELED);
+        if (broken)
+        {
+          for (size_t i = 0; i < ops.size(); i++)
+          {
+            results[i] = RunBlocking(ops[i]);
+          }
+          return results;
+        }
+
+        size_t next = 0, completed = 0, inFlight = 0;
+        unsigned unsubmitted = 0;
+
+        while (completed < ops.size())
+        {
+          // Only this thread produces, the kernel consumes up to our tail
+          unsigned tail = *sqTail;
+          while (next < ops.size() && inFlight < depth)
+          {
+            unsigned slot = tail & sqMask;
+            sqes[slot] = ops[next];
+            sqes[slot].user_data = next;
+            sqArray[slot] = slot;
+            tail++;
+            next++;
+            inFlight++;
+            unsubmitted++;
+          }
+          __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+          int entered = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+          if (entered < 0)
+          {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            {
+              continue;
+            }
+            // The ring is unusable. Take back what the kernel has not seen and
+            // wait for everything it has, as an op left in flight could still
+            // write into a caller's buffer after we return. Only then run the
+            // rest as plain system calls.
+            broken = true;
+            __atomic_store_n(sqTail, tail - unsubmitted, __ATOMIC_RELEASE);
+            next -= unsubmitted;
+            inFlight -= unsubmitted;
+            Drain(results, inFlight, completed);
+            for (; next < ops.size(); next++)
+            {
+              results[next] = RunBlocking(ops[next]);
+            }
+            break;
+          }
+          unsubmitted -= std::min(unsubmitted, static_cast<unsigned>(entered));
+          Reap(results, inFlight, completed);
+        }
+        return results;
+      }
+
+    private:
+      // Take every completion off the queue
+      void Reap(std::vector<int> &results, size_t &inFlight, size_t &completed)
+      {
+        unsigned head = *cqHead;
+        unsigned cqTailNow = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != cqTailNow)
+        {
+          const io_uring_cqe &cqe = cqes[head & cqMask];
+          results[cqe.user_data] = cqe.res;
+          head++;
+          inFlight--;
+          completed++;
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+      }
+
+      // Wait until no op is in flight. The kernel posts completions to the
+      // shared queue whether or not io_uring_enter works, so when waiting
+      // through it fails the queue is polled instead.
+      void Drain(std::vector<int> &results, size_t &inFlight, size_t &completed)
+      {
+        Reap(results, inFlight, completed);
+        while (inFlight > 0)
+        {
+          if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+          {
+            usleep(1000);
+          }
+          Reap(results, inFlight, completed);
+        }
+      }
+
+      // The system call an operation stands for, with the result in the
+      // form a completion would carry it
+      static int RunBlocking(const io_uring_sqe &op)
+      {
+        long result = -1;
+        switch (op.opcode)
+        {
+        case IORING_OP_OPENAT:
+          result = openat(op.fd, reinterpret_cast<const char *>(op.addr), static_cast<int>(op.open_flags),
+                          static_cast<mode_t>(op.len));
+          break;
+        case IORING_OP_STATX:
+          result = statx(op.fd, reinterpret_cast<const char *>(op.addr), static_cast<int>(op.statx_flags), op.len,
+                         reinterpret_cast<struct statx *>(op.off));
+          break;
+        case IORING_OP_READ:
+          result = pread(op.fd, reinterpret_cast<void *>(op.addr), op.len, static_cast<off_t>(op.off));
+          break;
+        case IORING_OP_WRITE:
+          result = pwrite(op.fd, reinterpret_cast<const void *>(op.addr), op.len, static_cast<off_t>(op.off));
+          break;
+        case IORING_OP_FSYNC:
+          result = fsync(op.fd);
+          break;
+        case IORING_OP_CLOSE:
+          result = close(op.fd);
+          break;
+        default:
+          errno = EINVAL;
+          break;
+        }
+        return result < 0 ? -errno : static_cast<int>(result);
+      }
+
+      unsigned depth;
+      int ringFd = -1;
+      void *sqRing = nullptr;
+      void *cqRing = nullptr;
+      size_t sqRingSize = 0;
+      size_t cqRingSize = 0;
+      size_t sqesSize = 0;
+      io_uring_sqe *sqes = nullptr;
+      unsigned *sqTail = nullptr;
+      unsigned *sqArray = nullptr;
+      unsigned sqMask = 0;
+      unsigned *cqHead = nullptr;
+      unsigned *cqTail = nullptr;
+      unsigned cqMask = 0;
+      io_uring_cqe *cqes = nullptr;
+      bool broken = false; // after a fatal io_uring_enter error, ops use blocking calls
+    };
+
+    // Batches run in phases (open, size, transfer, sync, close) so every
+    // phase can keep the queue full. Each batch takes a ring of its own, so
+    // batches from different threads never wait for each other's I/O.
+    class UringIoEngine : public IoEngine
+    {
+    public:
+      // Returns nullptr when the kernel lacks io_uring or the needed opcodes
+      static std::unique_ptr<UringIoEngine> Create(unsigned depth)
+      {
+        std::unique_ptr<UringIoEngine> engine(new UringIoEngine(depth));
+        std::unique_ptr<Ring> ring = engine->Acquire();
+        if (!ring)
+        {
+          return nullptr;
+        }
+        engine->Release(std::move(ring));
+        return engine;
+      }
+
+      const char *Name() const override { return "io_uring"; }
+
+      void Read(std::vector<FileRead> &reads) override
+      {
+        std::unique_ptr<Ring> ring = Acquire();
+        if (!ring)
+        {
+          ParallelFor(reads.size(), depth, [&](size_t i)
+                      { reads[i].ok = ReadFileBlocking(reads[i]); });
+          Count(reads.size());
+          return;
+        }
+
+        size_t count = reads.size();
+        std::vector<struct statx> sizes(count);
+
+        // Open every file, then size what was opened through its descriptor
+        // so a file replaced in between is never read at the other's size
+        std::vector<io_uring_sqe> ops;
+        for (size_t i = 0; i < count; i++)
+        {
+          ops.push_back(OpenOp(reads[i].path, O_RDONLY | O_CLOEXEC, 0));
+        }
+        std::vector<int> fds = ring->Run(ops);
+
+        ops.clear();
+        std::vector<size_t> opened;
+        for (size_t i = 0; i < count; i++)
+        {
+          if (fds[i] >= 0)
+          {
+            ops.push_back(StatxOp(fds[i], &sizes[i]));
+            opened.push_back(i);
+          }
+        }
+        std::vector<int> results = ring->Run(ops);
+
+        std::vector<size_t> done(count, 0);
+        std::vector<size_t> active;
+        for (size_t j = 0; j < opened.size(); j++)
+        {
+          size_t i = opened[j];
+          if (results[j] == 0)
+          {
+            reads[i].data.resize(static_cast<size_t>(sizes[i].stx_size));
+            reads[i].ok = true;
+            active.push_back(i);
+          }
+        }
+
+        // Read until every file is complete, short reads are resubmitted
+        while (!active.empty())
+        {
+          ops.clear();
+          std::vector<size_t> pending;
+          for (size_t i : active)
+          {
+            if (done[i] < reads[i].data.size())
+            {
+              ops.push_back(TransferOp(IORING_OP_READ, fds[i], reads[i].data.data() + done[i],
+                                       reads[i].data.size() - done[i], done[i]));
+              pending.push_back(i);
+            }
+          }
+          results = ring->Run(ops);
+
+          active.clear();
+          for (size_t j = 0; j < pending.size(); j++)
+          {
+            size_t i = pending[j];
+            if (results[j] > 0)
+            {
+              done[i] += static_cast<size_t>(results[j]);
+              active.push_back(i);
+            }
+            else
+            {
+              // The file shrank while we read it (0) or the read failed
+              reads[i].ok = results[j] == 0;
+              reads[i].data.resize(done[i]);
+            }
+          }
+        }
+
+        CloseAll(*ring, fds);
+        Release(std::move(ring));
+        Count(count);
+      }
+
+      void Write(std::vector<FileWrite> &writes) override
+      {
+        std::unique_ptr<Ring> ring = Acquire();
+        if (!ring)
+        {
+          ParallelFor(writes.size(), depth, [&](size_t i)
+                      { writes[i].ok = WriteFileBlocking(writes[i]); });
+          Count(writes.size());
+          return;
+        }
+
+        size_t count = writes.size();
+        std::vector<io_uring_sqe> ops;
+        for (const auto &request : writes)
+        {
+          ops.push_back(OpenOp(request.path, request.flags | O_CLOEXEC, request.mode));
+        }
+        std::vector<int> fds = ring->Run(ops);
+
+        std::vector<size_t> done(count, 0);
+        std::vector<size_t> active;
+        for (size_t i = 0; i < count; i++)
+        {
+          writes[i].ok = fds[i] >= 0;
+          if (writes[i].ok)
+          {
+            active.push_back(i);
+          }
+        }
+
+        while (!active.empty())
+        {
+          ops.clear();
+          std::vector<size_t> pending;
+          for (size_t i : active)
+          {
+            if (done[i] < writes[i].size)
+            {
+              ops.push_back(TransferOp(IORING_OP_WRITE, fds[i], const_cast<uint8_t *>(writes[i].data) + done[i],
+                                       writes[i].size - done[i], done[i]));
+              pending.push_back(i);
+            }
+          }
+          std::vector<int> results = ring->Run(ops);
+
+          active.clear();
+          for (size_t j = 0; j < pending.size(); j++)
+          {
+            size_t i = pending[j];
+            if (results[j] > 0)
+            {
+              done[i] += static_cast<size_t>(results[j]);
+              active.push_back(i);
+            }
+            else
+            {
+              writes[i].ok = false;
+            }
+          }
+        }
+
+        ops.clear();
+        std::vector<size_t> syncing;
+        for (size_t i = 0; i < count; i++)
+        {
+          if (writes[i].ok && writes[i].sync)
+          {
+            io_uring_sqe op = {};
+            op.opcode = IORING_OP_FSYNC;
+            op.fd = fds[i];
+            ops.push_back(op);
+            syncing.push_back(i);
+          }
+        }
+        std::vector<int> results = ring->Run(ops);
+        for (size_t j = 0; j < syncing.size(); j++)
+        {
+          writes[syncing[j]].ok = results[j] == 0;
+        }
+
+        results = CloseAll(*ring, fds);
+        for (size_t i = 0; i < count; i++)
+        {
+          writes[i].ok = writes[i].ok && results[i] == 0;
+        }
+        Release(std::move(ring));
+        Count(count);
+      }
+
+    private:
+      explicit UringIoEngine(unsigned depth) : depth(depth) {}
+
+      // An idle ring, or a new one when every ring is busy. Returns nullptr
+      // once a ring broke or when no ring can be set up, and the batch then
+      // uses blocking calls.
+      std::unique_ptr<Ring> Acquire()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (broken)
+          {
+            return nullptr;
+          }
+          if (!idle.empty())
+          {
+            std::unique_ptr<Ring> ring = std::move(idle.back());
+            idle.pop_back();
+            return ring;
+          }
+        }
+        auto ring = std::make_unique<Ring>(depth);
+        return ring->Setup() ? std::move(ring) : nullptr;
+      }
+
+      // Keep a ring for the next batch, unless it broke
+      void Release(std::unique_ptr<Ring> ring)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ring->Broken())
+        {
+          broken = true;
+          return;
+        }
+        idle.push_back(std::move(ring));
+      }
+
+      static io_uring_sqe OpenOp(const std::string &path, int flags, mode_t mode)
+      {
+        io_uring_sqe op = {};
+        op.opcode = IORING_OP_OPENAT;
+        op.fd = AT_FDCWD;
+        op.addr = reinterpret_cast<uintptr_t>(path.c_str());
+        op.len = mode;
+        op.open_flags = static_cast<uint32_t>(flags);
+        return op;
+      }
+
+      static io_uring_sqe StatxOp(int fd, struct statx *buffer)
+      {
+        io_uring_sqe op = {};
+        op.opcode = IORING_OP_STATX;
+        op.fd = fd;
+        op.addr = reinterpret_cast<uintptr_t>("");
+        op.len = STATX_SIZE;
+        op.off = reinterpret_cast<uintptr_t>(buffer);
+        op.statx_flags = AT_EMPTY_PATH;
+        return op;
+      }
+
+      static io_uring_sqe TransferOp(uint8_t opcode, int fd, uint8_t *buffer, size_t size, size_t offset)
+      {
+        io_uring_sqe op = {};
+        op.opcode = opcode;
+        op.fd = fd;
+        op.addr = reinterpret_cast<uintptr_t>(buffer);
+        op.len = static_cast<uint32_t>(std::min(size, MAX_TRANSFER));
+        op.off = offset;
+        return op;
+      }
+
+      static std::vector<int> CloseAll(Ring &ring, const std::vector<int> &fds)
+      {
+        std::vector<io_uring_sqe> ops;
+        std::vector<size_t> open;
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+          if (fds[i] >= 0)
+          {
+            io_uring_sqe op = {};
+            op.opcode = IORING_OP_CLOSE;
+            op.fd = fds[i];
+            ops.push_back(op);
+            open.push_back(i);
+          }
+        }
+
+        std::vector<int> results(fds.size(), -EBADF);
+        std::vector<int> closed = ring.Run(ops);
+        for (size_t j = 0; j < open.size(); j++)
+        {
+          results[open[j]] = closed[j];
+        }
+        return results;
+      }
+
+      unsigned depth;
+      std::mutex mutex; // guards idle and broken
+      std::vector<std::unique_ptr<Ring>> idle;
+      bool broken = false; // a ring failed, every batch uses blocking calls
+    };
+#endif
+
+    // Set once GetIoEngine has created the engine
+    std::atomic<IoEngine *> createdEngine{nullptr};
+
+    std::unique_ptr<IoEngine> CreateIoEngine()
+    {
+      std::string name = GetConfig("io.engine", "auto");
+      int depth = GetConfigInt("io.queuedepth", DEFAULT_IO_QUEUE_DEPTH);
+      depth = std::max(1, std::min(depth, 4096));
+
+#ifdef MICROGIT_HAVE_IO_URING
+      if (name != "threads")
+      {
+        std::unique_ptr<IoEngine> engine = UringIoEngine::Create(static_cast<unsigned>(depth));
+        if (engine)
+        {
+          return engine;
+        }
+      }
+#endif
+
+      // Blocking calls: one thread per operation in flight
+      return std::make_unique<ThreadPoolIoEngine>(static_cast<size_t>(depth));
+    }
+  }
+
+  ThreadPoolIoEngine::ThreadPoolIoEngine(size_t workers) : workers(workers) {}
+
+  void ThreadPoolIoEngine::Read(std::vector<FileRead> &reads)
+  {
+    ParallelFor(reads.size(), workers, [&](size_t i)
+                { reads[i].ok = ReadFileBlocking(reads[i]); });
+    Count(reads.size());
+  }
+
+  void ThreadPoolIoEngine::Write(std::vector<FileWrite> &writes)
+  {
+    ParallelFor(writes.size(), workers, [&](size_t i)
+                { writes[i].ok = WriteFileBlocking(writes[i]); });
+    Count(writes.size());
+  }
+
+  IoEngine &GetIoEngine()
+  {
+    static std::unique_ptr<IoEngine> engine = CreateIoEngine();
+    createdEngine = engine.get();
+    return *engine;
+  }
+
+  void PrintIoStats(std::ostream &out)
+  {
+    IoEngine *engine = createdEngine;
+    if (!engine)
+    {
+      out << "I/O engine: not used" << std::endl;
+      return;
+    }
+    IoStats io = engine->Stats();
+    out << "I/O engine: " << engine->Name() << ", " << io.operations << " file(s) in " << io.batches << " batch(es)"
+        << std::endl;
+  }
+}
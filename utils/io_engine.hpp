@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/types.h>
+
+namespace utils
+{
+  // Batched file I/O for commands that touch many files at once. A whole
+  // batch is handed to the engine, which keeps up to io.queuedepth operations
+  // in flight: through io_uring where the kernel supports it, otherwise on a
+  // pool of threads doing ordinary blocking calls.
+
+  // Operations kept in flight when no io.queuedepth setting exists
+  const int DEFAULT_IO_QUEUE_DEPTH = 32;
+
+  // Read a whole file
+  struct FileRead
+  {
+    std::string path;
+    std::vector<uint8_t> data;
+    bool ok = false;
+  };
+
+  // Write a file from a caller-owned buffer
+  struct FileWrite
+  {
+    std::string path;
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    mode_t mode = 0644;
+    bool sync = false; // fsync before closing
+    bool ok = false;
+  };
+
+  struct IoStats
+  {
+    size_t batches = 0;
+    size_t operations = 0; // files read or written
+  };
+
+  class IoEngine
+  {
+  public:
+    virtual ~IoEngine() = default;
+
+    // Perform every request, setting ok on each one that succeeded
+    virtual void Read(std::vector<FileRead> &reads) = 0;
+    virtual void Write(std::vector<FileWrite> &writes) = 0;
+
+    virtual const char *Name() const = 0;
+
+    IoStats Stats() const { return {batches, operations}; }
+
+  protected:
+    // Engines may be called from several threads at once
+    void Count(size_t files)
+    {
+      batches++;
+      operations += files;
+    }
+
+  private:
+    std::atomic<size_t> batches{0};
+    std::atomic<size_t> operations{0};
+  };
+
+  // Runs requests on a pool of threads, one blocking call sequence per file
+  class ThreadPoolIoEngine : public IoEngine
+  {
+  public:
+    explicit ThreadPoolIoEngine(size_t workers);
+
+    void Read(std::vector<FileRead> &reads) override;
+    void Write(std::vector<FileWrite> &writes) override;
+    const char *Name() const override { return "threads"; }
+
+  private:
+    size_t workers;
+  };
+
+  // The engine selected by io.engine: "auto" (io_uring when available),
+  // "io_uring" or "threads"
+  IoEngine &GetIoEngine();
+
+  // Print the engine's counters (shown when MICROGIT_STATS is set), without
+  // creating an engine when nothing used one
+  void PrintIoStats(std::ostream &out);
+}
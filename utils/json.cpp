@@ -9,14 +9,49 @@ namespace utils
 {
   class JSONImpl
   {
+    // Ids are hex strings in JSON, an empty string is the null id
+    static ObjectId IdFromJson(const json &value)
+    {
+      std::string hex = value.get<std::string>();
+      ObjectId id;
+      if (!hex.empty() && !ObjectId::FromHex(hex, id))
+      {
+        throw std::runtime_error("invalid object id '" + hex + "'");
+      }
+      return id;
+    }
+
+    static std::map<std::string, ObjectId> FilesFromJson(const json &value)
+    {
+      std::map<std::string, ObjectId> files;
+      for (const auto &[path, hash] : value.get<std::map<std::string, std::string>>())
+      {
+        files[path] = IdFromJson(hash);
+      }
+      return files;
+    }
+
   public:
     static std::string Stringify(const SavePoint &savePoint)
     {
       json j;
       j["message"] = savePoint.message;
       j["timestamp"] = savePoint.timestamp;
-      j["parent"] = savePoint.parent;
-      j["files"] = savePoint.files;
+      j["parent"] = savePoint.parent.Hex();
+      if (savePoint.tree.IsNull())
+      {
+        std::map<std::string, std::string> files;
+        for (const auto &[path, hash] : savePoint.files)
+        {
+          files[path] = hash.Hex();
+        }
+        j["files"] = files;
+      }
+      else
+      {
+        // Files live in the tree, the SavePoint stays the same size however many there are
+        j["tree"] = savePoint.tree.Hex();
+      }
 
       return j.dump(2); // Pretty print with 2-space indentation
     }
@@ -30,8 +65,15 @@ namespace utils
         SavePoint savePoint;
         savePoint.message = j["message"];
         savePoint.timestamp = j["timestamp"];
-        savePoint.parent = j["parent"];
-        savePoint.files = j["files"].get<std::map<std::string, std::string>>();
+        savePoint.parent = IdFromJson(j["parent"]);
+        if (j.contains("tree"))
+        {
+          savePoint.tree = IdFromJson(j["tree"]);
+        }
+        else
+        {
+          savePoint.files = FilesFromJson(j["files"]);
+        }
 
         return savePoint;
       }
@@ -57,8 +99,15 @@ namespace utils
         SavePoint savePoint;
         savePoint.message = j["message"];
         savePoint.timestamp = j["timestamp"];
-        savePoint.parent = j["parent"];
-        savePoint.files = j["files"].get<std::map<std::string, std::string>>();
+        savePoint.parent = IdFromJson(j["parent"]);
+        if (j.contains("tree"))
+        {
+          savePoint.tree = IdFromJson(j["tree"]);
+        }
+        else
+        {
+          savePoint.files = FilesFromJson(j["files"]);
+        }
 
         return savePoint;
       }
@@ -1,53 +1,43 @@
 #include "main.hpp"
-#include <iomanip>
-#include <sstream>
+#include "config.hpp"
+#include "hasher.hpp"
 #include <fstream>
 #include <filesystem>
-#include <openssl/sha.h>
 
 namespace fs = std::filesystem;
 
 namespace utils
 {
 
-  std::string HashContent(const std::vector<uint8_t> &content)
+  ObjectId HashContent(const std::vector<uint8_t> &content)
   {
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, content.data(), content.size());
-    SHA256_Final(hash, &sha256);
-
-    std::stringstream ss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
-    {
-      ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
-    }
-    return ss.str();
+    Hasher hasher;
+    hasher.Update(content);
+    return hasher.Finish();
   }
 
-  bool WriteObject(const std::string &hash, const std::vector<uint8_t> &content)
+  int GetRepositoryFormatVersion()
   {
-    fs::path objectPath = fs::path(DEFAULT_PATH) / "objects" / hash;
-
-    try
-    {
-      // Create directories if they don't exist
-      fs::create_directories(objectPath.parent_path());
+    return GetConfigInt("core.formatversion", FORMAT_FLAT_OBJECTS);
+  }
 
-      std::ofstream file(objectPath, std::ios::binary);
-      if (!file)
-      {
-        return false;
-      }
+  fs::path ObjectPath(const ObjectId &hash)
+  {
+    return ObjectPath(hash, GetRepositoryFormatVersion());
+  }
 
-      file.write(reinterpret_cast<const char *>(content.data()), content.size());
-      return !file.fail();
-    }
-    catch (const std::exception &)
+  fs::path ObjectPath(const ObjectId &hash, int formatVersion)
+  {
+    fs::path objectsDir = fs::path(DEFAULT_PATH) / "objects";
+    char hex[OBJECT_ID_HEX_SIZE];
+    hash.WriteHex(hex);
+    if (formatVersion < FORMAT_FANOUT_OBJECTS)
     {
-      return false;
+      return objectsDir / std::string(hex, sizeof(hex));
     }
+
+    // Shard into 256 subdirectories to keep each directory small
+    return objectsDir / std::string(hex, 2) / std::string(hex + 2, sizeof(hex) - 2);
   }
 
 } // namespace utils
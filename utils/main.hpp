@@ -1,30 +1,131 @@
 #pragma once
 
 #include <string>
+#include <atomic>
 #include <vector>
 #include <map>
 #include <fstream>
+#include <ostream>
 #include <filesystem>
+#include "codec.hpp"
+#include "object_id.hpp"
 
 namespace utils
 {
   // Default path for the repository
   const std::string DEFAULT_PATH = ".microgit";
 
+  // Repository format versions
+  //   0 - flat objects/<hash> layout (repositories created before versioning)
+  //   1 - two-level fan-out objects/<first two hex digits>/<remaining digits>
+  const int FORMAT_FLAT_OBJECTS = 0;
+  const int FORMAT_FANOUT_OBJECTS = 1;
+
+  // Format version written by init and migrate
+  const int REPOSITORY_FORMAT_VERSION = FORMAT_FANOUT_OBJECTS;
+
   // SavePoint structure to store commit information
   struct SavePoint
   {
     std::string message;
     std::string timestamp;
-    std::string parent;
-    std::map<std::string, std::string> files; // filename -> hash
+    ObjectId parent;
+    ObjectId tree;                         // root tree (see tree.hpp), null for older SavePoints
+    std::map<std::string, ObjectId> files; // filename -> hash, only in SavePoints without a tree
+  };
+
+  // Hash the content with the repository's hash algorithm
+  ObjectId HashContent(const std::vector<uint8_t> &content);
+
+  // Get the format version recorded in the repository config
+  int GetRepositoryFormatVersion();
+
+  // Resolve the on-disk path of a loose object for the repository's layout
+  std::filesystem::path ObjectPath(const ObjectId &hash);
+
+  // Resolve the loose object path for a specific format version
+  std::filesystem::path ObjectPath(const ObjectId &hash, int formatVersion);
+
+  // Prefix of temp files that hold objects until they are complete
+  const std::string TEMP_OBJECT_PREFIX = ".tmp-";
+
+  // Replace a file the way objects are published: write a synced temp file
+  // next to it and rename it into place, so readers and crashes see either
+  // the old content or the new
+  bool ReplaceFile(const std::string &path, const std::string &content);
+
+  // How object writes are made durable (core.fsync)
+  enum class FsyncMode
+  {
+    None,   // leave flushing to the OS
+    Object, // fsync every object and its directory as it is written
+    Batch,  // one syncfs for all objects at the end of a command (SyncObjects)
+  };
+
+  // The repository's durability setting, batch when unset
+  FsyncMode GetFsyncMode();
+
+  // Counters for object writes made by this process, from any thread
+  struct ObjectWriteStats
+  {
+    std::atomic<size_t> written{0};
+    std::atomic<size_t> skipped{0}; // already present in the store
   };
 
-  // Hash the content using SHA-256
-  std::string HashContent(const std::vector<uint8_t> &content);
+  // Write object to the repository, skipping objects that are already stored
+  bool WriteObject(const ObjectId &hash, const std::vector<uint8_t> &content,
+                   ObjectType type = ObjectType::Blob);
+
+  // Flush objects written since the last sync in batch mode
+  bool SyncObjects();
+
+  // Ask the next SyncObjects to flush files written outside WriteObject (e.g. packs)
+  void MarkObjectsForSync();
+
+  // Object write counters for this process
+  const ObjectWriteStats &GetObjectWriteStats();
+
+  // Persist hashes of newly written objects to the known-objects list and object filter
+  void FlushKnownObjects();
+
+  // Discard the known-objects list and object filter, e.g. after objects were deleted
+  void ForgetKnownObjects();
+
+  // Print the object write and object filter counters (shown when MICROGIT_STATS is set)
+  void PrintObjectStoreStats(std::ostream &out);
+
+  // Read an object's stored bytes (codec header and payload) without decoding them
+  bool ReadStoredObject(const ObjectId &hash, std::vector<uint8_t> &stored);
+
+  // Read and decode an object, trying packfiles before the loose object store
+  bool ReadObject(const ObjectId &hash, std::vector<uint8_t> &content);
+
+  // Read an object as a string, returns an empty string if it is missing
+  std::string ReadObject(const ObjectId &hash);
+
+  // Check if an object exists in a pack or as a loose object
+  bool ObjectExists(const ObjectId &hash);
+
+  // List the hashes of all loose objects
+  std::vector<ObjectId> ListLooseObjects();
+
+  // Shortest prefix accepted in place of a full object id
+  const size_t MIN_ABBREV_LENGTH = 4;
+
+  // Stored objects whose hex id starts with prefix, sorted. Packs are
+  // binary-searched through their index and loose objects through a sorted
+  // listing of the fan-out directories the prefix selects, cached until the
+  // next object is written.
+  std::vector<ObjectId> FindObjectsByPrefix(const std::string &prefix);
+
+  // The stored objects a full or abbreviated id could name; with a type other
+  // than Unknown, objects of other types are left out. No result means no
+  // match, more than one an ambiguous prefix.
+  std::vector<ObjectId> ResolveObjectId(const std::string &name, ObjectType type = ObjectType::Unknown);
 
-  // Write object to the repository
-  bool WriteObject(const std::string &hash, const std::vector<uint8_t> &content);
+  // Print the error for a prefix ResolveObjectId found several objects for,
+  // listing each candidate with its type
+  void ReportAmbiguousId(std::ostream &out, const std::string &name, const std::vector<ObjectId> &matches);
 
   // Check if a file exists
   inline bool FileExists(const std::string &path)
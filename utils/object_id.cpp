@@ -0,0 +1,90 @@
+#include "object_id.hpp"
+
+namespace utils
+{
+  namespace
+  {
+    // Two digits per byte value, so encoding is one table copy per byte
+    struct HexTables
+    {
+      char encode[256][2];
+      int8_t decode[256];
+
+      HexTables()
+      {
+        static const char digits[] = "0123456789abcdef";
+        for (int i = 0; i < 256; i++)
+        {
+          encode[i][0] = digits[i >> 4];
+          encode[i][1] = digits[i & 0xf];
+          decode[i] = -1;
+        }
+        for (int i = 0; i < 16; i++)
+        {
+          decode[static_cast<uint8_t>(digits[i])] = static_cast<int8_t>(i);
+          decode[static_cast<uint8_t>("0123456789ABCDEF"[i])] = static_cast<int8_t>(i);
+        }
+      }
+    };
+
+    const HexTables &Tables()
+    {
+      static const HexTables tables;
+      return tables;
+    }
+  }
+
+  bool ObjectId::FromHex(const char *hex, size_t size, ObjectId &id)
+  {
+    if (size != OBJECT_ID_HEX_SIZE)
+    {
+      return false;
+    }
+
+    const int8_t *decode = Tables().decode;
+    ObjectId parsed;
+    for (size_t i = 0; i < OBJECT_ID_SIZE; i++)
+    {
+      int hi = decode[static_cast<uint8_t>(hex[2 * i])];
+      int lo = decode[static_cast<uint8_t>(hex[2 * i + 1])];
+      if ((hi | lo) < 0)
+      {
+        return false;
+      }
+      parsed.bytes[i] = static_cast<uint8_t>(hi << 4 | lo);
+    }
+    id = parsed;
+    return true;
+  }
+
+  void ObjectId::WriteHex(char *out) const
+  {
+    const auto &encode = Tables().encode;
+    for (size_t i = 0; i < OBJECT_ID_SIZE; i++)
+    {
+      std::memcpy(out + 2 * i, encode[bytes[i]], 2);
+    }
+  }
+
+  std::string ObjectId::Hex() const
+  {
+    if (IsNull())
+    {
+      return "";
+    }
+    std::string hex(OBJECT_ID_HEX_SIZE, '0');
+    WriteHex(&hex[0]);
+    return hex;
+  }
+
+  std::ostream &operator<<(std::ostream &out, const ObjectId &id)
+  {
+    if (id.IsNull())
+    {
+      return out;
+    }
+    char hex[OBJECT_ID_HEX_SIZE];
+    id.WriteHex(hex);
+    return out.write(hex, sizeof(hex));
+  }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <functional>
+
+namespace utils
+{
+  // Bytes in an object id (a SHA-256 or BLAKE3 digest, see hasher.hpp) and
+  // digits in its hex form
+  const size_t OBJECT_ID_SIZE = 32;
+  const size_t OBJECT_ID_HEX_SIZE = OBJECT_ID_SIZE * 2;
+
+  // The name of an object as its raw digest. Ids stay binary wherever they
+  // are compared, hashed or kept in containers; hex is only produced or parsed
+  // where an id meets text: object file names, SavePoint JSON, the staging
+  // and index files, tree objects and command output. The all-zero id is the
+  // null id and stands for "no object" (no parent, an absent file, ...).
+  struct ObjectId
+  {
+    std::array<uint8_t, OBJECT_ID_SIZE> bytes{};
+
+    ObjectId() = default;
+
+    // Copy OBJECT_ID_SIZE bytes, e.g. a digest or a pack index entry
+    explicit ObjectId(const uint8_t *data)
+    {
+      std::memcpy(bytes.data(), data, OBJECT_ID_SIZE);
+    }
+
+    // Parse exactly OBJECT_ID_HEX_SIZE hex digits of either case, returns
+    // false and leaves id untouched for anything else
+    static bool FromHex(const char *hex, size_t size, ObjectId &id);
+    static bool FromHex(const std::string &hex, ObjectId &id)
+    {
+      return FromHex(hex.data(), hex.size(), id);
+    }
+
+    // Lowercase hex form, empty for the null id
+    std::string Hex() const;
+
+    // Write the OBJECT_ID_HEX_SIZE lowercase digits to out (not terminated)
+    void WriteHex(char *out) const;
+
+    bool IsNull() const
+    {
+      static const ObjectId null;
+      return *this == null;
+    }
+
+    const uint8_t *Data() const { return bytes.data(); }
+
+    bool operator==(const ObjectId &other) const
+    {
+      return std::memcmp(bytes.data(), other.bytes.data(), OBJECT_ID_SIZE) == 0;
+    }
+    bool operator!=(const ObjectId &other) const { return !(*this == other); }
+
+    // Byte order, which is also the order of the hex forms
+    bool operator<(const ObjectId &other) const
+    {
+      return std::memcmp(bytes.data(), other.bytes.data(), OBJECT_ID_SIZE) < 0;
+    }
+  };
+
+  // Print the hex form, nothing for the null id
+  std::ostream &operator<<(std::ostream &out, const ObjectId &id);
+}
+
+namespace std
+{
+  // Digests are uniformly distributed, so their leading bytes are a hash already
+  template <>
+  struct hash<utils::ObjectId>
+  {
+    size_t operator()(const utils::ObjectId &id) const noexcept
+    {
+      size_t value;
+      std::memcpy(&value, id.bytes.data(), sizeof(value));
+      return value;
+    }
+  };
+}
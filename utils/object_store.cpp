@@ -0,0 +1,1472 @@
+#include "object_store.hpp"
+#include "main.hpp"
+#include "config.hpp"
+#include "pack.hpp"
+#include "bloom.hpp"
+#include "io_engine.hpp"
+#include "file_copy.hpp"
+#include "chunks.hpp"
+#include "tree.hpp"
+#include "json.hpp"
+#include "hasher.hpp"
+#include <fstream>
+#include <filesystem>
+#include <unordered_set>
+#include <map>
+#include <cstdio>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <atomic>
+
+namespace fs = std::filesystem;
+
+namespace utils
+{
+  namespace
+  {
+    ObjectWriteStats writeStats;
+
+    // Lock shared by processes updating the known-objects list and object filter
+    fs::path ObjectFilesLockPath()
+    {
+      return fs::path(DEFAULT_PATH) / "object-filter.lock";
+    }
+
+    // Take the lock exclusively, returns its descriptor or -1
+    int LockObjectFiles()
+    {
+      int lockFd = open(ObjectFilesLockPath().c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      if (lockFd >= 0 && flock(lockFd, LOCK_EX) != 0)
+      {
+        close(lockFd);
+        return -1;
+      }
+      return lockFd;
+    }
+
+    // Hashes known to be in the object store, persisted in .microgit/known-objects
+    // so repeated adds can skip writes without touching the objects directory
+    class KnownObjects
+    {
+    public:
+      ~KnownObjects()
+      {
+        Flush();
+      }
+
+      bool Contains(const ObjectId &hash)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        Load();
+        return hashes.count(hash) > 0;
+      }
+
+      void Insert(const ObjectId &hash)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        Load();
+        if (hashes.insert(hash).second)
+        {
+          pending.push_back(hash);
+        }
+      }
+
+      void Flush()
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.empty() || !fs::exists(DEFAULT_PATH))
+        {
+          return;
+        }
+
+        // Appends from concurrent processes must not interleave within a line
+        int lockFd = LockObjectFiles();
+        if (lockFd < 0)
+        {
+          return;
+        }
+        {
+          std::ofstream file(Path(), std::ios::app);
+          for (const auto &hash : pending)
+          {
+            file << hash << '\n';
+          }
+        }
+        close(lockFd);
+        pending.clear();
+      }
+
+      void Reset()
+      {
+        Flush();
+        std::lock_guard<std::mutex> lock(mutex);
+        hashes.clear();
+        loaded = false;
+      }
+
+    private:
+      static std::string Path()
+      {
+        return DEFAULT_PATH + "/known-objects";
+      }
+
+      void Load()
+      {
+        if (loaded)
+        {
+          return;
+        }
+        loaded = true;
+
+        std::ifstream file(Path());
+        std::string line;
+        ObjectId hash;
+        while (std::getline(file, line))
+        {
+          if (ObjectId::FromHex(line, hash))
+          {
+            hashes.insert(hash);
+          }
+        }
+      }
+
+      bool loaded = false;
+      std::unordered_set<ObjectId> hashes;
+      std::vector<ObjectId> pending;
+      std::mutex mutex;
+    };
+
+    KnownObjects knownObjects;
+
+    // Bloom filter over every stored hash, persisted in .microgit/object-filter
+    // so a lookup for an object that does not exist never touches the store
+    class ObjectFilter
+    {
+    public:
+      ~ObjectFilter()
+      {
+        Save();
+      }
+
+      bool MayContain(const ObjectId &hash)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!Load())
+        {
+          return true;
+        }
+        // Other processes may have stored the object since the filter was
+        // read, so a miss is only final against the filter on disk
+        if (filter.MayContain(hash) || (Refresh() && filter.MayContain(hash)))
+        {
+          return true;
+        }
+        negatives++;
+        return false;
+      }
+
+      void Insert(const ObjectId &hash)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!Load() || filter.MayContain(hash))
+        {
+          return;
+        }
+
+        // Past its capacity the false positive rate climbs, size up from the store
+        if (filter.Count() >= filter.Capacity())
+        {
+          Rebuild(filter.Capacity() * 2);
+        }
+        filter.Add(hash);
+        dirty = true;
+      }
+
+      void Save()
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!dirty || !fs::exists(DEFAULT_PATH))
+        {
+          return;
+        }
+
+        // Other processes save their own copies, so fold in whatever the
+        // file holds now and replace it while they are locked out
+        int lockFd = LockObjectFiles();
+        if (lockFd < 0)
+        {
+          return;
+        }
+        Refresh();
+        if (filter.Save(Path()))
+        {
+          dirty = false;
+          diskIdentity = FileIdentity();
+        }
+        close(lockFd);
+      }
+
+      void Reset()
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::error_code ec;
+        fs::remove(Path(), ec);
+        loaded = false;
+        dirty = false;
+        diskIdentity.clear();
+      }
+
+      size_t Negatives() const
+      {
+        return negatives;
+      }
+
+    private:
+      static fs::path Path()
+      {
+        return fs::path(DEFAULT_PATH) / "object-filter";
+      }
+
+      // Inode, size and mtime of the filter file, empty if there is none
+      static std::string FileIdentity()
+      {
+        struct stat info;
+        if (stat(Path().c_str(), &info) != 0)
+        {
+          return "";
+        }
+        return std::to_string(info.st_ino) + ":" + std::to_string(info.st_size) + ":" +
+               std::to_string(info.st_mtim.tv_sec) + "." + std::to_string(info.st_mtim.tv_nsec);
+      }
+
+      // Merge the filter file into this copy if it was replaced since it was
+      // last read or written. False if nothing new was found.
+      bool Refresh()
+      {
+        std::string identity = FileIdentity();
+        if (identity.empty() || identity == diskIdentity)
+        {
+          return false;
+        }
+        diskIdentity = identity;
+
+        BloomFilter disk;
+        if (!disk.Load(Path()))
+        {
+          return false;
+        }
+        if (!filter.Merge(disk))
+        {
+          // Sized differently: the store itself holds every key of both
+          Rebuild(std::max(filter.Capacity(), disk.Capacity()));
+        }
+        return true;
+      }
+
+      // Outside a repository there is nothing to filter
+      bool Load()
+      {
+        if (loaded)
+        {
+          return true;
+        }
+        if (!fs::exists(DEFAULT_PATH))
+        {
+          return false;
+        }
+
+        loaded = true;
+        diskIdentity = FileIdentity();
+        if (!filter.Load(Path()))
+        {
+          // First use, or a damaged file: rebuild from what is actually stored
+          Rebuild(0);
+        }
+        return true;
+      }
+
+      void Rebuild(size_t capacity)
+      {
+        std::vector<ObjectId> hashes = PackObjectStore().List();
+        std::vector<ObjectId> looseHashes = LooseObjectStore().List();
+        hashes.insert(hashes.end(), looseHashes.begin(), looseHashes.end());
+
+        filter = BloomFilter(std::max(capacity, hashes.size() * 2));
+        for (const auto &hash : hashes)
+        {
+          filter.Add(hash);
+        }
+        dirty = true;
+      }
+
+      BloomFilter filter;
+      bool loaded = false;
+      bool dirty = false;
+      std::string diskIdentity; // filter file as last read or written
+      size_t negatives = 0;
+      std::mutex mutex;
+    };
+
+    ObjectFilter objectFilter;
+
+    // Sorted listings of loose object directories for resolving abbreviated
+    // ids, keyed by fan-out directory name ("" in the flat layout). Publishing
+    // an object marks them stale.
+    std::map<std::string, std::vector<ObjectId>> looseListings;
+    std::mutex looseListingsMutex;
+    std::atomic<bool> looseListingsStale{false};
+
+    // The listing of one loose object directory, looseListingsMutex must be held
+    const std::vector<ObjectId> &LooseListing(const std::string &fanout)
+    {
+      if (looseListingsStale.exchange(false))
+      {
+        looseListings.clear();
+      }
+      auto it = looseListings.find(fanout);
+      if (it != looseListings.end())
+      {
+        return it->second;
+      }
+
+      std::vector<ObjectId> &ids = looseListings[fanout];
+      std::error_code ec;
+      ObjectId id;
+      for (const auto &entry : fs::directory_iterator(fs::path(DEFAULT_PATH) / "objects" / fanout, ec))
+      {
+        if (entry.is_regular_file(ec) && ObjectId::FromHex(fanout + entry.path().filename().string(), id))
+        {
+          ids.push_back(id);
+        }
+      }
+      std::sort(ids.begin(), ids.end());
+      return ids;
+    }
+
+    // The first and last ids that start with a hex prefix
+    bool PrefixRange(const std::string &prefix, ObjectId &first, ObjectId &last)
+    {
+      if (prefix.empty() || prefix.size() > OBJECT_ID_HEX_SIZE)
+      {
+        return false;
+      }
+      size_t padding = OBJECT_ID_HEX_SIZE - prefix.size();
+      return ObjectId::FromHex(prefix + std::string(padding, '0'), first) &&
+             ObjectId::FromHex(prefix + std::string(padding, 'f'), last);
+    }
+
+    // Objects written since the last SyncObjects in batch mode
+    std::atomic<bool> syncPending{false};
+
+    // Distinguishes temp files created by this process
+    std::atomic<unsigned long> tempCounter{0};
+
+    // Read size of streaming writes
+    const size_t STREAM_BLOCK_SIZE = 64 * 1024;
+
+    std::unique_ptr<ObjectStore> objectStore;
+
+    bool WriteAll(int fd, const uint8_t *data, size_t size)
+    {
+      while (size > 0)
+      {
+        ssize_t written = write(fd, data, size);
+        if (written < 0)
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
+          return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+      }
+      return true;
+    }
+
+    // Open a new temp file in dir, private to this process. Writing objects to
+    // a temp file first means a crash never leaves a truncated object under a
+    // valid name; O_EXCL keeps concurrent writers apart.
+    // Temp files are read back through the same descriptor to hash them
+    const int TEMP_OPEN_FLAGS = O_RDWR | O_CREAT | O_EXCL;
+
+    int OpenTemp(const fs::path &dir, std::string &tempPath)
+    {
+      tempPath = (dir / (TEMP_OBJECT_PREFIX + std::to_string(getpid()) + "-" + std::to_string(tempCounter++))).string();
+      int fd = open(tempPath.c_str(), TEMP_OPEN_FLAGS, 0644);
+      if (fd < 0 && errno == ENOENT)
+      {
+        // Create the fan-out directory on first use
+        std::error_code ec;
+        fs::create_directories(dir, ec);
+        fd = open(tempPath.c_str(), TEMP_OPEN_FLAGS, 0644);
+      }
+      return fd;
+    }
+
+    // Finish writing a temp file, removing it if anything went wrong
+    bool CloseTemp(int fd, const std::string &tempPath, bool ok)
+    {
+      if (ok && GetFsyncMode() == FsyncMode::Object)
+      {
+        ok = fsync(fd) == 0;
+      }
+      ok = close(fd) == 0 && ok;
+      if (!ok)
+      {
+        unlink(tempPath.c_str());
+      }
+      return ok;
+    }
+
+    // Make a rename durable by syncing the directory that holds it
+    void SyncDirectory(const fs::path &dir)
+    {
+      int fd = open(dir.c_str(), O_RDONLY);
+      if (fd >= 0)
+      {
+        fsync(fd);
+        close(fd);
+      }
+    }
+  }
+
+  bool ReplaceFile(const std::string &path, const std::string &content)
+  {
+    // Always synced: callers may hold the config lock, so core.fsync can't be read here
+    fs::path dir = fs::path(path).parent_path();
+    std::string tempPath;
+    int fd = OpenTemp(dir.empty() ? fs::path(".") : dir, tempPath);
+    if (fd < 0)
+    {
+      return false;
+    }
+    bool ok = WriteAll(fd, reinterpret_cast<const uint8_t *>(content.data()), content.size()) && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+      unlink(tempPath.c_str());
+      return false;
+    }
+    SyncDirectory(dir.empty() ? fs::path(".") : dir);
+    return true;
+  }
+
+  // ObjectStore defaults
+
+  bool ObjectStore::ReadStored(const ObjectId &hash, std::vector<uint8_t> &stored)
+  {
+    std::vector<uint8_t> content;
+    if (!Read(hash, content))
+    {
+      return false;
+    }
+    stored = EncodeObject(content, 0);
+    return true;
+  }
+
+  bool ObjectStore::Info(const ObjectId &hash, ObjectInfo &info)
+  {
+    std::vector<uint8_t> content;
+    if (!Read(hash, content))
+    {
+      return false;
+    }
+    info.type = ClassifyContent(content);
+    info.size = content.size();
+    return true;
+  }
+
+  bool ObjectStore::Stream(const ObjectId &hash, const ByteSink &sink)
+  {
+    std::vector<uint8_t> content;
+    return Read(hash, content) && sink(content.data(), content.size());
+  }
+
+  std::vector<bool> ObjectStore::ReadBatch(const std::vector<ObjectId> &hashes,
+                                           std::vector<std::vector<uint8_t>> &contents)
+  {
+    std::vector<bool> found(hashes.size());
+    contents.resize(hashes.size());
+    for (size_t i = 0; i < hashes.size(); i++)
+    {
+      found[i] = Read(hashes[i], contents[i]);
+    }
+    return found;
+  }
+
+  bool ObjectStore::WriteBatch(const std::vector<ObjectId> &hashes,
+                               const std::vector<std::vector<uint8_t>> &contents)
+  {
+    bool ok = hashes.size() == contents.size();
+    for (size_t i = 0; i < hashes.size() && i < contents.size(); i++)
+    {
+      ok = Write(hashes[i], contents[i], ObjectType::Blob) && ok;
+    }
+    return ok;
+  }
+
+  bool ObjectStore::WriteStream(std::istream &in, ObjectId &hash)
+  {
+    std::vector<uint8_t> content(std::istreambuf_iterator<char>(in), {});
+    if (in.bad())
+    {
+      return false;
+    }
+    hash = HashContent(content);
+    return Write(hash, content, ObjectType::Blob);
+  }
+
+  bool ObjectStore::WriteFile(const std::string &path, ObjectId &hash)
+  {
+    std::ifstream in(path, std::ios::binary);
+    return in && WriteStream(in, hash);
+  }
+
+  // LooseObjectStore
+
+  bool LooseObjectStore::ReadStored(const ObjectId &hash, std::vector<uint8_t> &stored)
+  {
+    std::ifstream file(ObjectPath(hash), std::ios::binary);
+    if (!file)
+    {
+      return false;
+    }
+
+    stored.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+  }
+
+  bool LooseObjectStore::Read(const ObjectId &hash, std::vector<uint8_t> &content)
+  {
+    std::vector<uint8_t> stored;
+    if (!ReadStored(hash, stored))
+    {
+      return false;
+    }
+
+    // Raw objects need no decoding, hand the buffer over as is
+    if (!HasCodecHeader(stored.data(), stored.size()))
+    {
+      content.swap(stored);
+      return true;
+    }
+    return DecodeObject(stored, content);
+  }
+
+  bool LooseObjectStore::Write(const ObjectId &hash, const std::vector<uint8_t> &content, ObjectType type)
+  {
+    fs::path objectPath = ObjectPath(hash);
+    if (access(objectPath.c_str(), F_OK) == 0)
+    {
+      knownObjects.Insert(hash);
+      writeStats.skipped++;
+      return true;
+    }
+
+    std::string tempPath;
+    int fd = OpenTemp(objectPath.parent_path(), tempPath);
+    if (fd < 0)
+    {
+      return false;
+    }
+
+    std::vector<uint8_t> stored = EncodeObject(content, GetCompressionLevel(), type);
+    bool ok = WriteAll(fd, stored.data(), stored.size());
+    return CloseTemp(fd, tempPath, ok) && Publish(tempPath, hash);
+  }
+
+  bool LooseObjectStore::WriteStream(std::istream &in, ObjectId &hash)
+  {
+    std::string tempPath;
+    if (!StreamToTemp(in, hash, tempPath))
+    {
+      return false;
+    }
+
+    if (access(ObjectPath(hash).c_str(), F_OK) == 0)
+    {
+      Discard(tempPath, hash);
+      return true;
+    }
+    return Publish(tempPath, hash);
+  }
+
+  bool LooseObjectStore::WriteFile(const std::string &path, ObjectId &hash)
+  {
+    std::string tempPath;
+    if (!FileToTemp(path, hash, tempPath))
+    {
+      return false;
+    }
+
+    if (access(ObjectPath(hash).c_str(), F_OK) == 0)
+    {
+      Discard(tempPath, hash);
+      return true;
+    }
+    return Publish(tempPath, hash);
+  }
+
+  bool LooseObjectStore::FileToTemp(const std::string &path, ObjectId &hash, std::string &tempPath)
+  {
+    int inFd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (inFd < 0)
+    {
+      return false;
+    }
+
+    // Files that would be stored raw are copied into the temp file by the
+    // kernel (a reflink where supported), everything else is encoded
+    std::vector<uint8_t> sample(STREAM_BLOCK_SIZE);
+    ssize_t got = pread(inFd, sample.data(), sample.size(), 0);
+    if (got < static_cast<ssize_t>(CLONE_MIN_SIZE) || !StoresRaw(sample.data(), static_cast<size_t>(got), GetCompressionLevel()))
+    {
+      close(inFd);
+      std::ifstream in(path, std::ios::binary);
+      return in && StreamToTemp(in, hash, tempPath);
+    }
+
+    int fd = OpenTemp(fs::path(DEFAULT_PATH) / "objects", tempPath);
+    if (fd < 0)
+    {
+      close(inFd);
+      return false;
+    }
+    // Read the temp file back to hash it, so the object matches its name
+    // even if the source changes while it is copied
+    bool ok = CopyFileContents(inFd, fd) && lseek(fd, 0, SEEK_SET) == 0;
+    close(inFd);
+
+    Hasher hasher;
+    ok = ok && hasher.UpdateFd(fd);
+    hash = hasher.Finish();
+    return CloseTemp(fd, tempPath, ok);
+  }
+
+  std::string LooseObjectStore::RawPath(const ObjectId &hash, size_t minSize)
+  {
+    std::string path = ObjectPath(hash).string();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      return "";
+    }
+
+    struct stat info;
+    uint8_t header[CODEC_HEADER_SIZE];
+    bool raw = fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= minSize &&
+               (info.st_size < static_cast<off_t>(sizeof(header)) ||
+                (pread(fd, header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+                 !HasCodecHeader(header, sizeof(header))));
+    close(fd);
+    return raw ? path : "";
+  }
+
+  bool LooseObjectStore::StreamToTemp(std::istream &in, ObjectId &hash, std::string &tempPath)
+  {
+    // The hash is only known at the end, so stage in the objects directory itself
+    int fd = OpenTemp(fs::path(DEFAULT_PATH) / "objects", tempPath);
+    if (fd < 0)
+    {
+      return false;
+    }
+
+    Hasher hasher;
+    ObjectEncoder encoder(GetCompressionLevel(), [fd](const uint8_t *data, size_t size)
+                          { return WriteAll(fd, data, size); });
+
+    // Every block is hashed and encoded into the temp file in the same pass
+    std::vector<uint8_t> block(STREAM_BLOCK_SIZE);
+    bool ok = true;
+    uint64_t total = 0;
+    while (ok && (in.read(reinterpret_cast<char *>(block.data()), block.size()) || in.gcount() > 0))
+    {
+      size_t size = static_cast<size_t>(in.gcount());
+      hasher.Update(block.data(), size);
+      total += size;
+      ok = encoder.Write(block.data(), size);
+    }
+    ok = ok && !in.bad() && encoder.Finish();
+
+    // The header went out before the size was known, fill it in
+    if (ok && encoder.SizePending())
+    {
+      uint8_t field[8];
+      PutObjectSize(total, field);
+      ok = pwrite(fd, field, sizeof(field), OBJECT_SIZE_OFFSET) == static_cast<ssize_t>(sizeof(field));
+    }
+
+    hash = hasher.Finish();
+    return CloseTemp(fd, tempPath, ok);
+  }
+
+  bool LooseObjectStore::Publish(const std::string &tempPath, const ObjectId &hash)
+  {
+    fs::path objectPath = ObjectPath(hash);
+
+    // rename is atomic, readers see either no object or the complete one
+    int result = rename(tempPath.c_str(), objectPath.c_str());
+    if (result != 0 && errno == ENOENT)
+    {
+      // Create the fan-out directory on first use
+      std::error_code ec;
+      fs::create_directories(objectPath.parent_path(), ec);
+      result = rename(tempPath.c_str(), objectPath.c_str());
+    }
+    if (result != 0)
+    {
+      unlink(tempPath.c_str());
+      return false;
+    }
+
+    FsyncMode fsyncMode = GetFsyncMode();
+    if (fsyncMode == FsyncMode::Object)
+    {
+      SyncDirectory(objectPath.parent_path());
+    }
+    else if (fsyncMode == FsyncMode::Batch)
+    {
+      syncPending = true;
+    }
+
+    knownObjects.Insert(hash);
+    looseListingsStale = true;
+    writeStats.written++;
+    return true;
+  }
+
+  void LooseObjectStore::Discard(const std::string &tempPath, const ObjectId &hash)
+  {
+    unlink(tempPath.c_str());
+    knownObjects.Insert(hash);
+    writeStats.skipped++;
+  }
+
+  bool LooseObjectStore::Exists(const ObjectId &hash)
+  {
+    return access(ObjectPath(hash).c_str(), F_OK) == 0;
+  }
+
+  bool LooseObjectStore::Info(const ObjectId &hash, ObjectInfo &info)
+  {
+    int fd = open(ObjectPath(hash).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      return false;
+    }
+
+    struct stat st;
+    uint8_t prefix[TYPED_HEADER_SIZE];
+    ssize_t got = fstat(fd, &st) == 0 ? pread(fd, prefix, sizeof(prefix), 0) : -1;
+    close(fd);
+    ObjectHeader header;
+    if (got < 0 || !ParseObjectHeader(prefix, static_cast<size_t>(got), header))
+    {
+      return false;
+    }
+
+    // A raw object is its content, so the file size is the object size
+    info.type = header.length == 0 ? RawObjectType(prefix, static_cast<size_t>(got)) : header.type;
+    info.size = header.length == 0 ? static_cast<uint64_t>(st.st_size) : header.size;
+    if (info.type != ObjectType::Unknown && info.size != OBJECT_SIZE_UNKNOWN)
+    {
+      return true;
+    }
+    return ObjectStore::Info(hash, info);
+  }
+
+  bool LooseObjectStore::Stream(const ObjectId &hash, const ByteSink &sink)
+  {
+    std::ifstream file(ObjectPath(hash), std::ios::binary);
+    return file && DecodeObjectStream(file, sink);
+  }
+
+  std::vector<bool> LooseObjectStore::ReadBatch(const std::vector<ObjectId> &hashes,
+                                                std::vector<std::vector<uint8_t>> &contents)
+  {
+    std::vector<FileRead> reads(hashes.size());
+    for (size_t i = 0; i < hashes.size(); i++)
+    {
+      reads[i].path = ObjectPath(hashes[i]).string();
+    }
+    GetIoEngine().Read(reads);
+
+    std::vector<bool> found(hashes.size(), false);
+    contents.resize(hashes.size());
+    for (size_t i = 0; i < hashes.size(); i++)
+    {
+      if (!reads[i].ok)
+      {
+        continue;
+      }
+      if (!HasCodecHeader(reads[i].data.data(), reads[i].data.size()))
+      {
+        contents[i].swap(reads[i].data);
+        found[i] = true;
+      }
+      else
+      {
+        found[i] = DecodeObject(reads[i].data, contents[i]);
+      }
+    }
+    return found;
+  }
+
+  bool LooseObjectStore::WriteBatch(const std::vector<ObjectId> &hashes,
+                                    const std::vector<std::vector<uint8_t>> &contents)
+  {
+    if (hashes.size() != contents.size())
+    {
+      return false;
+    }
+
+    std::vector<size_t> indexes(hashes.size());
+    for (size_t i = 0; i < indexes.size(); i++)
+    {
+      indexes[i] = i;
+    }
+    return WriteSelected(hashes, contents, indexes);
+  }
+
+  bool LooseObjectStore::WriteSelected(const std::vector<ObjectId> &hashes,
+                                       const std::vector<std::vector<uint8_t>> &contents,
+                                       const std::vector<size_t> &indexes)
+  {
+    // Encode everything first, then let the engine write all temp files at once
+    std::vector<size_t> pending;
+    std::vector<std::vector<uint8_t>> stored;
+    std::vector<FileWrite> writes;
+    int level = GetCompressionLevel();
+    bool sync = GetFsyncMode() == FsyncMode::Object;
+    std::unordered_set<ObjectId> queued;
+    for (size_t i : indexes)
+    {
+      // Files with the same content share one write
+      if (!queued.insert(hashes[i]).second)
+      {
+        writeStats.skipped++;
+        continue;
+      }
+      fs::path objectPath = ObjectPath(hashes[i]);
+      if (access(objectPath.c_str(), F_OK) == 0)
+      {
+        knownObjects.Insert(hashes[i]);
+        writeStats.skipped++;
+        continue;
+      }
+
+      std::error_code ec;
+      fs::create_directories(objectPath.parent_path(), ec);
+      FileWrite write;
+      write.path = (objectPath.parent_path() /
+                    (TEMP_OBJECT_PREFIX + std::to_string(getpid()) + "-" + std::to_string(tempCounter++)))
+                       .string();
+      write.flags = TEMP_OPEN_FLAGS;
+      write.sync = sync;
+      writes.push_back(write);
+      stored.push_back(EncodeObject(contents[i], level));
+      pending.push_back(i);
+    }
+
+    for (size_t j = 0; j < writes.size(); j++)
+    {
+      writes[j].data = stored[j].data();
+      writes[j].size = stored[j].size();
+    }
+    GetIoEngine().Write(writes);
+
+    bool ok = true;
+    for (size_t j = 0; j < writes.size(); j++)
+    {
+      if (!writes[j].ok)
+      {
+        unlink(writes[j].path.c_str());
+        ok = false;
+        continue;
+      }
+      ok = Publish(writes[j].path, hashes[pending[j]]) && ok;
+    }
+    return ok;
+  }
+
+  std::vector<ObjectId> LooseObjectStore::List()
+  {
+    std::vector<ObjectId> hashes;
+    fs::path objectsDir = fs::path(DEFAULT_PATH) / "objects";
+    std::error_code ec;
+    if (!fs::is_directory(objectsDir, ec))
+    {
+      return hashes;
+    }
+
+    for (const auto &entry : fs::directory_iterator(objectsDir, ec))
+    {
+      std::string name = entry.path().filename().string();
+      if (starts_with(name, "."))
+      {
+        // Temp files and other bookkeeping
+        continue;
+      }
+
+      // Names that are not object ids are not objects
+      ObjectId hash;
+      if (entry.is_regular_file())
+      {
+        // Flat layout
+        if (ObjectId::FromHex(name, hash))
+        {
+          hashes.push_back(hash);
+        }
+      }
+      else if (entry.is_directory() && name.size() == 2)
+      {
+        // Fan-out layout
+        for (const auto &object : fs::directory_iterator(entry.path(), ec))
+        {
+          if (object.is_regular_file() && ObjectId::FromHex(name + object.path().filename().string(), hash))
+          {
+            hashes.push_back(hash);
+          }
+        }
+      }
+    }
+    return hashes;
+  }
+
+  bool LooseObjectStore::Sync()
+  {
+    if (!syncPending.exchange(false))
+    {
+      return true;
+    }
+
+    fs::path objectsDir = fs::path(DEFAULT_PATH) / "objects";
+    int fd = open(objectsDir.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      return false;
+    }
+
+#ifdef __linux__
+    // One syncfs flushes every object written since the last sync
+    bool ok = syncfs(fd) == 0;
+#else
+    sync();
+    bool ok = true;
+#endif
+    close(fd);
+    return ok;
+  }
+
+  // PackObjectStore
+
+  bool PackObjectStore::Read(const ObjectId &hash, std::vector<uint8_t> &content)
+  {
+    // Packs decode their own entries so delta chains can use the base cache
+    return ReadPackedContent(hash, content);
+  }
+
+  bool PackObjectStore::ReadStored(const ObjectId &hash, std::vector<uint8_t> &stored)
+  {
+    return ReadPackedObject(hash, stored);
+  }
+
+  bool PackObjectStore::Write(const ObjectId &hash, const std::vector<uint8_t> &/*content*/, ObjectType /*type*/)
+  {
+    // Packs are immutable, new ones are built with WritePack
+    return Exists(hash);
+  }
+
+  bool PackObjectStore::Exists(const ObjectId &hash)
+  {
+    return HasPackedObject(hash);
+  }
+
+  bool PackObjectStore::Info(const ObjectId &hash, ObjectInfo &info)
+  {
+    for (const auto &pack : GetPacks())
+    {
+      if (pack->Info(hash, info))
+      {
+        return info.type != ObjectType::Unknown || ObjectStore::Info(hash, info);
+      }
+    }
+    return false;
+  }
+
+  std::vector<ObjectId> PackObjectStore::List()
+  {
+    std::vector<ObjectId> hashes;
+    for (const auto &pack : GetPacks())
+    {
+      for (uint32_t i = 0; i < pack->Count(); i++)
+      {
+        hashes.push_back(pack->HashAt(i));
+      }
+    }
+    return hashes;
+  }
+
+  // MemoryObjectStore
+
+  bool MemoryObjectStore::Read(const ObjectId &hash, std::vector<uint8_t> &content)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = objects.find(hash);
+    if (it == objects.end())
+    {
+      return false;
+    }
+    content = it->second;
+    return true;
+  }
+
+  bool MemoryObjectStore::Write(const ObjectId &hash, const std::vector<uint8_t> &content, ObjectType /*type*/)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (objects.emplace(hash, content).second)
+    {
+      writeStats.written++;
+    }
+    else
+    {
+      writeStats.skipped++;
+    }
+    return true;
+  }
+
+  bool MemoryObjectStore::Exists(const ObjectId &hash)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return objects.count(hash) > 0;
+  }
+
+  bool MemoryObjectStore::Stream(const ObjectId &hash, const ByteSink &sink)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = objects.find(hash);
+    return it != objects.end() && sink(it->second.data(), it->second.size());
+  }
+
+  std::vector<ObjectId> MemoryObjectStore::List()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ObjectId> hashes;
+    hashes.reserve(objects.size());
+    for (const auto &entry : objects)
+    {
+      hashes.push_back(entry.first);
+    }
+    return hashes;
+  }
+
+  // RepositoryObjectStore
+
+  bool RepositoryObjectStore::Read(const ObjectId &hash, std::vector<uint8_t> &content)
+  {
+    return !hash.IsNull() && (packs.Read(hash, content) || loose.Read(hash, content));
+  }
+
+  bool RepositoryObjectStore::ReadStored(const ObjectId &hash, std::vector<uint8_t> &stored)
+  {
+    return !hash.IsNull() && (packs.ReadStored(hash, stored) || loose.ReadStored(hash, stored));
+  }
+
+  bool RepositoryObjectStore::Write(const ObjectId &hash, const std::vector<uint8_t> &content, ObjectType type)
+  {
+    // Objects are immutable, so one that is already stored never needs rewriting
+    if (AlreadyStored(hash))
+    {
+      writeStats.skipped++;
+      return true;
+    }
+
+    if (!loose.Write(hash, content, type))
+    {
+      return false;
+    }
+    objectFilter.Insert(hash);
+    return true;
+  }
+
+  bool RepositoryObjectStore::WriteStream(std::istream &in, ObjectId &hash)
+  {
+    std::string tempPath;
+    return loose.StreamToTemp(in, hash, tempPath) && Commit(tempPath, hash);
+  }
+
+  bool RepositoryObjectStore::WriteFile(const std::string &path, ObjectId &hash)
+  {
+    std::string tempPath;
+    return loose.FileToTemp(path, hash, tempPath) && Commit(tempPath, hash);
+  }
+
+  std::string RepositoryObjectStore::RawPath(const ObjectId &hash, size_t minSize)
+  {
+    return hash.IsNull() ? "" : loose.RawPath(hash, minSize);
+  }
+
+  bool RepositoryObjectStore::Commit(const std::string &tempPath, const ObjectId &hash)
+  {
+    // Same skip rules as Write, only applied once the hash is known
+    if (AlreadyStored(hash) || loose.Exists(hash))
+    {
+      loose.Discard(tempPath, hash);
+      objectFilter.Insert(hash);
+      return true;
+    }
+
+    if (!loose.Publish(tempPath, hash))
+    {
+      return false;
+    }
+    objectFilter.Insert(hash);
+    return true;
+  }
+
+  std::vector<bool> RepositoryObjectStore::ReadBatch(const std::vector<ObjectId> &hashes,
+                                                     std::vector<std::vector<uint8_t>> &contents)
+  {
+    // Packed objects are already mapped, only loose ones go through the I/O engine
+    std::vector<bool> found(hashes.size(), false);
+    contents.resize(hashes.size());
+    std::vector<size_t> looseIndexes;
+    std::vector<ObjectId> looseHashes;
+    for (size_t i = 0; i < hashes.size(); i++)
+    {
+      if (hashes[i].IsNull())
+      {
+        continue;
+      }
+      if (packs.Read(hashes[i], contents[i]))
+      {
+        found[i] = true;
+      }
+      else
+      {
+        looseIndexes.push_back(i);
+        looseHashes.push_back(hashes[i]);
+      }
+    }
+
+    std::vector<std::vector<uint8_t>> looseContents;
+    std::vector<bool> looseFound = loose.ReadBatch(looseHashes, looseContents);
+    for (size_t j = 0; j < looseIndexes.size(); j++)
+    {
+      found[looseIndexes[j]] = looseFound[j];
+      contents[looseIndexes[j]].swap(looseContents[j]);
+    }
+    return found;
+  }
+
+  bool RepositoryObjectStore::WriteBatch(const std::vector<ObjectId> &hashes,
+                                         const std::vector<std::vector<uint8_t>> &contents)
+  {
+    if (hashes.size() != contents.size())
+    {
+      return false;
+    }
+
+    std::vector<size_t> indexes;
+    for (size_t i = 0; i < hashes.size(); i++)
+    {
+      if (AlreadyStored(hashes[i]))
+      {
+        writeStats.skipped++;
+        continue;
+      }
+      indexes.push_back(i);
+    }
+
+    bool ok = loose.WriteSelected(hashes, contents, indexes);
+    for (size_t i : indexes)
+    {
+      objectFilter.Insert(hashes[i]);
+    }
+    return ok;
+  }
+
+  bool RepositoryObjectStore::AlreadyStored(const ObjectId &hash)
+  {
+    // When the filter rules the object out, go straight to writing it. The
+    // known-objects list is only a hint: it is not synced and outlives objects
+    // deleted behind its back, so a loose hit is confirmed with a stat.
+    return objectFilter.MayContain(hash) &&
+           (packs.Exists(hash) || (knownObjects.Contains(hash) && loose.Exists(hash)));
+  }
+
+  bool RepositoryObjectStore::Exists(const ObjectId &hash)
+  {
+    return !hash.IsNull() && objectFilter.MayContain(hash) && (packs.Exists(hash) || loose.Exists(hash));
+  }
+
+  bool RepositoryObjectStore::Info(const ObjectId &hash, ObjectInfo &info)
+  {
+    return !hash.IsNull() && (packs.Info(hash, info) || loose.Info(hash, info));
+  }
+
+  bool RepositoryObjectStore::Stream(const ObjectId &hash, const ByteSink &sink)
+  {
+    if (packs.Exists(hash))
+    {
+      return packs.Stream(hash, sink);
+    }
+    return loose.Stream(hash, sink);
+  }
+
+  std::vector<ObjectId> RepositoryObjectStore::List()
+  {
+    std::vector<ObjectId> hashes = packs.List();
+    std::vector<ObjectId> looseHashes = loose.List();
+    hashes.insert(hashes.end(), looseHashes.begin(), looseHashes.end());
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    return hashes;
+  }
+
+  bool RepositoryObjectStore::Sync()
+  {
+    // Persist the filter with the objects, before any reference to them is published
+    objectFilter.Save();
+    return loose.Sync();
+  }
+
+  ObjectType ClassifyContent(const std::vector<uint8_t> &content)
+  {
+    if (IsChunkList(content))
+    {
+      return ObjectType::ChunkList;
+    }
+    if (IsTree(content))
+    {
+      return ObjectType::Tree;
+    }
+    if (RawObjectType(content.data(), content.size()) == ObjectType::Blob)
+    {
+      return ObjectType::Blob;
+    }
+
+    // Parsing fails unless the JSON has every SavePoint field
+    try
+    {
+      JSON::Parse(std::string(content.begin(), content.end()));
+      return ObjectType::SavePoint;
+    }
+    catch (const std::exception &)
+    {
+      return ObjectType::Blob;
+    }
+  }
+
+  ObjectStore &GetObjectStore()
+  {
+    if (!objectStore)
+    {
+      objectStore = std::make_unique<RepositoryObjectStore>();
+    }
+    return *objectStore;
+  }
+
+  void SetObjectStore(std::unique_ptr<ObjectStore> store)
+  {
+    objectStore = std::move(store);
+  }
+
+  // Helpers declared in main.hpp
+
+  bool WriteObject(const ObjectId &hash, const std::vector<uint8_t> &content, ObjectType type)
+  {
+    return GetObjectStore().Write(hash, content, type);
+  }
+
+  bool ReadStoredObject(const ObjectId &hash, std::vector<uint8_t> &stored)
+  {
+    return GetObjectStore().ReadStored(hash, stored);
+  }
+
+  bool ReadObject(const ObjectId &hash, std::vector<uint8_t> &content)
+  {
+    return GetObjectStore().Read(hash, content);
+  }
+
+  std::string ReadObject(const ObjectId &hash)
+  {
+    std::vector<uint8_t> content;
+    if (!ReadObject(hash, content))
+    {
+      return "";
+    }
+    return std::string(content.begin(), content.end());
+  }
+
+  bool ObjectExists(const ObjectId &hash)
+  {
+    return GetObjectStore().Exists(hash);
+  }
+
+  std::vector<ObjectId> ListLooseObjects()
+  {
+    return LooseObjectStore().List();
+  }
+
+  std::vector<ObjectId> FindObjectsByPrefix(const std::string &prefix)
+  {
+    std::vector<ObjectId> matches;
+    ObjectId first, last;
+    if (!PrefixRange(prefix, first, last))
+    {
+      return matches;
+    }
+
+    // Every id from first to last starts with the prefix
+    for (const auto &pack : GetPacks())
+    {
+      for (uint32_t i = pack->LowerBound(first); i < pack->Count(); i++)
+      {
+        ObjectId id = pack->HashAt(i);
+        if (last < id)
+        {
+          break;
+        }
+        matches.push_back(id);
+      }
+    }
+
+    // A prefix of two or more digits selects a single fan-out directory
+    std::vector<std::string> fanouts;
+    if (GetRepositoryFormatVersion() < FORMAT_FANOUT_OBJECTS)
+    {
+      fanouts.push_back("");
+    }
+    else
+    {
+      for (int byte = first.bytes[0]; byte <= last.bytes[0]; byte++)
+      {
+        char name[3];
+        std::snprintf(name, sizeof(name), "%02x", byte);
+        fanouts.push_back(name);
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(looseListingsMutex);
+    for (const auto &fanout : fanouts)
+    {
+      const std::vector<ObjectId> &ids = LooseListing(fanout);
+      auto begin = std::lower_bound(ids.begin(), ids.end(), first);
+      auto end = std::upper_bound(begin, ids.end(), last);
+      matches.insert(matches.end(), begin, end);
+    }
+
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+    return matches;
+  }
+
+  std::vector<ObjectId> ResolveObjectId(const std::string &name, ObjectType type)
+  {
+    std::vector<ObjectId> candidates;
+    ObjectId id;
+    if (ObjectId::FromHex(name, id))
+    {
+      if (GetObjectStore().Exists(id))
+      {
+        candidates.push_back(id);
+      }
+    }
+    else if (name.size() >= MIN_ABBREV_LENGTH)
+    {
+      candidates = FindObjectsByPrefix(name);
+    }
+
+    if (type == ObjectType::Unknown)
+    {
+      return candidates;
+    }
+
+    std::vector<ObjectId> matches;
+    for (const auto &candidate : candidates)
+    {
+      ObjectInfo info;
+      if (GetObjectStore().Info(candidate, info) && info.type == type)
+      {
+        matches.push_back(candidate);
+      }
+    }
+    return matches;
+  }
+
+  void ReportAmbiguousId(std::ostream &out, const std::string &name, const std::vector<ObjectId> &matches)
+  {
+    out << "Error: Short hash '" << name << "' is ambiguous, it matches " << matches.size() << " objects:" << std::endl;
+    for (const auto &id : matches)
+    {
+      ObjectInfo info;
+      out << "  " << id;
+      if (GetObjectStore().Info(id, info))
+      {
+        out << " " << ObjectTypeName(info.type);
+      }
+      out << std::endl;
+    }
+  }
+
+  FsyncMode GetFsyncMode()
+  {
+    std::string mode = GetConfig("core.fsync", "batch");
+    if (mode == "none")
+    {
+      return FsyncMode::None;
+    }
+    if (mode == "object")
+    {
+      return FsyncMode::Object;
+    }
+    return FsyncMode::Batch;
+  }
+
+  void MarkObjectsForSync()
+  {
+    if (GetFsyncMode() != FsyncMode::None)
+    {
+      syncPending = true;
+    }
+  }
+
+  bool SyncObjects()
+  {
+    return GetObjectStore().Sync();
+  }
+
+  const ObjectWriteStats &GetObjectWriteStats()
+  {
+    return writeStats;
+  }
+
+  void FlushKnownObjects()
+  {
+    knownObjects.Flush();
+    objectFilter.Save();
+  }
+
+  void PrintObjectStoreStats(std::ostream &out)
+  {
+    out << "Object writes: " << writeStats.written << " written, " << writeStats.skipped << " already stored"
+        << std::endl;
+    out << "Object filter: " << objectFilter.Negatives() << " lookup(s) answered without touching the store"
+        << std::endl;
+  }
+
+  void ForgetKnownObjects()
+  {
+    std::error_code ec;
+    knownObjects.Reset();
+    fs::remove(DEFAULT_PATH + "/known-objects", ec);
+    objectFilter.Reset();
+  }
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <istream>
+#include "codec.hpp"
+#include "object_id.hpp"
+
+namespace utils
+{
+  // Storage backend for content-addressed objects. Commands reach the
+  // repository's store through GetObjectStore() (or the ReadObject/WriteObject
+  // helpers in main.hpp) and never build object paths themselves.
+  class ObjectStore
+  {
+  public:
+    virtual ~ObjectStore() = default;
+
+    // Read and decode an object's content
+    virtual bool Read(const ObjectId &hash, std::vector<uint8_t> &content) = 0;
+
+    // Read an object's stored form, which DecodeObject turns back into content
+    virtual bool ReadStored(const ObjectId &hash, std::vector<uint8_t> &stored);
+
+    // Store an object, returns true if the object is present afterwards
+    virtual bool Write(const ObjectId &hash, const std::vector<uint8_t> &content, ObjectType type) = 0;
+
+    // Store content read from a stream and set hash to the repository's object
+    // hash of it (core.hash).
+    // The default reads the whole stream; stores that can write as they
+    // hash override it to keep memory use constant.
+    virtual bool WriteStream(std::istream &in, ObjectId &hash);
+
+    // Store the file at path like WriteStream. Stores that keep raw copies of
+    // files override it to copy the file inside the kernel.
+    virtual bool WriteFile(const std::string &path, ObjectId &hash);
+
+    // Path of a file holding exactly the object's content, for objects of at
+    // least minSize bytes; empty when there is none. Such a file can be
+    // copied with CloneFile or hard-linked instead of decoded.
+    virtual std::string RawPath(const ObjectId &/*hash*/, size_t /*minSize*/) { return ""; }
+
+    // Check whether the store holds an object
+    virtual bool Exists(const ObjectId &hash) = 0;
+
+    // Look up an object's type and size. Stores that record them in a header
+    // override it to read only that; the default reads the whole object.
+    virtual bool Info(const ObjectId &hash, ObjectInfo &info);
+
+    // Pass an object's content to sink in pieces
+    virtual bool Stream(const ObjectId &hash, const ByteSink &sink);
+
+    // Read several objects, found[i] tells whether contents[i] was filled
+    virtual std::vector<bool> ReadBatch(const std::vector<ObjectId> &hashes,
+                                        std::vector<std::vector<uint8_t>> &contents);
+
+    // Write several objects, returns false if any of them failed
+    virtual bool WriteBatch(const std::vector<ObjectId> &hashes,
+                            const std::vector<std::vector<uint8_t>> &contents);
+
+    // Hashes of every object in the store
+    virtual std::vector<ObjectId> List() = 0;
+
+    // Make earlier writes durable
+    virtual bool Sync() { return true; }
+  };
+
+  // One file per object under .microgit/objects, laid out by ObjectPath
+  class LooseObjectStore : public ObjectStore
+  {
+  public:
+    bool Read(const ObjectId &hash, std::vector<uint8_t> &content) override;
+    bool ReadStored(const ObjectId &hash, std::vector<uint8_t> &stored) override;
+    bool Write(const ObjectId &hash, const std::vector<uint8_t> &content, ObjectType type) override;
+    bool WriteStream(std::istream &in, ObjectId &hash) override;
+    bool WriteFile(const std::string &path, ObjectId &hash) override;
+    std::string RawPath(const ObjectId &hash, size_t minSize) override;
+    bool Exists(const ObjectId &hash) override;
+    bool Info(const ObjectId &hash, ObjectInfo &info) override;
+    bool Stream(const ObjectId &hash, const ByteSink &sink) override;
+    std::vector<bool> ReadBatch(const std::vector<ObjectId> &hashes,
+                                std::vector<std::vector<uint8_t>> &contents) override;
+    bool WriteBatch(const std::vector<ObjectId> &hashes,
+                    const std::vector<std::vector<uint8_t>> &contents) override;
+    std::vector<ObjectId> List() override;
+    bool Sync() override;
+
+    // The two halves of WriteStream and WriteFile, for stores that decide in
+    // between whether the object is needed: hash and encode the content into
+    // a temp file, then either move it into place or throw it away
+    bool StreamToTemp(std::istream &in, ObjectId &hash, std::string &tempPath);
+    bool FileToTemp(const std::string &path, ObjectId &hash, std::string &tempPath);
+    bool Publish(const std::string &tempPath, const ObjectId &hash);
+    void Discard(const std::string &tempPath, const ObjectId &hash);
+
+    // WriteBatch restricted to the entries at indexes
+    bool WriteSelected(const std::vector<ObjectId> &hashes,
+                       const std::vector<std::vector<uint8_t>> &contents,
+                       const std::vector<size_t> &indexes);
+  };
+
+  // Read-only view of the repository's packfiles; packs are written by WritePack
+  class PackObjectStore : public ObjectStore
+  {
+  public:
+    bool Read(const ObjectId &hash, std::vector<uint8_t> &content) override;
+    bool ReadStored(const ObjectId &hash, std::vector<uint8_t> &stored) override;
+    bool Write(const ObjectId &hash, const std::vector<uint8_t> &content, ObjectType type) override;
+    bool Exists(const ObjectId &hash) override;
+    bool Info(const ObjectId &hash, ObjectInfo &info) override;
+    std::vector<ObjectId> List() override;
+  };
+
+  // Objects kept in a hash map, for tests and benchmarks
+  class MemoryObjectStore : public ObjectStore
+  {
+  public:
+    bool Read(const ObjectId &hash, std::vector<uint8_t> &content) override;
+    bool Write(const ObjectId &hash, const std::vector<uint8_t> &content, ObjectType type) override;
+    bool Exists(const ObjectId &hash) override;
+    bool Stream(const ObjectId &hash, const ByteSink &sink) override;
+    std::vector<ObjectId> List() override;
+
+  private:
+    std::unordered_map<ObjectId, std::vector<uint8_t>> objects;
+    std::mutex mutex;
+  };
+
+  // The repository's store: packs are consulted first, new objects go to
+  // the loose store unless a pack already holds them
+  class RepositoryObjectStore : public ObjectStore
+  {
+  public:
+    bool Read(const ObjectId &hash, std::vector<uint8_t> &content) override;
+    bool ReadStored(const ObjectId &hash, std::vector<uint8_t> &stored) override;
+    bool Write(const ObjectId &hash, const std::vector<uint8_t> &content, ObjectType type) override;
+    bool WriteStream(std::istream &in, ObjectId &hash) override;
+    bool WriteFile(const std::string &path, ObjectId &hash) override;
+    std::string RawPath(const ObjectId &hash, size_t minSize) override;
+    bool Exists(const ObjectId &hash) override;
+    bool Info(const ObjectId &hash, ObjectInfo &info) override;
+    bool Stream(const ObjectId &hash, const ByteSink &sink) override;
+    std::vector<bool> ReadBatch(const std::vector<ObjectId> &hashes,
+                                std::vector<std::vector<uint8_t>> &contents) override;
+    bool WriteBatch(const std::vector<ObjectId> &hashes,
+                    const std::vector<std::vector<uint8_t>> &contents) override;
+    std::vector<ObjectId> List() override;
+    bool Sync() override;
+
+  private:
+    // Publish a temp file written by the loose store unless the object is already stored
+    bool Commit(const std::string &tempPath, const ObjectId &hash);
+
+    // Whether a write of hash can be skipped
+    bool AlreadyStored(const ObjectId &hash);
+
+    PackObjectStore packs;
+    LooseObjectStore loose;
+  };
+
+  // Work out the type of object content that carries no type, e.g. objects
+  // written before the typed header existed
+  ObjectType ClassifyContent(const std::vector<uint8_t> &content);
+
+  // The store used by every command
+  ObjectStore &GetObjectStore();
+
+  // Replace the store used by every command, nullptr restores the repository store
+  void SetObjectStore(std::unique_ptr<ObjectStore> store);
+}
@@ -0,0 +1,662 @@
+#include "pack.hpp"
+#include "main.hpp"
+#include "codec.hpp"
+#include "config.hpp"
+#include "delta.hpp"
+#include <algorithm>
+#include <set>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace utils
+{
+  namespace
+  {
+    const char PACK_MAGIC[4] = {'M', 'G', 'P', 'K'};
+    const char INDEX_MAGIC[4] = {'M', 'G', 'I', 'X'};
+    const size_t PACK_HEADER_SIZE = 12;
+    const size_t INDEX_HEADER_SIZE = 16;
+    const size_t FANOUT_SIZE = 256 * 4;
+    const size_t HASH_BYTES = 32;
+    const size_t INDEX_ENTRY_SIZE = HASH_BYTES + 8;
+    const size_t ENTRY_HEADER_SIZE = 1 + 8;
+
+    // Deeper chains than this can only come from a corrupt pack
+    const int MAX_DELTA_RESOLVE_DEPTH = 1000;
+
+    uint32_t ReadU32(const uint8_t *p)
+    {
+      return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+             static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+    }
+
+    uint64_t ReadU64(const uint8_t *p)
+    {
+      return static_cast<uint64_t>(ReadU32(p)) | static_cast<uint64_t>(ReadU32(p + 4)) << 32;
+    }
+
+    void PutU32(std::string &out, uint32_t value)
+    {
+      for (int i = 0; i < 4; i++)
+      {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+      }
+    }
+
+    void PutU64(std::string &out, uint64_t value)
+    {
+      PutU32(out, static_cast<uint32_t>(value));
+      PutU32(out, static_cast<uint32_t>(value >> 32));
+    }
+
+    // Map a whole file read-only, returns nullptr on failure
+    const uint8_t *MapFile(const fs::path &path, size_t &size)
+    {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+      {
+        return nullptr;
+      }
+
+      struct stat st;
+      if (fstat(fd, &st) != 0 || st.st_size == 0)
+      {
+        close(fd);
+        return nullptr;
+      }
+
+      size = static_cast<size_t>(st.st_size);
+      void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      close(fd);
+      if (data == MAP_FAILED)
+      {
+        return nullptr;
+      }
+      return static_cast<const uint8_t *>(data);
+    }
+
+    std::vector<std::unique_ptr<PackReader>> packs;
+    bool packsLoaded = false;
+    std::mutex packsMutex;
+  }
+
+  PackReader::~PackReader()
+  {
+    if (packData)
+    {
+      munmap(const_cast<uint8_t *>(packData), packSize);
+    }
+    if (indexData)
+    {
+      munmap(const_cast<uint8_t *>(indexData), indexSize);
+    }
+  }
+
+  std::unique_ptr<PackReader> PackReader::Open(const fs::path &packPath, const fs::path &knownIndexPath)
+  {
+    std::unique_ptr<PackReader> reader(new PackReader());
+    reader->packPath = packPath;
+
+    fs::path indexPath = knownIndexPath;
+    if (indexPath.empty())
+    {
+      indexPath = packPath;
+      indexPath.replace_extension(".idx");
+    }
+
+    reader->packData = MapFile(packPath, reader->packSize);
+    reader->indexData = MapFile(indexPath, reader->indexSize);
+    if (!reader->packData || !reader->indexData)
+    {
+      return nullptr;
+    }
+
+    if (reader->packSize < PACK_HEADER_SIZE ||
+        std::memcmp(reader->packData, PACK_MAGIC, 4) != 0 ||
+        ReadU32(reader->packData + 4) != PACK_VERSION)
+    {
+      return nullptr;
+    }
+
+    if (reader->indexSize < INDEX_HEADER_SIZE + FANOUT_SIZE ||
+        std::memcmp(reader->indexData, INDEX_MAGIC, 4) != 0 ||
+        ReadU32(reader->indexData + 4) != PACK_VERSION)
+    {
+      return nullptr;
+    }
+
+    int cacheLimit = GetConfigInt("pack.deltacachesize", static_cast<int>(DEFAULT_DELTA_CACHE_SIZE));
+    reader->baseCacheLimit = cacheLimit > 0 ? static_cast<size_t>(cacheLimit) : 0;
+
+    reader->count = ReadU32(reader->indexData + 8);
+    if (reader->indexSize < INDEX_HEADER_SIZE + FANOUT_SIZE + static_cast<size_t>(reader->count) * INDEX_ENTRY_SIZE)
+    {
+      return nullptr;
+    }
+
+    return reader;
+  }
+
+  uint32_t PackReader::LowerBound(const ObjectId &hash) const
+  {
+    const uint8_t *key = hash.Data();
+
+    // The fan-out table narrows the search to entries sharing the first byte
+    const uint8_t *fanout = indexData + INDEX_HEADER_SIZE;
+    uint32_t lo = key[0] == 0 ? 0 : ReadU32(fanout + 4 * (key[0] - 1));
+    uint32_t hi = ReadU32(fanout + 4 * key[0]);
+
+    const uint8_t *entries = fanout + FANOUT_SIZE;
+    while (lo < hi)
+    {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (std::memcmp(entries + static_cast<size_t>(mid) * INDEX_ENTRY_SIZE, key, HASH_BYTES) < 0)
+      {
+        lo = mid + 1;
+      }
+      else
+      {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  bool PackReader::Find(const ObjectId &hash, uint64_t &offset) const
+  {
+    uint32_t i = LowerBound(hash);
+    const uint8_t *entry = indexData + INDEX_HEADER_SIZE + FANOUT_SIZE + static_cast<size_t>(i) * INDEX_ENTRY_SIZE;
+    if (i == count || std::memcmp(entry, hash.Data(), HASH_BYTES) != 0)
+    {
+      return false;
+    }
+    offset = ReadU64(entry + HASH_BYTES);
+    return true;
+  }
+
+  bool PackReader::Contains(const ObjectId &hash) const
+  {
+    uint64_t offset;
+    return Find(hash, offset);
+  }
+
+  bool PackReader::Read(const ObjectId &hash, std::vector<uint8_t> &content) const
+  {
+    uint64_t offset;
+    if (!Find(hash, offset) || offset + ENTRY_HEADER_SIZE > packSize)
+    {
+      return false;
+    }
+
+    const uint8_t *entry = packData + offset;
+    uint8_t kind = entry[0];
+    uint64_t length = ReadU64(entry + 1);
+    if (length > packSize - offset - ENTRY_HEADER_SIZE)
+    {
+      return false;
+    }
+
+    if (kind == PACK_ENTRY_FULL)
+    {
+      const uint8_t *data = entry + ENTRY_HEADER_SIZE;
+      content.assign(data, data + length);
+      return true;
+    }
+
+    // Deltas have no stored form of their own, hand back the content uncompressed
+    std::vector<uint8_t> decoded;
+    ObjectInfo info;
+    if (!ReadEntry(offset, decoded, 0) || !EntryInfo(offset, info, 0))
+    {
+      return false;
+    }
+    content = EncodeObject(decoded, 0, info.type);
+    return true;
+  }
+
+  bool PackReader::Info(const ObjectId &hash, ObjectInfo &info) const
+  {
+    uint64_t offset;
+    return Find(hash, offset) && EntryInfo(offset, info, 0);
+  }
+
+  bool PackReader::EntryInfo(uint64_t offset, ObjectInfo &info, int depth) const
+  {
+    if (depth > MAX_DELTA_RESOLVE_DEPTH || offset + ENTRY_HEADER_SIZE > packSize)
+    {
+      return false;
+    }
+
+    const uint8_t *entry = packData + offset;
+    uint8_t kind = entry[0];
+    uint64_t length = ReadU64(entry + 1);
+    if (length > packSize - offset - ENTRY_HEADER_SIZE)
+    {
+      return false;
+    }
+
+    const uint8_t *data = entry + ENTRY_HEADER_SIZE;
+    if (kind == PACK_ENTRY_FULL)
+    {
+      ObjectHeader header;
+      if (!ParseObjectHeader(data, length, header))
+      {
+        return false;
+      }
+      info.type = header.length == 0 ? RawObjectType(data, length) : header.type;
+      info.size = header.size;
+      if (info.size == OBJECT_SIZE_UNKNOWN)
+      {
+        // Older header without a size, only decoding tells
+        std::vector<uint8_t> content;
+        if (!ReadEntry(offset, content, depth))
+        {
+          return false;
+        }
+        info.size = content.size();
+      }
+      return true;
+    }
+
+    if (kind != PACK_ENTRY_DELTA || length < HASH_BYTES)
+    {
+      return false;
+    }
+
+    // The delta records the target size up front, the type is the base's
+    uint64_t baseOffset;
+    std::vector<uint8_t> delta;
+    if (!Find(ObjectId(data), baseOffset) ||
+        !DecodeObject(std::vector<uint8_t>(data + HASH_BYTES, data + length), delta) ||
+        !DeltaTargetSize(delta, info.size))
+    {
+      return false;
+    }
+    uint64_t size = info.size;
+    if (!EntryInfo(baseOffset, info, depth + 1))
+    {
+      return false;
+    }
+    info.size = size;
+    return true;
+  }
+
+  bool PackReader::ReadContent(const ObjectId &hash, std::vector<uint8_t> &content) const
+  {
+    uint64_t offset;
+    return Find(hash, offset) && ReadEntry(offset, content, 0);
+  }
+
+  bool PackReader::ReadEntry(uint64_t offset, std::vector<uint8_t> &content, int depth) const
+  {
+    if (depth > MAX_DELTA_RESOLVE_DEPTH || offset + ENTRY_HEADER_SIZE > packSize)
+    {
+      return false;
+    }
+
+    const uint8_t *entry = packData + offset;
+    uint8_t kind = entry[0];
+    uint64_t length = ReadU64(entry + 1);
+    if (length > packSize - offset - ENTRY_HEADER_SIZE)
+    {
+      return false;
+    }
+
+    const uint8_t *data = entry + ENTRY_HEADER_SIZE;
+    if (kind == PACK_ENTRY_FULL)
+    {
+      std::vector<uint8_t> stored(data, data + length);
+      if (!HasCodecHeader(stored.data(), stored.size()))
+      {
+        content.swap(stored);
+        return true;
+      }
+      return DecodeObject(stored, content);
+    }
+
+    if (kind != PACK_ENTRY_DELTA || length < HASH_BYTES)
+    {
+      return false;
+    }
+
+    uint64_t baseOffset;
+    if (!Find(ObjectId(data), baseOffset))
+    {
+      return false;
+    }
+
+    // Resolve the base through the cache so walking a chain stays linear
+    std::shared_ptr<const std::vector<uint8_t>> base = CachedBase(baseOffset);
+    if (!base)
+    {
+      std::vector<uint8_t> baseContent;
+      if (!ReadEntry(baseOffset, baseContent, depth + 1))
+      {
+        return false;
+      }
+      base = std::make_shared<const std::vector<uint8_t>>(std::move(baseContent));
+      CacheBase(baseOffset, *base);
+    }
+
+    std::vector<uint8_t> storedDelta(data + HASH_BYTES, data + length);
+    std::vector<uint8_t> delta;
+    if (!DecodeObject(storedDelta, delta))
+    {
+      return false;
+    }
+    return ApplyDelta(*base, delta, content);
+  }
+
+  void PackReader::CacheBase(uint64_t offset, const std::vector<uint8_t> &content) const
+  {
+    std::lock_guard<std::mutex> lock(baseCacheMutex);
+    if (content.size() > baseCacheLimit || baseCacheIndex.count(offset))
+    {
+      return;
+    }
+
+    baseCache.emplace_front(offset, std::make_shared<const std::vector<uint8_t>>(content));
+    baseCacheIndex[offset] = baseCache.begin();
+    baseCacheBytes += content.size();
+
+    while (baseCacheBytes > baseCacheLimit)
+    {
+      auto &oldest = baseCache.back();
+      baseCacheBytes -= oldest.second->size();
+      baseCacheIndex.erase(oldest.first);
+      baseCache.pop_back();
+    }
+  }
+
+  std::shared_ptr<const std::vector<uint8_t>> PackReader::CachedBase(uint64_t offset) const
+  {
+    std::lock_guard<std::mutex> lock(baseCacheMutex);
+    auto it = baseCacheIndex.find(offset);
+    if (it == baseCacheIndex.end())
+    {
+      return nullptr;
+    }
+
+    // Move to the front so it is evicted last
+    baseCache.splice(baseCache.begin(), baseCache, it->second);
+    return it->second->second;
+  }
+
+  ObjectId PackReader::HashAt(uint32_t i) const
+  {
+    return ObjectId(indexData + INDEX_HEADER_SIZE + FANOUT_SIZE + static_cast<size_t>(i) * INDEX_ENTRY_SIZE);
+  }
+
+  fs::path PackDirectory()
+  {
+    return fs::path(DEFAULT_PATH) / "objects" / "pack";
+  }
+
+  const std::vector<std::unique_ptr<PackReader>> &GetPacks()
+  {
+    std::lock_guard<std::mutex> lock(packsMutex);
+    if (packsLoaded)
+    {
+      return packs;
+    }
+
+    packsLoaded = true;
+    packs.clear();
+
+    std::error_code ec;
+    if (!fs::is_directory(PackDirectory(), ec))
+    {
+      return packs;
+    }
+
+    for (const auto &entry : fs::directory_iterator(PackDirectory(), ec))
+    {
+      if (entry.path().extension() != ".pack")
+      {
+        continue;
+      }
+
+      auto reader = PackReader::Open(entry.path());
+      if (reader)
+      {
+        packs.push_back(std::move(reader));
+      }
+    }
+    return packs;
+  }
+
+  void ReloadPacks()
+  {
+    std::lock_guard<std::mutex> lock(packsMutex);
+    packs.clear();
+    packsLoaded = false;
+  }
+
+  bool ReadPackedObject(const ObjectId &hash, std::vector<uint8_t> &content)
+  {
+    for (const auto &pack : GetPacks())
+    {
+      if (pack->Read(hash, content))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool ReadPackedContent(const ObjectId &hash, std::vector<uint8_t> &content)
+  {
+    for (const auto &pack : GetPacks())
+    {
+      if (pack->ReadContent(hash, content))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool HasPackedObject(const ObjectId &hash)
+  {
+    for (const auto &pack : GetPacks())
+    {
+      if (pack->Contains(hash))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Check that a written pack serves every object it was asked to hold,
+  // decoding each one and comparing its hash
+  static bool VerifyPack(const fs::path &packPath, const fs::path &indexPath, const std::vector<ObjectId> &hashes)
+  {
+    std::unique_ptr<PackReader> pack = PackReader::Open(packPath, indexPath);
+    if (!pack || pack->Count() != hashes.size())
+    {
+      return false;
+    }
+    std::vector<uint8_t> content;
+    for (const auto &hash : hashes)
+    {
+      if (!pack->ReadContent(hash, content) || HashContent(content) != hash)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  fs::path WritePack(const std::vector<ObjectId> &hashes, const std::map<ObjectId, ObjectId> &deltaBases)
+  {
+    std::vector<ObjectId> sorted(hashes);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    // Name the pack after the set of objects it contains
+    std::string names;
+    for (const auto &hash : sorted)
+    {
+      names += hash.Hex();
+    }
+    std::string packName = "pack-" + HashContent(std::vector<uint8_t>(names.begin(), names.end())).Hex();
+
+    fs::path packPath = PackDirectory() / (packName + ".pack");
+    fs::path indexPath = PackDirectory() / (packName + ".idx");
+    fs::path tmpPackPath = PackDirectory() / (packName + ".pack.tmp");
+    fs::path tmpIndexPath = PackDirectory() / (packName + ".idx.tmp");
+
+    try
+    {
+      fs::create_directories(PackDirectory());
+
+      std::ofstream packFile(tmpPackPath, std::ios::binary | std::ios::trunc);
+      if (!packFile)
+      {
+        return fs::path();
+      }
+
+      std::string header(PACK_MAGIC, 4);
+      PutU32(header, PACK_VERSION);
+      PutU32(header, static_cast<uint32_t>(sorted.size()));
+      packFile.write(header.data(), header.size());
+
+      // Bases are written before the deltas against them, so a delta only
+      // ever refers to an object already in this pack
+      std::vector<ObjectId> order;
+      std::set<ObjectId> scheduled;
+      for (const auto &hash : sorted)
+      {
+        std::vector<ObjectId> chain;
+        ObjectId next = hash;
+        while (!scheduled.count(next) && std::binary_search(sorted.begin(), sorted.end(), next))
+        {
+          scheduled.insert(next);
+          chain.push_back(next);
+          auto baseIt = deltaBases.find(next);
+          if (baseIt == deltaBases.end())
+          {
+            break;
+          }
+          next = baseIt->second;
+        }
+        order.insert(order.end(), chain.rbegin(), chain.rend());
+      }
+
+      uint64_t offset = header.size();
+      std::vector<std::pair<ObjectId, uint64_t>> entries;
+      std::set<ObjectId> written;
+      std::vector<uint8_t> content;
+      int compressionLevel = GetCompressionLevel();
+      for (const auto &hash : order)
+      {
+        if (hash.IsNull() || !ReadStoredObject(hash, content))
+        {
+          // Callers delete the old copies once the pack is written, so an
+          // object that cannot be read fails the whole pack
+          packFile.close();
+          fs::remove(tmpPackPath);
+          return fs::path();
+        }
+
+        uint8_t kind = PACK_ENTRY_FULL;
+        auto baseIt = deltaBases.find(hash);
+        if (baseIt != deltaBases.end() && written.count(baseIt->second))
+        {
+          std::vector<uint8_t> base, target;
+          if (ReadObject(baseIt->second, base) && ReadObject(hash, target))
+          {
+            // Only keep the delta when it beats the stored object
+            std::vector<uint8_t> storedDelta = EncodeObject(CreateDelta(base, target), compressionLevel,
+                                                            ObjectType::Delta);
+            if (HASH_BYTES + storedDelta.size() < content.size())
+            {
+              kind = PACK_ENTRY_DELTA;
+              content.assign(baseIt->second.Data(), baseIt->second.Data() + HASH_BYTES);
+              content.insert(content.end(), storedDelta.begin(), storedDelta.end());
+            }
+          }
+        }
+
+        std::string entryHeader(1, static_cast<char>(kind));
+        PutU64(entryHeader, content.size());
+        packFile.write(entryHeader.data(), entryHeader.size());
+        packFile.write(reinterpret_cast<const char *>(content.data()), content.size());
+
+        entries.emplace_back(hash, offset);
+        written.insert(hash);
+        offset += entryHeader.size() + content.size();
+      }
+
+      packFile.close();
+      if (packFile.fail())
+      {
+        fs::remove(tmpPackPath);
+        return fs::path();
+      }
+
+      // The index is sorted by hash
+      std::sort(entries.begin(), entries.end());
+      std::string index(INDEX_MAGIC, 4);
+      PutU32(index, PACK_VERSION);
+      PutU32(index, static_cast<uint32_t>(entries.size()));
+      PutU32(index, 0);
+
+      uint32_t fanout[256] = {0};
+      for (const auto &entry : entries)
+      {
+        fanout[entry.first.bytes[0]]++;
+      }
+      uint32_t running = 0;
+      for (int i = 0; i < 256; i++)
+      {
+        running += fanout[i];
+        PutU32(index, running);
+      }
+
+      for (const auto &entry : entries)
+      {
+        index.append(reinterpret_cast<const char *>(entry.first.Data()), HASH_BYTES);
+        PutU64(index, entry.second);
+      }
+
+      std::ofstream indexFile(tmpIndexPath, std::ios::binary | std::ios::trunc);
+      indexFile.write(index.data(), index.size());
+      indexFile.close();
+      if (indexFile.fail())
+      {
+        fs::remove(tmpPackPath);
+        fs::remove(tmpIndexPath);
+        return fs::path();
+      }
+
+      // Only a pack that reads back whole replaces anything
+      if (!VerifyPack(tmpPackPath, tmpIndexPath, sorted))
+      {
+        fs::remove(tmpPackPath);
+        fs::remove(tmpIndexPath);
+        return fs::path();
+      }
+
+      // Publish the pack before its index so readers never see a dangling index
+      fs::rename(tmpPackPath, packPath);
+      fs::rename(tmpIndexPath, indexPath);
+      ReloadPacks();
+      return packPath;
+    }
+    catch (const std::exception &)
+    {
+      std::error_code ec;
+      fs::remove(tmpPackPath, ec);
+      fs::remove(tmpIndexPath, ec);
+      return fs::path();
+    }
+  }
+}
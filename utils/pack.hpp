@@ -0,0 +1,137 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <map>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+#include <filesystem>
+#include "codec.hpp"
+#include "object_id.hpp"
+
+namespace utils
+{
+  // Packfiles consolidate many objects into a single file under objects/pack/.
+  //
+  // pack-<name>.pack: "MGPK" | version u32 | count u32, then one entry per object:
+  //   kind u8 | length u64 | data
+  // where data is the stored object bytes (see codec.hpp) for full entries, or
+  // the base's binary hash (32 bytes) followed by a stored delta (see delta.hpp)
+  // for delta entries. A delta's base always lives in the same pack.
+  // pack-<name>.idx:  "MGIX" | version u32 | count u32 | reserved u32,
+  //   fan-out table of 256 u32 (entries whose first byte <= i), then
+  //   count sorted entries of binary hash (32 bytes) | pack offset u64
+  // All integers are little-endian.
+
+  const uint32_t PACK_VERSION = 1;
+
+  // Pack entry kinds
+  const uint8_t PACK_ENTRY_FULL = 0;
+  const uint8_t PACK_ENTRY_DELTA = 1;
+
+  // Longest delta chain written when no pack.depth setting exists
+  const int DEFAULT_PACK_DEPTH = 10;
+
+  // Byte budget of the delta base cache when no pack.deltacachesize setting exists
+  const size_t DEFAULT_DELTA_CACHE_SIZE = 32 * 1024 * 1024;
+
+  // A read-only view of one packfile and its index, both memory-mapped
+  class PackReader
+  {
+  public:
+    ~PackReader();
+
+    // Map a pack and its index, returns nullptr if either is missing or
+    // malformed. The index is found next to the pack unless indexPath is given.
+    static std::unique_ptr<PackReader> Open(const std::filesystem::path &packPath,
+                                            const std::filesystem::path &indexPath = {});
+
+    // Binary search the index for a hash
+    bool Contains(const ObjectId &hash) const;
+
+    // Read an object's stored bytes from the pack, delta entries are resolved
+    bool Read(const ObjectId &hash, std::vector<uint8_t> &content) const;
+
+    // Read and decode an object's content, resolving delta chains
+    bool ReadContent(const ObjectId &hash, std::vector<uint8_t> &content) const;
+
+    // Read an object's type and size from its entry. Types the entry does not
+    // record are left Unknown; delta entries take the type of their base.
+    bool Info(const ObjectId &hash, ObjectInfo &info) const;
+
+    // Number of objects in the pack
+    uint32_t Count() const { return count; }
+
+    // Id of the i-th index entry (entries are sorted)
+    ObjectId HashAt(uint32_t i) const;
+
+    // Position of the first index entry not less than hash, Count() if none
+    uint32_t LowerBound(const ObjectId &hash) const;
+
+    const std::filesystem::path &Path() const { return packPath; }
+
+  private:
+    PackReader() = default;
+
+    // Locate the index entry for a hash, returns false if not present
+    bool Find(const ObjectId &hash, uint64_t &offset) const;
+
+    // Decode the entry at offset, depth guards against corrupt delta loops
+    bool ReadEntry(uint64_t offset, std::vector<uint8_t> &content, int depth) const;
+
+    // Info for the entry at offset, depth as for ReadEntry
+    bool EntryInfo(uint64_t offset, ObjectInfo &info, int depth) const;
+
+    // Remember the decoded content of a delta base (least recently used is evicted first)
+    void CacheBase(uint64_t offset, const std::vector<uint8_t> &content) const;
+
+    // Look up a cached delta base, returns nullptr on a miss
+    std::shared_ptr<const std::vector<uint8_t>> CachedBase(uint64_t offset) const;
+
+    std::filesystem::path packPath;
+    const uint8_t *packData = nullptr;
+    size_t packSize = 0;
+    const uint8_t *indexData = nullptr;
+    size_t indexSize = 0;
+    uint32_t count = 0;
+
+    // Reconstructed delta bases so successive versions of a path resolve quickly,
+    // shared between threads reading the same pack
+    using CacheList = std::list<std::pair<uint64_t, std::shared_ptr<const std::vector<uint8_t>>>>;
+    mutable CacheList baseCache;
+    mutable std::unordered_map<uint64_t, CacheList::iterator> baseCacheIndex;
+    mutable size_t baseCacheBytes = 0;
+    size_t baseCacheLimit = DEFAULT_DELTA_CACHE_SIZE;
+    mutable std::mutex baseCacheMutex;
+  };
+
+  // Directory holding the repository's packfiles
+  std::filesystem::path PackDirectory();
+
+  // All packs in the repository, opened on first use
+  const std::vector<std::unique_ptr<PackReader>> &GetPacks();
+
+  // Forget the opened packs so the next lookup rescans the pack directory
+  void ReloadPacks();
+
+  // Read an object's stored bytes from any pack
+  bool ReadPackedObject(const ObjectId &hash, std::vector<uint8_t> &content);
+
+  // Read and decode an object's content from any pack
+  bool ReadPackedContent(const ObjectId &hash, std::vector<uint8_t> &content);
+
+  // Check whether any pack holds the object
+  bool HasPackedObject(const ObjectId &hash);
+
+  // Write the given objects into a new pack and index, returns the pack path
+  // or an empty path on failure. Fails if any object cannot be read, and the
+  // pack is only published once every object reads back from it, so callers
+  // may delete the old copies. Objects listed in deltaBases (target -> base)
+  // are stored as deltas when that is smaller, all others are copied in their
+  // stored (encoded) form. Bases must be among the packed objects.
+  std::filesystem::path WritePack(const std::vector<ObjectId> &hashes,
+                                  const std::map<ObjectId, ObjectId> &deltaBases = {});
+}
@@ -0,0 +1,43 @@
+#include "parallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace utils
+{
+  size_t DefaultWorkerCount()
+  {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  void ParallelFor(size_t count, size_t workers, const std::function<void(size_t)> &fn)
+  {
+    workers = std::min(std::max<size_t>(workers, 1), count);
+    if (workers <= 1)
+    {
+      // Not worth a thread
+      for (size_t i = 0; i < count; i++)
+      {
+        fn(i);
+      }
+      return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers; i++)
+    {
+      threads.emplace_back([&]()
+                           {
+        for (size_t index = next++; index < count; index = next++)
+        {
+          fn(index);
+        } });
+    }
+    for (auto &thread : threads)
+    {
+      thread.join();
+    }
+  }
+}
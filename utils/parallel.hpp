@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace utils
+{
+  // One worker per core, at least one
+  size_t DefaultWorkerCount();
+
+  // Run fn(0) .. fn(count - 1) on up to workers threads and wait for all of
+  // them. Indexes are handed out in order, fn must be safe to call concurrently.
+  void ParallelFor(size_t count, size_t workers, const std::function<void(size_t)> &fn);
+}
@@ -0,0 +1,42 @@
+#include "sha256_lanes.hpp"
+#include <immintrin.h>
+
+namespace utils
+{
+  namespace
+  {
+    // Eight lanes in a 256-bit register
+    struct Avx2Lanes
+    {
+      typedef __m256i Type;
+      static constexpr size_t LANES = 8;
+
+      static Type Load(const uint32_t *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+      static void Store(uint32_t *p, Type x) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), x); }
+      static Type Set1(uint32_t x) { return _mm256_set1_epi32(static_cast<int>(x)); }
+      static Type Add(Type a, Type b) { return _mm256_add_epi32(a, b); }
+      static Type Xor3(Type a, Type b, Type c) { return _mm256_xor_si256(_mm256_xor_si256(a, b), c); }
+
+      // (e & f) ^ (~e & g)
+      static Type Ch(Type e, Type f, Type g) { return _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g)); }
+
+      // (a & b) | (c & (a | b)), the majority of each bit
+      static Type Maj(Type a, Type b, Type c)
+      {
+        return _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+      }
+
+      template <int N>
+      static Type Rotr(Type x) { return _mm256_or_si256(_mm256_srli_epi32(x, N), _mm256_slli_epi32(x, 32 - N)); }
+
+      template <int N>
+      static Type Shr(Type x) { return _mm256_srli_epi32(x, N); }
+    };
+  }
+
+  void Sha256MultiAvx2(const uint8_t *const *data, const size_t *sizes, size_t count,
+                       uint8_t (*digests)[SHA256_DIGEST_LEN])
+  {
+    HashLanes<Avx2Lanes>(data, sizes, count, digests);
+  }
+}
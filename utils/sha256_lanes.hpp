@@ -0,0 +1,211 @@
+#pragma once
+
+// The lane scheduling and rounds of multi-buffer SHA-256, written once over a
+// vector type that supplies the 32-bit lane operations. Only included by the
+// per-instruction-set sources: everything here has internal linkage, so none
+// of the code built with their -m flags is shared with the rest of the
+// program, where the CPU may not have those instructions.
+
+#include "sha256_multi.hpp"
+#include <cstring>
+
+namespace utils
+{
+  namespace
+  {
+    const uint32_t SHA256_IV[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                                   0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+    const uint32_t SHA256_K[64] = {
+        0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+        0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+        0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+        0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+        0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+        0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+        0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+        0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2};
+
+    const size_t SHA256_BLOCK_LEN = 64;
+
+    inline uint32_t LoadBigEndian(const uint8_t *p)
+    {
+      return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 |
+             static_cast<uint32_t>(p[2]) << 8 | static_cast<uint32_t>(p[3]);
+    }
+
+    // A message in a lane. Blocks before tailStart are read where the
+    // message lies; the rest, its last bytes followed by the 0x80 marker and
+    // the length in bits, are padded into tail when the message starts.
+    struct LaneMessage
+    {
+      size_t index;
+      const uint8_t *data;
+      size_t tailStart;
+      size_t blocks;
+      size_t block;
+      uint8_t tail[2 * SHA256_BLOCK_LEN];
+
+      void Start(size_t messageIndex, const uint8_t *messageData, size_t size)
+      {
+        index = messageIndex;
+        data = messageData;
+        block = 0;
+        tailStart = size & ~(SHA256_BLOCK_LEN - 1);
+
+        size_t tailLen = size - tailStart;
+        size_t tailBlocks = tailLen + 9 <= SHA256_BLOCK_LEN ? 1 : 2;
+        blocks = tailStart / SHA256_BLOCK_LEN + tailBlocks;
+
+        std::memset(tail, 0, sizeof(tail));
+        if (tailLen > 0)
+        {
+          std::memcpy(tail, data + tailStart, tailLen);
+        }
+        tail[tailLen] = 0x80;
+        uint64_t bits = static_cast<uint64_t>(size) * 8;
+        uint8_t *end = tail + tailBlocks * SHA256_BLOCK_LEN;
+        for (int i = 0; i < 8; i++)
+        {
+          end[-1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+        }
+      }
+
+      const uint8_t *Block() const
+      {
+        size_t offset = block * SHA256_BLOCK_LEN;
+        return offset < tailStart ? data + offset : tail + (offset - tailStart);
+      }
+    };
+
+    // One block of every lane. state and words are laid out word by word,
+    // one column per lane, so each row loads as a vector.
+    template <typename V>
+    void CompressLanes(uint32_t state[8][V::LANES], const uint32_t words[16][V::LANES])
+    {
+      typedef typename V::Type T;
+
+      T w[16];
+      for (int t = 0; t < 16; t++)
+      {
+        w[t] = V::Load(words[t]);
+      }
+
+      T a = V::Load(state[0]), b = V::Load(state[1]), c = V::Load(state[2]), d = V::Load(state[3]);
+      T e = V::Load(state[4]), f = V::Load(state[5]), g = V::Load(state[6]), h = V::Load(state[7]);
+
+      // Unrolled, the schedule indexes and round constants become fixed and
+      // the 16 schedule words stay in registers
+#pragma GCC unroll 64
+      for (int t = 0; t < 64; t++)
+      {
+        // The message schedule only needs the last 16 words
+        if (t >= 16)
+        {
+          T w15 = w[(t - 15) & 15];
+          T w2 = w[(t - 2) & 15];
+          T s0 = V::Xor3(V::template Rotr<7>(w15), V::template Rotr<18>(w15), V::template Shr<3>(w15));
+          T s1 = V::Xor3(V::template Rotr<17>(w2), V::template Rotr<19>(w2), V::template Shr<10>(w2));
+          w[t & 15] = V::Add(V::Add(w[t & 15], s0), V::Add(w[(t - 7) & 15], s1));
+        }
+
+        T sum1 = V::Xor3(V::template Rotr<6>(e), V::template Rotr<11>(e), V::template Rotr<25>(e));
+        T t1 = V::Add(V::Add(h, sum1), V::Add(V::Ch(e, f, g), V::Add(V::Set1(SHA256_K[t]), w[t & 15])));
+        T sum0 = V::Xor3(V::template Rotr<2>(a), V::template Rotr<13>(a), V::template Rotr<22>(a));
+        T t2 = V::Add(sum0, V::Maj(a, b, c));
+
+        h = g;
+        g = f;
+        f = e;
+        e = V::Add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = V::Add(t1, t2);
+      }
+
+      T finals[8] = {a, b, c, d, e, f, g, h};
+      for (int i = 0; i < 8; i++)
+      {
+        V::Store(state[i], V::Add(V::Load(state[i]), finals[i]));
+      }
+    }
+
+    template <typename V>
+    void HashLanes(const uint8_t *const *data, const size_t *sizes, size_t count,
+                   uint8_t (*digests)[SHA256_DIGEST_LEN])
+    {
+      const size_t lanes = V::LANES;
+      LaneMessage messages[V::LANES];
+      bool active[V::LANES];
+      uint32_t state[8][V::LANES];
+      uint32_t words[16][V::LANES];
+      std::memset(words, 0, sizeof(words));
+      size_t next = 0;
+
+      // Give a lane the next message, or leave it idle once all are taken
+      auto refill = [&](size_t lane)
+      {
+        active[lane] = next < count;
+        if (!active[lane])
+        {
+          return;
+        }
+        messages[lane].Start(next, data[next], sizes[next]);
+        next++;
+        for (int i = 0; i < 8; i++)
+        {
+          state[i][lane] = SHA256_IV[i];
+        }
+      };
+
+      for (size_t lane = 0; lane < lanes; lane++)
+      {
+        refill(lane);
+      }
+
+      while (true)
+      {
+        // Idle lanes hash whatever their words hold and are ignored
+        bool any = false;
+        for (size_t lane = 0; lane < lanes; lane++)
+        {
+          if (!active[lane])
+          {
+            continue;
+          }
+          any = true;
+          const uint8_t *block = messages[lane].Block();
+          for (int t = 0; t < 16; t++)
+          {
+            words[t][lane] = LoadBigEndian(block + 4 * t);
+          }
+        }
+        if (!any)
+        {
+          return;
+        }
+
+        CompressLanes<V>(state, words);
+
+        for (size_t lane = 0; lane < lanes; lane++)
+        {
+          if (!active[lane] || ++messages[lane].block < messages[lane].blocks)
+          {
+            continue;
+          }
+          uint8_t *digest = digests[messages[lane].index];
+          for (int i = 0; i < 8; i++)
+          {
+            uint32_t word = state[i][lane];
+            digest[4 * i] = static_cast<uint8_t>(word >> 24);
+            digest[4 * i + 1] = static_cast<uint8_t>(word >> 16);
+            digest[4 * i + 2] = static_cast<uint8_t>(word >> 8);
+            digest[4 * i + 3] = static_cast<uint8_t>(word);
+          }
+          refill(lane);
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace utils
+{
+  // Multi-buffer SHA-256: one message per SIMD lane, so the 64 rounds of a
+  // block are run for 8 (AVX2) or 16 (AVX-512) messages by the same
+  // instructions. A lane that finishes its message is refilled with the next
+  // one, so messages of different lengths keep every lane busy.
+  //
+  // Each entry point is compiled for its instruction set alone (see
+  // CMakeLists.txt) and may only be called once the CPU is known to have it.
+  // digests[i] receives the SHA-256 of the sizes[i] bytes at data[i].
+
+  const size_t SHA256_DIGEST_LEN = 32;
+
+  void Sha256MultiAvx2(const uint8_t *const *data, const size_t *sizes, size_t count,
+                       uint8_t (*digests)[SHA256_DIGEST_LEN]);
+
+  void Sha256MultiAvx512(const uint8_t *const *data, const size_t *sizes, size_t count,
+                         uint8_t (*digests)[SHA256_DIGEST_LEN]);
+}
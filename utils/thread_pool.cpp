@@ -0,0 +1,123 @@
+#include "thread_pool.hpp"
+
+namespace utils
+{
+  namespace
+  {
+    // The pool and deque of the worker running on this thread, if any
+    thread_local const void *currentPool = nullptr;
+    thread_local size_t currentQueue = 0;
+  }
+
+  ThreadPool::ThreadPool(size_t workers)
+  {
+    workers = workers > 0 ? workers : 1;
+    for (size_t i = 0; i < workers; i++)
+    {
+      queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < workers; i++)
+    {
+      threads.emplace_back(&ThreadPool::Run, this, i);
+    }
+  }
+
+  ThreadPool::~ThreadPool()
+  {
+    Wait();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread : threads)
+    {
+      thread.join();
+    }
+  }
+
+  void ThreadPool::Submit(std::function<void()> task)
+  {
+    size_t index = currentPool == this ? currentQueue : nextQueue++ % queues.size();
+    pending++;
+    {
+      std::lock_guard<std::mutex> lock(queues[index]->mutex);
+      queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+      // Under the lock so a worker checking for work cannot miss the wakeup
+      std::lock_guard<std::mutex> lock(mutex);
+      queued++;
+    }
+    wake.notify_one();
+  }
+
+  void ThreadPool::Wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]()
+              { return pending == 0; });
+  }
+
+  bool ThreadPool::Take(size_t index, std::function<void()> &task)
+  {
+    {
+      Queue &own = *queues[index];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty())
+      {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return true;
+      }
+    }
+
+    for (size_t offset = 1; offset < queues.size(); offset++)
+    {
+      Queue &victim = *queues[(index + offset) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.tasks.empty())
+      {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        steals++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void ThreadPool::Run(size_t index)
+  {
+    currentPool = this;
+    currentQueue = index;
+
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this]()
+                  { return queued > 0 || stopping; });
+        if (stopping && queued == 0)
+        {
+          return;
+        }
+      }
+
+      std::function<void()> task;
+      if (!Take(index, task))
+      {
+        // Another worker got there first
+        continue;
+      }
+      queued--;
+      task();
+
+      if (--pending == 0)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.notify_all();
+      }
+    }
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace utils
+{
+  // Work-stealing thread pool. Every worker owns a deque: tasks submitted
+  // from a worker go to the back of its own deque and are taken from there
+  // (newest first, while their data is still in cache), and an idle worker
+  // steals the oldest task from another worker's front. Tasks submitted
+  // from outside the pool are spread over the deques round-robin.
+  class ThreadPool
+  {
+  public:
+    explicit ThreadPool(size_t workers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Queue a task, which may itself submit more tasks
+    void Submit(std::function<void()> task);
+
+    // Block until every submitted task, including ones submitted by tasks, has run
+    void Wait();
+
+    size_t Workers() const { return threads.size(); }
+
+    // Tasks a worker took from another worker's deque
+    size_t Steals() const { return steals; }
+
+  private:
+    struct Queue
+    {
+      std::deque<std::function<void()>> tasks;
+      std::mutex mutex;
+    };
+
+    void Run(size_t index);
+
+    // Take a task from the worker's own deque, or steal one
+    bool Take(size_t index, std::function<void()> &task);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake; // tasks were queued or the pool is stopping
+    std::condition_variable idle; // the last pending task finished
+    std::atomic<size_t> queued{0};  // submitted but not yet taken
+    std::atomic<size_t> pending{0}; // submitted but not yet finished
+    std::atomic<size_t> nextQueue{0};
+    std::atomic<size_t> steals{0};
+    bool stopping = false;
+  };
+}
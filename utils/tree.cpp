@@ -0,0 +1,377 @@
+#include "tree.hpp"
+#include "codec.hpp"
+#include "cache.hpp"
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace utils
+{
+  namespace
+  {
+    const char TREE_MAGIC[] = "\0microgit-tree 1\n";
+    const size_t TREE_MAGIC_SIZE = sizeof(TREE_MAGIC) - 1;
+
+    // Rewrite the directory at base with changes relative to it. Sets hash to
+    // the new tree, or to the null id when nothing is left in it.
+    bool UpdateDirectory(const ObjectId &base, const std::map<std::string, ObjectId> &changes,
+                         ObjectId &hash)
+    {
+      std::vector<TreeEntry> current;
+      if (!ReadTree(base, current))
+      {
+        return false;
+      }
+      std::map<std::string, TreeEntry> entries;
+      for (auto &entry : current)
+      {
+        entries[entry.name] = std::move(entry);
+      }
+
+      // Changes below a subdirectory are applied to it as a group
+      std::map<std::string, std::map<std::string, ObjectId>> subdirectories;
+      for (const auto &[path, blob] : changes)
+      {
+        size_t slash = path.find('/');
+        if (slash == std::string::npos)
+        {
+          if (blob.IsNull())
+          {
+            entries.erase(path);
+          }
+          else
+          {
+            entries[path] = {path, blob, false};
+          }
+          continue;
+        }
+        subdirectories[path.substr(0, slash)][path.substr(slash + 1)] = blob;
+      }
+
+      for (const auto &[name, subChanges] : subdirectories)
+      {
+        auto it = entries.find(name);
+        ObjectId subBase = it != entries.end() && it->second.directory ? it->second.hash : ObjectId();
+        ObjectId subHash;
+        if (!UpdateDirectory(subBase, subChanges, subHash))
+        {
+          return false;
+        }
+        if (subHash.IsNull())
+        {
+          entries.erase(name);
+        }
+        else
+        {
+          entries[name] = {name, subHash, true};
+        }
+      }
+
+      if (entries.empty())
+      {
+        hash = ObjectId();
+        return true;
+      }
+
+      std::vector<TreeEntry> updated;
+      updated.reserve(entries.size());
+      for (auto &entry : entries)
+      {
+        updated.push_back(std::move(entry.second));
+      }
+      hash = WriteTree(std::move(updated));
+      return !hash.IsNull();
+    }
+
+    bool Flatten(const ObjectId &hash, const std::string &prefix, std::map<std::string, ObjectId> &files)
+    {
+      std::vector<TreeEntry> entries;
+      if (!ReadTree(hash, entries))
+      {
+        return false;
+      }
+      for (const auto &entry : entries)
+      {
+        std::string path = prefix + entry.name;
+        if (!entry.directory)
+        {
+          files[path] = entry.hash;
+        }
+        else if (!Flatten(entry.hash, path + "/", files))
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool Find(const ObjectId &hash, const std::string &prefix, const std::set<std::string> &paths,
+              std::map<std::string, ObjectId> &files)
+    {
+      std::vector<TreeEntry> entries;
+      if (!ReadTree(hash, entries))
+      {
+        return false;
+      }
+
+      // Paths below a subdirectory are looked up in it as a group
+      std::map<std::string, std::set<std::string>> subdirectories;
+      for (const auto &path : paths)
+      {
+        size_t slash = path.find('/');
+        if (slash != std::string::npos)
+        {
+          subdirectories[path.substr(0, slash)].insert(path.substr(slash + 1));
+        }
+      }
+
+      for (const auto &entry : entries)
+      {
+        if (!entry.directory)
+        {
+          if (paths.count(entry.name))
+          {
+            files[prefix + entry.name] = entry.hash;
+          }
+          continue;
+        }
+        auto sub = subdirectories.find(entry.name);
+        if (sub != subdirectories.end() && !Find(entry.hash, prefix + entry.name + "/", sub->second, files))
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool Diff(const ObjectId &oldTree, const ObjectId &newTree, const std::string &prefix,
+              const TreeDiffFn &fn)
+    {
+      if (oldTree == newTree)
+      {
+        return true;
+      }
+
+      std::vector<TreeEntry> oldEntries, newEntries;
+      if (!ReadTree(oldTree, oldEntries) || !ReadTree(newTree, newEntries))
+      {
+        return false;
+      }
+
+      // Both lists are sorted by name, walk them together
+      static const TreeEntry none;
+      size_t i = 0, j = 0;
+      while (i < oldEntries.size() || j < newEntries.size())
+      {
+        int order = i == oldEntries.size()   ? 1
+                    : j == newEntries.size() ? -1
+                                             : oldEntries[i].name.compare(newEntries[j].name);
+        const TreeEntry &before = order <= 0 ? oldEntries[i] : none;
+        const TreeEntry &after = order >= 0 ? newEntries[j] : none;
+        const std::string &name = order <= 0 ? before.name : after.name;
+        i += order <= 0 ? 1 : 0;
+        j += order >= 0 ? 1 : 0;
+
+        if (before.hash == after.hash && before.directory == after.directory)
+        {
+          continue;
+        }
+
+        // A path that changed between file and directory is a removal plus an addition
+        std::string path = prefix + name;
+        ObjectId oldFile = before.directory ? ObjectId() : before.hash;
+        ObjectId newFile = after.directory ? ObjectId() : after.hash;
+        if (!Diff(before.directory ? before.hash : ObjectId(), after.directory ? after.hash : ObjectId(), path + "/", fn))
+        {
+          return false;
+        }
+        if (oldFile != newFile)
+        {
+          fn(path, oldFile, newFile);
+        }
+      }
+      return true;
+    }
+  }
+
+  bool IsTree(const std::vector<uint8_t> &content)
+  {
+    return content.size() >= TREE_MAGIC_SIZE && std::memcmp(content.data(), TREE_MAGIC, TREE_MAGIC_SIZE) == 0;
+  }
+
+  bool ParseTree(const std::vector<uint8_t> &content, std::vector<TreeEntry> &entries)
+  {
+    if (!IsTree(content))
+    {
+      return false;
+    }
+
+    entries.clear();
+    size_t pos = TREE_MAGIC_SIZE;
+    while (pos < content.size())
+    {
+      auto end = std::find(content.begin() + pos, content.end(), '\n');
+      std::string line(content.begin() + pos, end);
+      if (end == content.end() || line.size() < 4 || (line[0] != 'f' && line[0] != 'd') || line[1] != ' ')
+      {
+        return false;
+      }
+
+      size_t space = line.find(' ', 2);
+      if (space == std::string::npos || space + 1 == line.size())
+      {
+        return false;
+      }
+      TreeEntry entry{line.substr(space + 1), ObjectId(), line[0] == 'd'};
+      if (!ObjectId::FromHex(line.data() + 2, space - 2, entry.hash))
+      {
+        return false;
+      }
+      entries.push_back(std::move(entry));
+      pos = static_cast<size_t>(end - content.begin()) + 1;
+    }
+    return true;
+  }
+
+  bool ReadTree(const ObjectId &hash, std::vector<TreeEntry> &entries)
+  {
+    entries.clear();
+    if (hash.IsNull())
+    {
+      return true;
+    }
+
+    // Trees are read again by every command walking a SavePoint, keep them cached
+    auto content = ReadCachedObject(hash);
+    return content && ParseTree(*content, entries);
+  }
+
+  std::vector<uint8_t> SerializeTree(std::vector<TreeEntry> entries)
+  {
+    std::sort(entries.begin(), entries.end(), [](const TreeEntry &a, const TreeEntry &b)
+              { return a.name < b.name; });
+
+    std::string list(TREE_MAGIC, TREE_MAGIC_SIZE);
+    for (const auto &entry : entries)
+    {
+      list += entry.directory ? "d " : "f ";
+      list += entry.hash.Hex() + " " + entry.name + "\n";
+    }
+    return std::vector<uint8_t>(list.begin(), list.end());
+  }
+
+  ObjectId WriteTree(std::vector<TreeEntry> entries)
+  {
+    std::vector<uint8_t> content = SerializeTree(std::move(entries));
+    ObjectId hash = HashContent(content);
+    return WriteObject(hash, content, ObjectType::Tree) ? hash : ObjectId();
+  }
+
+  ObjectId UpdateTree(const ObjectId &base, const std::map<std::string, ObjectId> &changes)
+  {
+    ObjectId hash;
+    if (!UpdateDirectory(base, changes, hash))
+    {
+      return ObjectId();
+    }
+
+    // The root always exists, even when every file is gone
+    return hash.IsNull() ? WriteTree({}) : hash;
+  }
+
+  bool FlattenTree(const ObjectId &hash, std::map<std::string, ObjectId> &files)
+  {
+    files.clear();
+    return Flatten(hash, "", files);
+  }
+
+  bool DiffTrees(const ObjectId &oldTree, const ObjectId &newTree, const TreeDiffFn &fn)
+  {
+    return Diff(oldTree, newTree, "", fn);
+  }
+
+  bool ListTrees(const ObjectId &root, std::vector<ObjectId> &trees)
+  {
+    std::vector<ObjectId> pending = {root};
+    while (!pending.empty())
+    {
+      ObjectId hash = pending.back();
+      pending.pop_back();
+      if (hash.IsNull())
+      {
+        continue;
+      }
+
+      std::vector<TreeEntry> entries;
+      if (!ReadTree(hash, entries))
+      {
+        return false;
+      }
+      trees.push_back(hash);
+      for (const auto &entry : entries)
+      {
+        if (entry.directory)
+        {
+          pending.push_back(entry.hash);
+        }
+      }
+    }
+    return true;
+  }
+
+  bool SavePointFiles(const SavePoint &savePoint, std::map<std::string, ObjectId> &files)
+  {
+    if (savePoint.tree.IsNull())
+    {
+      // SavePoints written before trees list their files directly
+      files = savePoint.files;
+      return true;
+    }
+    return FlattenTree(savePoint.tree, files);
+  }
+
+  bool SavePointFindFiles(const SavePoint &savePoint, const std::set<std::string> &paths,
+                          std::map<std::string, ObjectId> &files)
+  {
+    files.clear();
+    if (savePoint.tree.IsNull())
+    {
+      for (const auto &[path, hash] : savePoint.files)
+      {
+        if (paths.count(path))
+        {
+          files[path] = hash;
+        }
+      }
+      return true;
+    }
+    return Find(savePoint.tree, "", paths, files);
+  }
+
+  std::string TreePath(const std::string &path)
+  {
+    fs::path normal = fs::path(path).lexically_normal();
+    if (normal.is_absolute())
+    {
+      return "";
+    }
+
+    std::string result;
+    for (const auto &part : normal)
+    {
+      std::string name = part.string();
+      if (name == "..")
+      {
+        return "";
+      }
+      if (name.empty() || name == ".")
+      {
+        continue;
+      }
+      result += (result.empty() ? "" : "/") + name;
+    }
+    return result;
+  }
+}
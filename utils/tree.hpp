@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <functional>
+#include "main.hpp"
+
+namespace utils
+{
+  // A SavePoint's files are stored as a Merkle tree with one object per
+  // directory, listing its entries sorted by name:
+  //   "\0microgit-tree 1\n" | "<f|d> <hash> <name>\n"...
+  // 'f' entries name a file's blob (or chunk list), 'd' entries a subtree.
+  // A tree's hash covers everything below it, so a save only writes the
+  // directories on the path to a changed file and shares every other subtree
+  // with its parent, and two trees can be compared by skipping equal hashes.
+
+  struct TreeEntry
+  {
+    std::string name;
+    ObjectId hash;
+    bool directory = false;
+  };
+
+  // Check whether object content is a tree
+  bool IsTree(const std::vector<uint8_t> &content);
+
+  // Parse a tree object, returns false if it is malformed
+  bool ParseTree(const std::vector<uint8_t> &content, std::vector<TreeEntry> &entries);
+
+  // Read a tree from the object store; the null id is the empty tree
+  bool ReadTree(const ObjectId &hash, std::vector<TreeEntry> &entries);
+
+  // The content of a tree object listing entries, in any order
+  std::vector<uint8_t> SerializeTree(std::vector<TreeEntry> entries);
+
+  // Store a tree and return its hash, or the null id on failure
+  ObjectId WriteTree(std::vector<TreeEntry> entries);
+
+  // Apply changes (path -> blob hash, the null id removes the path) to the
+  // tree at base and return the new root. Only directories that contain a
+  // change are read and rewritten. Returns the null id on failure.
+  ObjectId UpdateTree(const ObjectId &base, const std::map<std::string, ObjectId> &changes);
+
+  // Flatten a tree into path -> blob hash
+  bool FlattenTree(const ObjectId &hash, std::map<std::string, ObjectId> &files);
+
+  // Call fn(path, oldHash, newHash) for every file that differs between two
+  // trees (the null id means absent), without descending into subtrees
+  // whose hashes are equal
+  using TreeDiffFn = std::function<void(const std::string &path, const ObjectId &oldHash,
+                                        const ObjectId &newHash)>;
+  bool DiffTrees(const ObjectId &oldTree, const ObjectId &newTree, const TreeDiffFn &fn);
+
+  // Hashes of the tree objects reachable from root, root included
+  bool ListTrees(const ObjectId &root, std::vector<ObjectId> &trees);
+
+  // Every file recorded by a SavePoint, whether it has a tree or a flat file list
+  bool SavePointFiles(const SavePoint &savePoint, std::map<std::string, ObjectId> &files);
+
+  // The files among paths that a SavePoint records, reading only the
+  // directories on the way to them rather than the whole tree
+  bool SavePointFindFiles(const SavePoint &savePoint, const std::set<std::string> &paths,
+                          std::map<std::string, ObjectId> &files);
+
+  // Normalize a path for use in a tree: relative, '/'-separated and without
+  // "." components. Returns an empty string for paths outside the repository.
+  std::string TreePath(const std::string &path);
+}